@@ -0,0 +1,331 @@
+#include "alignment.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <thread>
+#include "overlap_kernel.h"
+
+// Framerate conversions tried when guessing; the identity comes first so it wins ties
+static const double framerate_ratios[] = {1.0,         25.0 / 23.976, 23.976 / 25.0, 25.0 / 24.0,
+                                          24.0 / 25.0, 24.0 / 23.976, 23.976 / 24.0};
+
+// Rates subtitles are usually timed for; each ratio above converts one of them into another
+static const double film_frame_rates[] = {23.976, 24.0, 25.0};
+
+// With the reference's frame rate known, the subtitle was timed either for that rate or for one of the other
+// usual ones, so three ratios instead of seven. High frame rate videos count as the rate they were doubled
+// from. Returns 0 for a rate that is none of the usual ones; then the whole table is tried.
+static size_t probed_framerate_ratios(double frame_rate, double *ratios) {
+    while (frame_rate > 30.0) {
+        frame_rate /= 2.0;
+    }
+    const double *match = nullptr;
+    for (const double &rate : film_frame_rates) {
+        if (std::fabs(frame_rate - rate) < 0.01) {
+            match = &rate;
+        }
+    }
+    if (!match) {
+        return 0;
+    }
+    size_t count = 0;
+    ratios[count++] = 1.0;
+    for (const double &rate : film_frame_rates) {
+        if (&rate != match) {
+            ratios[count++] = rate / *match;
+        }
+    }
+    return count;
+}
+
+static int64_t floor_div(int64_t value, int64_t step) {
+    int64_t quotient = value / step;
+    return (value % step != 0 && value < 0) ? quotient - 1 : quotient;
+}
+
+static int64_t scale_time(int64_t time, double ratio) {
+    return ratio == 1.0 ? time : static_cast<int64_t>(std::llround(time * ratio));
+}
+
+// Incorrect spans scaled by ratio, in grid steps
+static void to_grid(const std::vector<TimeSpan> &spans, double ratio, int64_t unit, std::vector<TimeSpan> &grid) {
+    grid.resize(spans.size());
+    for (size_t i = 0; i < spans.size(); ++i) {
+        grid[i].start = floor_div(scale_time(spans[i].start, ratio), unit);
+        grid[i].end = std::max(grid[i].start + 1, floor_div(scale_time(spans[i].end, ratio), unit));
+    }
+}
+
+// Prefix sums of the reference coverage over every position a shifted line can reach.
+// Returns the grid position of coverage[0].
+static int64_t rasterize_reference(const std::vector<TimeSpan> &reference, const std::vector<TimeSpan> &grid,
+                                   int64_t unit, int64_t half, std::vector<int32_t> &coverage) {
+    int64_t low = std::numeric_limits<int64_t>::max();
+    int64_t high = std::numeric_limits<int64_t>::min();
+    for (const auto &span : grid) {
+        low = std::min(low, span.start);
+        high = std::max(high, span.end);
+    }
+    low -= half;
+    high += half;
+
+    // Depth changes first, turned into prefix sums in place below
+    const size_t size = static_cast<size_t>(high - low);
+    coverage.assign(size + 1, 0);
+    for (const auto &span : reference) {
+        int64_t start = std::clamp(floor_div(span.start, unit), low, high);
+        int64_t end = std::clamp(floor_div(span.end, unit), low, high);
+        if (start < end) {
+            ++coverage[start - low];
+            --coverage[end - low];
+        }
+    }
+    int32_t depth = 0;
+    int32_t covered = 0;
+    for (size_t x = 0; x < size; ++x) {
+        depth += coverage[x];
+        coverage[x] = covered;
+        covered += depth > 0 ? 1 : 0;
+    }
+    coverage[size] = covered;
+    return low;
+}
+
+// out[k] += overlap ratio of span shifted by (k - half) steps, for every offset k
+static void add_line_scores(const std::vector<int32_t> &coverage, int64_t low, int64_t half, const TimeSpan &span,
+                            std::vector<double> &out) {
+    const int32_t *begin = coverage.data() + (span.start - half - low);
+    const int32_t *end = coverage.data() + (span.end - half - low);
+    add_overlap_scores(begin, end, 1.0 / static_cast<double>(span.end - span.start), out.data(), out.size());
+}
+
+static double line_score(const PreparedAlignment &prepared, const TimeSpan &span, size_t k) {
+    const int32_t *coverage = prepared.coverage.data() + k;
+    return (coverage[span.end - prepared.half - prepared.low] - coverage[span.start - prepared.half - prepared.low]) /
+           static_cast<double>(span.end - span.start);
+}
+
+// Highest value, ties going to the index closest to center (the unshifted timing)
+static size_t best_index(const std::vector<double> &values, size_t center) {
+    size_t best = 0;
+    for (size_t k = 1; k < values.size(); ++k) {
+        if (values[k] > values[best] ||
+            (values[k] == values[best] && std::llabs(static_cast<long long>(k) - static_cast<long long>(center)) <
+                                              std::llabs(static_cast<long long>(best) - static_cast<long long>(center)))) {
+            best = k;
+        }
+    }
+    return best;
+}
+
+void prepare_alignment(const std::vector<TimeSpan> &reference, const std::vector<TimeSpan> &incorrect,
+                       const AlignmentParams &params, PreparedAlignment &prepared) {
+    prepared.line_count = incorrect.size();
+    prepared.empty = incorrect.empty() || reference.empty();
+    prepared.framerate_ratio = 1.0;
+    prepared.constant_score = 0.0;
+    if (prepared.empty) {
+        return;
+    }
+
+    prepared.unit = std::max<int64_t>(1, params.resolution_ms);
+    prepared.half = std::max<int64_t>(0, params.max_offset_ms / prepared.unit);
+    prepared.constant_offset = static_cast<size_t>(prepared.half);
+    const size_t offset_count = static_cast<size_t>(2 * prepared.half + 1);
+    const double *ratios = framerate_ratios;
+    size_t ratio_count = params.guess_framerate ? sizeof(framerate_ratios) / sizeof(framerate_ratios[0]) : 1;
+    double probed_ratios[sizeof(film_frame_rates) / sizeof(film_frame_rates[0])];
+    if (params.guess_framerate && params.reference_frame_rate > 0.0) {
+        const size_t probed_count = probed_framerate_ratios(params.reference_frame_rate, probed_ratios);
+        if (probed_count > 0) {
+            ratios = probed_ratios;
+            ratio_count = probed_count;
+        }
+    }
+
+    // Best constant offset for every candidate framerate; the winner also seeds the split search
+    double best_total = -1.0;
+    for (size_t r = 0; r < ratio_count; ++r) {
+        to_grid(incorrect, ratios[r], prepared.unit, prepared.grid);
+        prepared.low = rasterize_reference(reference, prepared.grid, prepared.unit, prepared.half, prepared.coverage);
+        prepared.totals.assign(offset_count, 0.0);
+        for (const auto &span : prepared.grid) {
+            add_line_scores(prepared.coverage, prepared.low, prepared.half, span, prepared.totals);
+        }
+        size_t k = best_index(prepared.totals, static_cast<size_t>(prepared.half));
+        if (prepared.totals[k] > best_total) {
+            best_total = prepared.totals[k];
+            prepared.constant_offset = k;
+            prepared.framerate_ratio = ratios[r];
+        }
+    }
+    prepared.constant_score = best_total;
+
+    if (prepared.framerate_ratio != ratios[ratio_count - 1]) {
+        to_grid(incorrect, prepared.framerate_ratio, prepared.unit, prepared.grid);
+        prepared.low = rasterize_reference(reference, prepared.grid, prepared.unit, prepared.half, prepared.coverage);
+    }
+}
+
+// Best offset index per line of grid (lines of prepared or a subset of them) at the given penalty.
+// Returns the score and counts the splits.
+static double split_search(const PreparedAlignment &prepared, const std::vector<TimeSpan> &grid, double penalty,
+                           AlignmentWorkspace &workspace, std::vector<size_t> &chosen, size_t &splits) {
+    const int64_t half = prepared.half;
+    const size_t line_count = grid.size();
+    const size_t offset_count = static_cast<size_t>(2 * half + 1);
+    const size_t words = (offset_count + 63) / 64;
+
+    // previous[k]: best score of the lines so far with the last one shifted by offset k
+    workspace.previous.assign(offset_count, 0.0);
+    workspace.current.resize(offset_count);
+    workspace.jumps.assign(line_count * words, 0);
+    workspace.row_best.resize(line_count);
+    add_line_scores(prepared.coverage, prepared.low, half, grid[0], workspace.previous);
+    for (size_t i = 1; i < line_count; ++i) {
+        size_t best = best_index(workspace.previous, static_cast<size_t>(half));
+        workspace.row_best[i - 1] = static_cast<int32_t>(best);
+        const double jump = workspace.previous[best] - penalty;
+        uint64_t *bits = workspace.jumps.data() + i * words;
+        for (size_t k = 0; k < offset_count; ++k) {
+            if (jump > workspace.previous[k]) {
+                workspace.current[k] = jump;
+                bits[k >> 6] |= uint64_t(1) << (k & 63);
+            } else {
+                workspace.current[k] = workspace.previous[k];
+            }
+        }
+        add_line_scores(prepared.coverage, prepared.low, half, grid[i], workspace.current);
+        workspace.previous.swap(workspace.current);
+    }
+
+    // Walk back from the best final offset, following the segment starts
+    size_t k = best_index(workspace.previous, static_cast<size_t>(half));
+    const double score = workspace.previous[k];
+    chosen.resize(line_count);
+    splits = 0;
+    for (size_t i = line_count; i-- > 0;) {
+        chosen[i] = k;
+        if (i > 0 && (workspace.jumps[i * words + (k >> 6)] >> (k & 63)) & 1) {
+            k = static_cast<size_t>(workspace.row_best[i - 1]);
+            ++splits;
+        }
+    }
+    return score;
+}
+
+AlignmentResult align_prepared(const PreparedAlignment &prepared, double split_penalty,
+                               AlignmentWorkspace &workspace) {
+    AlignmentResult result;
+    result.offsets.assign(prepared.line_count, 0);
+    result.split_penalty = split_penalty;
+    if (prepared.empty) {
+        return result;
+    }
+    result.framerate_ratio = prepared.framerate_ratio;
+
+    if (split_penalty <= 0.0) {
+        std::fill(result.offsets.begin(), result.offsets.end(),
+                  (static_cast<int64_t>(prepared.constant_offset) - prepared.half) * prepared.unit);
+        result.score = prepared.constant_score;
+        result.overlap = prepared.constant_score;
+        return result;
+    }
+
+    std::vector<size_t> chosen;
+    result.score = split_search(prepared, prepared.grid, split_penalty / 10.0, workspace, chosen, result.splits);
+    for (size_t i = 0; i < chosen.size(); ++i) {
+        result.offsets[i] = (static_cast<int64_t>(chosen[i]) - prepared.half) * prepared.unit;
+        result.overlap += line_score(prepared, prepared.grid[i], chosen[i]);
+    }
+    return result;
+}
+
+AlignmentResult align_spans(const std::vector<TimeSpan> &reference, const std::vector<TimeSpan> &incorrect,
+                            const AlignmentParams &params, AlignmentWorkspace &workspace) {
+    prepare_alignment(reference, incorrect, params, workspace.prepared);
+    return align_prepared(workspace.prepared, params.split_penalty, workspace);
+}
+
+AlignmentResult sweep_split_penalties(const std::vector<TimeSpan> &reference, const std::vector<TimeSpan> &incorrect,
+                                      const AlignmentParams &params, std::vector<AlignmentWorkspace> &workspaces) {
+    workspaces.resize(std::max<size_t>(1, workspaces.size()));
+    if (params.sweep_penalties.empty()) {
+        return align_spans(reference, incorrect, params, workspaces[0]);
+    }
+
+    // The framerate guess and the raster are done once and shared by every variant
+    const size_t variants = params.sweep_penalties.size();
+    const size_t thread_count = std::max<size_t>(1, std::min<size_t>(params.sweep_threads, variants));
+    workspaces.resize(std::max(workspaces.size(), thread_count));
+    PreparedAlignment &prepared = workspaces[0].prepared;
+    prepare_alignment(reference, incorrect, params, prepared);
+    if (prepared.empty || prepared.grid.size() < 4) {
+        return align_prepared(prepared, params.split_penalty, workspaces[0]);
+    }
+
+    // A lower penalty always fits the lines it sees at least as well, so each variant is fitted on the
+    // even lines and judged on how well its offsets carry over to the odd ones in between. Real splits
+    // carry over, splits that only chase jitter don't. The penalty is halved for the half-size fit.
+    std::vector<TimeSpan> fit_lines;
+    std::vector<TimeSpan> held_out;
+    for (size_t i = 0; i < prepared.grid.size(); ++i) {
+        (i % 2 == 0 ? fit_lines : held_out).push_back(prepared.grid[i]);
+    }
+    std::vector<double> held_out_score(variants, 0.0);
+    std::vector<size_t> fit_splits(variants, 0);
+    std::atomic<size_t> next_variant{0};
+    auto worker = [&](size_t slot) {
+        std::vector<size_t> chosen;
+        for (size_t v = next_variant++; v < variants; v = next_variant++) {
+            const double penalty = params.sweep_penalties[v];
+            if (penalty <= 0.0) {
+                chosen.assign(fit_lines.size(), prepared.constant_offset);
+            } else {
+                split_search(prepared, fit_lines, penalty / 20.0, workspaces[slot], chosen, fit_splits[v]);
+            }
+            for (size_t j = 0; j < held_out.size(); ++j) {
+                held_out_score[v] += line_score(prepared, held_out[j], chosen[j]);
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t slot = 1; slot < thread_count; ++slot) {
+        threads.emplace_back(worker, slot);
+    }
+    worker(0);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    // Among the variants within the tolerance of the best held-out score keep the simplest one
+    const double best = *std::max_element(held_out_score.begin(), held_out_score.end());
+    const double threshold = best - sweep_tolerance * held_out.size();
+    size_t pick = variants;
+    for (size_t v = 0; v < variants; ++v) {
+        if (held_out_score[v] < threshold) {
+            continue;
+        }
+        if (pick == variants || fit_splits[v] < fit_splits[pick] ||
+            (fit_splits[v] == fit_splits[pick] && params.sweep_penalties[v] > params.sweep_penalties[pick])) {
+            pick = v;
+        }
+    }
+    return align_prepared(prepared, params.sweep_penalties[pick], workspaces[0]);
+}
+
+std::vector<double> default_penalty_sweep() {
+    return {1, 2, 4, 7, 12, 20, 35, 60, 100, 300};
+}
+
+std::vector<TimeSpan> apply_alignment(const std::vector<TimeSpan> &incorrect, const AlignmentResult &result) {
+    std::vector<TimeSpan> aligned(incorrect.size());
+    for (size_t i = 0; i < incorrect.size(); ++i) {
+        int64_t offset = i < result.offsets.size() ? result.offsets[i] : 0;
+        aligned[i].start = scale_time(incorrect[i].start, result.framerate_ratio) + offset;
+        aligned[i].end = scale_time(incorrect[i].end, result.framerate_ratio) + offset;
+    }
+    return aligned;
+}
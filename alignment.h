@@ -0,0 +1,82 @@
+#ifndef ALIGNMENT_H
+#define ALIGNMENT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Half-open interval [start, end) in milliseconds
+struct TimeSpan {
+    int64_t start = 0;
+    int64_t end = 0;
+};
+
+struct AlignmentParams {
+    double split_penalty = 7.0;          // cost of changing the offset between two lines; 0 = one constant offset
+    bool guess_framerate = true;         // also try the usual 23.976/24/25 fps conversions
+    double reference_frame_rate = 0.0;   // of a video reference, from its headers; narrows the guess, 0 = unknown
+    int64_t max_offset_ms = 120000;      // search window on either side of the original timing
+    int64_t resolution_ms = 10;          // offset grid and overlap granularity
+    std::vector<double> sweep_penalties; // when set, try each of these instead of split_penalty and keep the best
+    unsigned int sweep_threads = 1;
+};
+
+struct AlignmentResult {
+    std::vector<int64_t> offsets;  // one per incorrect span, added after the framerate ratio
+    double framerate_ratio = 1.0;
+    double split_penalty = 0.0;    // the penalty that produced this result
+    double score = 0.0;            // sum of the per-line overlap ratios minus the split costs
+    double overlap = 0.0;          // sum of the per-line overlap ratios alone
+    size_t splits = 0;
+};
+
+// Framerate guess and rasterized reference for one pair; every penalty tried on the pair shares it read-only
+struct PreparedAlignment {
+    size_t line_count = 0;
+    bool empty = true;              // nothing to align against, every offset stays 0
+    int64_t unit = 1;
+    int64_t half = 0;               // offsets run from -half to +half grid steps
+    int64_t low = 0;                // grid position of coverage[0]
+    double framerate_ratio = 1.0;
+    size_t constant_offset = 0;     // best single offset, as an index into the offset range
+    double constant_score = 0.0;
+    std::vector<TimeSpan> grid;     // incorrect spans scaled and in grid steps
+    std::vector<int32_t> coverage;  // prefix sums of the reference coverage
+    std::vector<double> totals;
+};
+
+// Scratch buffers of one aligner; a worker keeps one and reuses it for every job
+struct AlignmentWorkspace {
+    PreparedAlignment prepared;
+    std::vector<double> previous;
+    std::vector<double> current;
+    std::vector<uint64_t> jumps;  // one bit per line and offset: the line starts a new segment
+    std::vector<int32_t> row_best;
+};
+
+void prepare_alignment(const std::vector<TimeSpan> &reference, const std::vector<TimeSpan> &incorrect,
+                       const AlignmentParams &params, PreparedAlignment &prepared);
+
+// Shift each line so the total overlap is maximal, paying split_penalty / 10 (in lines of full overlap)
+// whenever two neighbouring lines get different offsets
+AlignmentResult align_prepared(const PreparedAlignment &prepared, double split_penalty,
+                               AlignmentWorkspace &workspace);
+
+// alass-style alignment of the incorrect spans onto the reference at params.split_penalty
+AlignmentResult align_spans(const std::vector<TimeSpan> &reference, const std::vector<TimeSpan> &incorrect,
+                            const AlignmentParams &params, AlignmentWorkspace &workspace);
+
+// Mean overlap ratio by which a sweep result may trail the best one and still count as a tie
+static const double sweep_tolerance = 0.005;
+
+// Align at every params.sweep_penalties value on up to params.sweep_threads threads, one workspace each.
+// The simplest result (highest penalty) whose mean overlap is within sweep_tolerance of the best one wins.
+AlignmentResult sweep_split_penalties(const std::vector<TimeSpan> &reference, const std::vector<TimeSpan> &incorrect,
+                                      const AlignmentParams &params, std::vector<AlignmentWorkspace> &workspaces);
+
+// Penalties tried by the sweep unless the config names its own
+std::vector<double> default_penalty_sweep();
+
+std::vector<TimeSpan> apply_alignment(const std::vector<TimeSpan> &incorrect, const AlignmentResult &result);
+
+#endif // ALIGNMENT_H
@@ -0,0 +1,507 @@
+#include "batch_cli.h"
+
+#include <algorithm>
+#include <csignal>
+#include <iterator>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <pthread.h>
+#include <string>
+#include <thread>
+#include "batch_journal.h"
+#include "episode_pattern.h"
+#include "job_farm.h"
+#include "span_cache.h"
+#include "sync_core.h"
+#include "trace.h"
+
+using json = nlohmann::json;
+
+static const char *usage_text =
+    "Usage: test_app --batch [options]\n"
+    "  --config FILE           read defaults from a sync_config.json (default: ./sync_config.json if present)\n"
+    "  --manifest FILE         JSON manifest: any config key, plus an optional \"jobs\" array of\n"
+    "                          {\"video\", \"subtitle\", \"output\"} objects that skips scanning and matching;\n"
+    "                          a job's optional \"reference\" subtitle is aligned against instead of the video\n"
+    "  --videos DIR            video folder\n"
+    "  --subtitles DIR         subtitle folder\n"
+    "  --video-regex RE        episode pattern for video names\n"
+    "  --subtitle-regex RE     episode pattern for subtitle names\n"
+    "  --video-index N         match index for the video pattern\n"
+    "  --subtitle-index N      match index for the subtitle pattern\n"
+    "  --reference-regex RE    subtitles whose names match are trusted, already synced tracks; other subtitles\n"
+    "                          of their episode are aligned against them instead of the video\n"
+    "  --match-full-path       run the patterns on the path below the folder, e.g. Season 01/Show - 05.mkv,\n"
+    "                          instead of the file name\n"
+    "  --split-penalty X       split penalty (0 = one constant offset with the built-in aligner)\n"
+    "  --disable-fps-guessing  turn off framerate guessing\n"
+    "  --engine alass|native   run alass (default), or align in-process where possible with the experimental\n"
+    "                          built-in aligner\n"
+    "  --sweep                 try several split penalties per pair and keep the best (native engine)\n"
+    "  --sweep-penalties LIST  comma separated penalties for --sweep, e.g. 1,7,30\n"
+    "  --workers N             parallel jobs (0 = hardware concurrency)\n"
+    "  --depth N               subfolder depth to scan (negative = unlimited)\n"
+    "  --no-cache              ignore and don't update the sync cache\n"
+    "  --dry-run               print the jobs without running them\n"
+    "  --resume                run what an interrupted batch left unfinished, from its journal\n"
+    "  --trace FILE            write a Chrome trace of the run to FILE and print per-stage timings\n"
+    "  --serve ADDRESS         hand the jobs to --worker processes instead of running them here; ADDRESS\n"
+    "                          is unix:/path/to/socket or host:port\n"
+    "  --worker ADDRESS        run jobs for the coordinator at ADDRESS, --workers at a time, until killed;\n"
+    "                          videos and subtitles must be reachable under the same paths as there\n"
+    "  --once                  with --worker, exit after the first batch\n"
+    "Results are printed as one JSON object per line.\n";
+
+namespace {
+    struct CliOptions {
+        std::string config_file = "sync_config.json";
+        bool config_given = false;
+        std::string manifest_file;
+        bool use_cache = true;
+        bool dry_run = false;
+        bool resume = false;
+        std::string serve_address;
+        std::string worker_address;
+        bool once = false;
+    };
+
+    // Serializes the JSON lines written from the worker threads
+    std::mutex output_mutex;
+
+    void emit(const json &line) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cout << line.dump() << std::endl;
+    }
+
+    bool read_json_file(const std::string &path, json &data) {
+        std::ifstream file(path);
+        if (!file) {
+            std::cerr << "Cannot open " << path << std::endl;
+            return false;
+        }
+        try {
+            file >> data;
+        } catch (const json::parse_error &e) {
+            std::cerr << "Cannot parse " << path << ": " << e.what() << std::endl;
+            return false;
+        }
+        return data.is_object();
+    }
+
+    bool parse_int(const char *text, int &value) {
+        char *end = nullptr;
+        long parsed = std::strtol(text, &end, 10);
+        if (end == text || *end != '\0') {
+            return false;
+        }
+        value = static_cast<int>(parsed);
+        return true;
+    }
+
+    // Export the trace and print the per-stage percentiles as one line
+    void emit_trace(const std::string &path) {
+        const std::vector<TraceEvent> events = trace_collect(true);
+        std::string error;
+        if (!write_chrome_trace(path, events, error)) {
+            std::cerr << error << std::endl;
+        }
+        json stages = json::array();
+        for (const auto &stage : summarize_trace(events)) {
+            stages.push_back({{"stage", stage.name}, {"count", stage.count}, {"total_ms", stage.total_ms},
+                              {"p50_ms", stage.p50_ms}, {"p95_ms", stage.p95_ms}, {"max_ms", stage.max_ms}});
+        }
+        emit({{"event", "stages"}, {"trace_file", path}, {"stages", stages}});
+    }
+
+    // Flags are applied on top of the config and manifest, so they are parsed last
+    bool parse_flags(int argc, char *argv[], CliOptions &cli, json &overrides) {
+        for (int i = 2; i < argc; ++i) {
+            const std::string flag = argv[i];
+            const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+            int number = 0;
+
+            if (flag == "--disable-fps-guessing") {
+                overrides["disable_fps_guessing"] = true;
+                continue;
+            }
+            if (flag == "--match-full-path") {
+                overrides["match_full_path"] = true;
+                continue;
+            }
+            if (flag == "--sweep") {
+                overrides["sweep_split_penalty"] = true;
+                continue;
+            }
+            if (flag == "--no-cache") {
+                cli.use_cache = false;
+                continue;
+            }
+            if (flag == "--dry-run") {
+                cli.dry_run = true;
+                continue;
+            }
+            if (flag == "--resume") {
+                cli.resume = true;
+                continue;
+            }
+            if (flag == "--once") {
+                cli.once = true;
+                continue;
+            }
+            static const char *value_flags[] = {"--config", "--manifest", "--videos", "--subtitles",
+                                                "--video-regex", "--subtitle-regex", "--reference-regex",
+                                                "--video-index",
+                                                "--subtitle-index", "--split-penalty", "--engine", "--sweep-penalties",
+                                                "--workers", "--depth", "--trace", "--serve", "--worker"};
+            if (std::find(std::begin(value_flags), std::end(value_flags), flag) == std::end(value_flags)) {
+                std::cerr << "Unknown option " << flag << std::endl;
+                return false;
+            }
+            if (!value) {
+                std::cerr << "Missing value for " << flag << std::endl;
+                return false;
+            }
+            ++i;
+
+            if (flag == "--config") {
+                cli.config_file = value;
+                cli.config_given = true;
+            } else if (flag == "--manifest") {
+                cli.manifest_file = value;
+            } else if (flag == "--videos") {
+                overrides["video_folder"] = value;
+            } else if (flag == "--subtitles") {
+                overrides["srt_folder"] = value;
+            } else if (flag == "--video-regex") {
+                overrides["video_regex"] = value;
+            } else if (flag == "--subtitle-regex") {
+                overrides["subtitle_regex"] = value;
+            } else if (flag == "--reference-regex") {
+                overrides["reference_regex"] = value;
+            } else if (flag == "--trace") {
+                overrides["trace_file"] = value;
+            } else if (flag == "--serve" || flag == "--worker") {
+                FarmAddress address;
+                if (!parse_farm_address(value, address)) {
+                    std::cerr << "Invalid address for " << flag << ", expected unix:PATH or HOST:PORT" << std::endl;
+                    return false;
+                }
+                (flag == "--serve" ? cli.serve_address : cli.worker_address) = value;
+            } else if (flag == "--engine") {
+                if (std::strcmp(value, "native") != 0 && std::strcmp(value, "alass") != 0) {
+                    std::cerr << "--engine must be native or alass" << std::endl;
+                    return false;
+                }
+                overrides["alignment_engine"] = value;
+            } else if (flag == "--sweep-penalties") {
+                std::vector<double> penalties;
+                if (!parse_penalty_list(value, penalties)) {
+                    std::cerr << "Invalid penalty list for " << flag << std::endl;
+                    return false;
+                }
+                overrides["split_penalty_sweep"] = penalties;
+                overrides["sweep_split_penalty"] = true;
+            } else if (flag == "--split-penalty") {
+                char *end = nullptr;
+                double penalty = std::strtod(value, &end);
+                if (end == value || *end != '\0') {
+                    std::cerr << "Invalid number for " << flag << std::endl;
+                    return false;
+                }
+                overrides["split_penalty"] = penalty;
+            } else if (flag == "--video-index" || flag == "--subtitle-index" || flag == "--workers" ||
+                       flag == "--depth") {
+                if (!parse_int(value, number)) {
+                    std::cerr << "Invalid number for " << flag << std::endl;
+                    return false;
+                }
+                const char *key = flag == "--video-index"      ? "video_match_index"
+                                  : flag == "--subtitle-index" ? "subtitle_match_index"
+                                  : flag == "--workers"        ? "worker_count"
+                                                               : "scan_depth";
+                overrides[key] = number;
+            }
+        }
+        return true;
+    }
+
+    bool read_manifest_jobs(const json &manifest, std::vector<SyncJob> &jobs) {
+        for (const auto &item : manifest["jobs"]) {
+            if (!item.is_object() || !item.contains("video") || !item.contains("subtitle") ||
+                !item.contains("output") || !item["video"].is_string() || !item["subtitle"].is_string() ||
+                !item["output"].is_string()) {
+                std::cerr << "Manifest jobs need string \"video\", \"subtitle\" and \"output\" fields" << std::endl;
+                return false;
+            }
+            jobs.push_back({item["video"].get<std::string>(), item["subtitle"].get<std::string>(),
+                            item["output"].get<std::string>(), item.value("reference", std::string())});
+        }
+        return true;
+    }
+
+    json job_line(const SyncJob &job, size_t index) {
+        json line = {{"event", "job"}, {"index", index}, {"video", job.video_file}, {"subtitle", job.subtitle_file},
+                     {"output", job.output_file}};
+        if (!job.reference_file.empty()) {
+            line["reference"] = job.reference_file;
+        }
+        return line;
+    }
+
+    const char *job_status(const JobResult &result) {
+        if (result.cached) {
+            return "cached";
+        }
+        if (result.success) {
+            return "ok";
+        }
+        return result.cancelled ? "cancelled" : "failed";
+    }
+
+    void emit_job_result(const SyncJob &job, const JobResult &result) {
+        json line = job_line(job, result.job_index);
+        line["status"] = job_status(result);
+        if (!result.cached) {
+            line["engine"] = result.native ? "native" : "alass";
+            line["split_penalty"] = result.split_penalty;
+        }
+        line["exit_code"] = result.exit_code;
+        if (!result.error.empty()) {
+            line["error"] = result.error;
+        }
+        if (!result.output.empty()) {
+            line["alass_output"] = result.output;
+        }
+        line["seconds"] = result.seconds;
+        if (!result.cached) {
+            line["cpu_seconds"] = result.cpu_seconds;
+        }
+        if (result.max_rss_kb > 0) {
+            line["max_rss_kb"] = result.max_rss_kb;
+        }
+        emit(line);
+    }
+
+    // SIGINT/SIGTERM are taken by a watcher thread that calls on_signal; the children get a clean mask
+    std::thread start_signal_watcher(const std::function<void()> &on_signal) {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        sigaddset(&signals, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        return std::thread([signals, on_signal]() {
+            int received = 0;
+            if (sigwait(&signals, &received) == 0 && received != SIGUSR1) {
+                on_signal();
+            }
+        });
+    }
+
+    // Wake the watcher so it can exit
+    void stop_signal_watcher(std::thread &watcher) {
+        pthread_kill(watcher.native_handle(), SIGUSR1);
+        watcher.join();
+    }
+
+    // Pull jobs from a coordinator until killed, or until its batch is over with --once
+    int run_worker(const CliOptions &cli, const SyncRequest &request) {
+        FarmAddress address;
+        parse_farm_address(cli.worker_address, address);
+        BatchSettings settings = make_batch_settings(request);
+        settings.span_cache_dir = span_cache_dir(cli.config_file);
+
+        std::atomic<bool> stop{false};
+        std::thread watcher = start_signal_watcher([&stop]() {
+            stop = true;
+            interrupt_job_workers();
+        });
+        emit({{"event", "worker_ready"}, {"coordinator", cli.worker_address}, {"slots", settings.worker_count}});
+        BatchCallbacks callbacks;
+        callbacks.on_finished = emit_job_result;
+        run_job_worker(address, settings.worker_count, settings, cli.once, stop, callbacks);
+        stop_signal_watcher(watcher);
+        return stop ? BATCH_EXIT_CANCELLED : BATCH_EXIT_OK;
+    }
+}
+
+bool is_batch_cli_invocation(int argc, char *argv[]) {
+    return argc > 1 && std::strcmp(argv[1], "--batch") == 0;
+}
+
+int run_batch_cli(int argc, char *argv[]) {
+    CliOptions cli;
+    json overrides = json::object();
+    for (int i = 2; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--help") == 0) {
+            std::cout << usage_text;
+            return BATCH_EXIT_OK;
+        }
+    }
+    if (!parse_flags(argc, argv, cli, overrides)) {
+        std::cerr << usage_text;
+        return BATCH_EXIT_USAGE;
+    }
+
+    // Config first, then the manifest, then the flags
+    SyncRequest request;
+    json config;
+    if (cli.config_given || std::ifstream(cli.config_file)) {
+        if (!read_json_file(cli.config_file, config)) {
+            return BATCH_EXIT_USAGE;
+        }
+        read_sync_request(config, request);
+    }
+    json manifest;
+    if (!cli.manifest_file.empty()) {
+        if (!read_json_file(cli.manifest_file, manifest)) {
+            return BATCH_EXIT_USAGE;
+        }
+        read_sync_request(manifest, request);
+    }
+    read_sync_request(overrides, request);
+    trace_enable(!request.settings.trace_file.empty());
+    trace_set_thread_name("main");
+    if (!cli.worker_address.empty()) {
+        return run_worker(cli, request);
+    }
+    if (request.sweep_split_penalty && request.alignment.engine != ENGINE_NATIVE) {
+        emit({{"event", "warning"},
+              {"message", "the split penalty sweep needs --engine native; alass runs every job with one penalty"}});
+    }
+
+    // A resumed batch runs with the options it was started with
+    const std::string journal_path = batch_journal_path(cli.config_file);
+    std::vector<SyncJob> jobs;
+    if (cli.resume) {
+        JournalResume resume;
+        if (load_batch_journal(journal_path, resume)) {
+            jobs = std::move(resume.jobs);
+            request.alignment = resume.alignment;
+        } else {
+            discard_batch_journal(journal_path);
+        }
+        emit({{"event", "resume"}, {"journal", journal_path}, {"jobs", resume.total}, {"finished", resume.finished},
+              {"remaining", jobs.size()}});
+    } else if (manifest.is_object() && manifest.contains("jobs") && manifest["jobs"].is_array()) {
+        if (!read_manifest_jobs(manifest, jobs)) {
+            return BATCH_EXIT_USAGE;
+        }
+    } else {
+        if (request.video_folder.empty() || request.srt_folder.empty()) {
+            std::cerr << "Both --videos and --subtitles (or a manifest/config naming them) are required" << std::endl;
+            return BATCH_EXIT_USAGE;
+        }
+        if (!compile_episode_pattern(request.video_regex) || !compile_episode_pattern(request.subtitle_regex)) {
+            std::cerr << "One or both regex patterns are invalid" << std::endl;
+            return BATCH_EXIT_USAGE;
+        }
+        if (!request.reference_regex.empty() && !compile_episode_pattern(request.reference_regex)) {
+            std::cerr << "The reference regex is invalid" << std::endl;
+            return BATCH_EXIT_USAGE;
+        }
+
+        std::vector<ScanError> errors;
+        const FileCatalog video_files =
+            scan_folder(request.video_folder, make_scan_options(request.settings, true), &errors);
+        const FileCatalog subtitle_files =
+            scan_folder(request.srt_folder, make_scan_options(request.settings, false), &errors);
+        for (const auto &error : errors) {
+            emit({{"event", "scan_error"}, {"path", error.path}, {"message", error.message}});
+        }
+
+        const MatchedLibrary library = match_library(request, video_files, subtitle_files);
+        for (const auto &conflict : library.match.conflicts) {
+            emit({{"event", "conflict"}, {"key", format_episode_key(conflict.key)}, {"videos", conflict.videos},
+                  {"subtitles", conflict.subtitles}});
+        }
+        emit({{"event", "matched"}, {"videos", video_files.size()}, {"subtitles", subtitle_files.size()},
+              {"video_keys", library.video_matches}, {"subtitle_keys", library.subtitle_matches},
+              {"pairs", library.match.pairs}, {"reference_pairs", library.match.reference_pairs},
+              {"conflicts", library.match.conflicts.size()}});
+        jobs = build_sync_jobs(request, video_files, subtitle_files, library);
+    }
+
+    if (jobs.empty()) {
+        emit({{"event", "summary"}, {"jobs", 0}});
+        return BATCH_EXIT_NO_JOBS;
+    }
+    if (cli.dry_run) {
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            json line = job_line(jobs[i], i);
+            line["status"] = "planned";
+            emit(line);
+        }
+        return BATCH_EXIT_OK;
+    }
+
+    SyncCache cache;
+    BatchSettings settings = make_batch_settings(request);
+    settings.span_cache_dir = span_cache_dir(cli.config_file);
+    if (cli.use_cache) {
+        load_sync_cache(cache, sync_cache_path(cli.config_file));
+        settings.cache = &cache;
+    }
+    BatchJournal journal;
+    if (open_batch_journal(journal, journal_path, jobs, settings.alignment)) {
+        settings.journal = &journal;
+    } else {
+        std::cerr << "Cannot write the batch journal " << journal_path << ", the batch can't be resumed" << std::endl;
+    }
+
+    BatchControl control;
+    std::thread watcher = start_signal_watcher([&control]() { cancel_batch(control); });
+
+    BatchCallbacks callbacks;
+    callbacks.on_progress = [](const SyncJob &, size_t job_index, double fraction) {
+        emit({{"event", "progress"}, {"index", job_index}, {"fraction", fraction}});
+    };
+    callbacks.on_finished = emit_job_result;
+    BatchReport report;
+    if (cli.serve_address.empty()) {
+        report = run_sync_jobs(jobs, settings, &control, callbacks);
+    } else {
+        FarmAddress address;
+        parse_farm_address(cli.serve_address, address);
+        emit({{"event", "serving"}, {"address", cli.serve_address}, {"jobs", jobs.size()}});
+        std::vector<FarmWorkerStats> workers;
+        std::string error;
+        report = run_job_coordinator(address, jobs, settings, FarmSettings(), &control, callbacks, workers, error);
+        if (!error.empty()) {
+            std::cerr << error << std::endl;
+            stop_signal_watcher(watcher);
+            close_batch_journal(journal, true);
+            return BATCH_EXIT_USAGE;
+        }
+        for (const auto &worker : workers) {
+            const double minutes = worker.connected_seconds / 60.0;
+            emit({{"event", "worker"}, {"worker", worker.worker}, {"succeeded", worker.succeeded},
+                  {"failed", worker.failed}, {"lost", worker.lost}, {"busy_seconds", worker.busy_seconds},
+                  {"connected_seconds", worker.connected_seconds},
+                  {"jobs_per_minute", minutes > 0.0 ? (worker.succeeded + worker.failed) / minutes : 0.0}});
+        }
+    }
+
+    stop_signal_watcher(watcher);
+    close_batch_journal(journal, report.cancelled == 0);
+
+    if (settings.cache && !save_sync_cache(cache)) {
+        std::cerr << "Could not write the sync cache to " << cache.path << std::endl;
+    }
+
+    emit({{"event", "summary"}, {"jobs", jobs.size()}, {"succeeded", report.succeeded}, {"cached", report.cached},
+          {"failed", report.failed}, {"cancelled", report.cancelled}, {"unswept", report.unswept},
+          {"workers", report.worker_count}, {"wall_seconds", report.wall_seconds}});
+    if (trace_enabled()) {
+        emit_trace(request.settings.trace_file);
+    }
+
+    if (control.cancelled) {
+        return BATCH_EXIT_CANCELLED;
+    }
+    return report.failed > 0 ? BATCH_EXIT_JOB_FAILED : BATCH_EXIT_OK;
+}
@@ -0,0 +1,19 @@
+#ifndef BATCH_CLI_H
+#define BATCH_CLI_H
+
+// Exit codes of the headless batch mode
+enum BatchExitCode {
+    BATCH_EXIT_OK = 0,
+    BATCH_EXIT_JOB_FAILED = 1,  // at least one job failed
+    BATCH_EXIT_USAGE = 2,       // bad flags, manifest or config
+    BATCH_EXIT_NO_JOBS = 3,     // nothing matched
+    BATCH_EXIT_CANCELLED = 130  // interrupted by SIGINT/SIGTERM
+};
+
+// True when argv asks for the headless batch mode (first argument --batch)
+bool is_batch_cli_invocation(int argc, char *argv[]);
+
+// Scan, match and sync without GTK, printing one JSON object per line on stdout
+int run_batch_cli(int argc, char *argv[]);
+
+#endif // BATCH_CLI_H
@@ -0,0 +1,218 @@
+#include "batch_journal.h"
+
+#include <filesystem>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include "nlohmann/json.hpp"
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+// Lines written between two fdatasync calls, at most
+static const size_t journal_sync_lines = 32;
+static const auto journal_sync_interval = std::chrono::seconds(1);
+
+std::string batch_journal_path(const std::string &config_file) {
+    return (fs::path(config_file).parent_path() / "sync_journal.jsonl").string();
+}
+
+static json fingerprint_json(const FileFingerprint &fingerprint) {
+    return {fingerprint.size, fingerprint.mtime_ns, fingerprint.hash};
+}
+
+static bool read_fingerprint(const json &value, FileFingerprint &fingerprint) {
+    if (!value.is_array() || value.size() != 3 || !value[0].is_number_unsigned() || !value[1].is_number_integer() ||
+        !value[2].is_number_unsigned()) {
+        return false;
+    }
+    fingerprint.size = value[0].get<uint64_t>();
+    fingerprint.mtime_ns = value[1].get<int64_t>();
+    fingerprint.hash = value[2].get<uint64_t>();
+    return true;
+}
+
+static bool write_all(int fd, const std::string &data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t count = write(fd, data.data() + written, data.size() - written);
+        if (count <= 0) {
+            return false;
+        }
+        written += static_cast<size_t>(count);
+    }
+    return true;
+}
+
+static void append_line(BatchJournal &journal, const json &line) {
+    std::lock_guard<std::mutex> lock(journal.mutex);
+    if (journal.fd == -1) {
+        return;
+    }
+    // One write per line, so a crash tears at most the last one
+    write_all(journal.fd, line.dump() + "\n");
+    const auto now = std::chrono::steady_clock::now();
+    if (++journal.unsynced >= journal_sync_lines || now - journal.last_sync >= journal_sync_interval) {
+        fdatasync(journal.fd);
+        journal.unsynced = 0;
+        journal.last_sync = now;
+    }
+}
+
+bool open_batch_journal(BatchJournal &journal, const std::string &path, const std::vector<SyncJob> &jobs,
+                        const AlignmentOptions &alignment) {
+    json job_list = json::array();
+    for (const auto &job : jobs) {
+        json item = {job.video_file, job.subtitle_file, job.output_file};
+        if (!job.reference_file.empty()) {
+            item.push_back(job.reference_file);
+        }
+        job_list.push_back(item);
+    }
+    const json begin = {{"event", "begin"},
+                        {"jobs", job_list},
+                        {"split_penalty", alignment.split_penalty},
+                        {"disable_fps_guessing", alignment.disable_fps_guessing},
+                        {"engine", alignment.engine == ENGINE_ALASS ? "alass" : "native"},
+                        {"penalty_sweep", alignment.penalty_sweep}};
+
+    std::lock_guard<std::mutex> lock(journal.mutex);
+    journal.path = path;
+    journal.fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (journal.fd == -1) {
+        return false;
+    }
+    if (!write_all(journal.fd, begin.dump() + "\n") || fdatasync(journal.fd) != 0) {
+        close(journal.fd);
+        journal.fd = -1;
+        unlink(path.c_str());
+        return false;
+    }
+    journal.unsynced = 0;
+    journal.last_sync = std::chrono::steady_clock::now();
+    return true;
+}
+
+void journal_job_running(BatchJournal &journal, size_t job_index) {
+    append_line(journal, {{"event", "running"}, {"job", job_index}});
+}
+
+void journal_job_done(BatchJournal &journal, size_t job_index, const std::string &output_file,
+                      const FileFingerprint &video, const FileFingerprint &subtitle) {
+    append_line(journal, {{"event", "done"},
+                          {"job", job_index},
+                          {"output", output_file},
+                          {"video", fingerprint_json(video)},
+                          {"subtitle", fingerprint_json(subtitle)}});
+}
+
+void journal_job_failed(BatchJournal &journal, size_t job_index, int exit_code) {
+    append_line(journal, {{"event", "failed"}, {"job", job_index}, {"exit_code", exit_code}});
+}
+
+void close_batch_journal(BatchJournal &journal, bool every_job_ended) {
+    std::lock_guard<std::mutex> lock(journal.mutex);
+    if (journal.fd == -1) {
+        return;
+    }
+    fdatasync(journal.fd);
+    close(journal.fd);
+    journal.fd = -1;
+    if (every_job_ended) {
+        unlink(journal.path.c_str());
+    }
+}
+
+// A done job only counts while its output is there and its inputs are the ones it was synced from
+static bool still_done(const SyncJob &job, const json &done) {
+    FileFingerprint video;
+    FileFingerprint subtitle;
+    FileFingerprint current;
+    if (!done.contains("video") || !done.contains("subtitle") || !read_fingerprint(done["video"], video) ||
+        !read_fingerprint(done["subtitle"], subtitle) || !fs::exists(job.output_file)) {
+        return false;
+    }
+    if (!fingerprint_file(job_reference(job), current) || current.hash != video.hash ||
+        current.mtime_ns != video.mtime_ns) {
+        return false;
+    }
+    return fingerprint_file(job.subtitle_file, current) && current.hash == subtitle.hash &&
+           current.mtime_ns == subtitle.mtime_ns;
+}
+
+// Temporary outputs the interrupted batch left behind for a job, from alass (".partial-PID-N-name") or the
+// native writer ("name.partial-PID-N")
+static void remove_partial_outputs(const SyncJob &job) {
+    const fs::path output = job.output_file;
+    const std::string name = output.filename().string();
+    const fs::path parent = output.parent_path().empty() ? fs::path(".") : output.parent_path();
+    std::error_code ec;
+    for (fs::directory_iterator it(parent, ec), end; !ec && it != end; it.increment(ec)) {
+        const std::string entry = it->path().filename().string();
+        const bool from_alass = entry.rfind(".partial-", 0) == 0 && entry.size() > name.size() + 1 &&
+                                entry.compare(entry.size() - name.size() - 1, std::string::npos, "-" + name) == 0;
+        const bool from_native = entry.rfind(name + ".partial-", 0) == 0;
+        if (from_alass || from_native) {
+            std::error_code remove_ec;
+            fs::remove(it->path(), remove_ec);
+        }
+    }
+}
+
+bool load_batch_journal(const std::string &path, JournalResume &resume) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::vector<SyncJob> jobs;
+    std::vector<json> done;
+    std::string text;
+    bool begun = false;
+    while (std::getline(file, text)) {
+        const json line = json::parse(text, nullptr, false);
+        if (line.is_discarded() || !line.is_object() || !line.contains("event")) {
+            continue;
+        }
+        try {
+            const std::string event = line["event"].get<std::string>();
+            if (event == "begin") {
+                for (const auto &item : line["jobs"]) {
+                    jobs.push_back({item[0].get<std::string>(), item[1].get<std::string>(),
+                                    item[2].get<std::string>(),
+                                    item.size() > 3 ? item[3].get<std::string>() : std::string()});
+                }
+                resume.alignment.split_penalty = line["split_penalty"].get<double>();
+                resume.alignment.disable_fps_guessing = line["disable_fps_guessing"].get<bool>();
+                resume.alignment.engine = line["engine"] == "native" ? ENGINE_NATIVE : ENGINE_ALASS;
+                resume.alignment.penalty_sweep = line["penalty_sweep"].get<std::vector<double>>();
+                done.assign(jobs.size(), json());
+                begun = true;
+            } else if (begun && line.contains("job") && line["job"].get<size_t>() < jobs.size()) {
+                // The latest line of a job decides its state; a retried job may fail after it was done
+                done[line["job"].get<size_t>()] = event == "done" ? line : json();
+            }
+        } catch (const json::exception &) {
+            continue;
+        }
+    }
+    if (!begun) {
+        return false;
+    }
+
+    resume.total = jobs.size();
+    resume.finished = 0;
+    resume.jobs.clear();
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        if (!done[i].is_null() && still_done(jobs[i], done[i])) {
+            ++resume.finished;
+        } else {
+            remove_partial_outputs(jobs[i]);
+            resume.jobs.push_back(jobs[i]);
+        }
+    }
+    return !resume.jobs.empty();
+}
+
+void discard_batch_journal(const std::string &path) {
+    unlink(path.c_str());
+}
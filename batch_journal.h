@@ -0,0 +1,51 @@
+#ifndef BATCH_JOURNAL_H
+#define BATCH_JOURNAL_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "job_scheduler.h"
+#include "sync_cache.h"
+
+// Append-only JSON lines log of one batch: the job list first, then a line per job as it starts and
+// ends. A batch that never got to the end leaves it behind so the next start can resume the rest.
+struct BatchJournal {
+    std::string path;
+    int fd = -1;
+    std::mutex mutex;
+    size_t unsynced = 0;  // lines written since the last fdatasync
+    std::chrono::steady_clock::time_point last_sync;
+};
+
+// What an interrupted batch left to do
+struct JournalResume {
+    std::vector<SyncJob> jobs;  // not finished, or finished but their output or inputs changed since
+    AlignmentOptions alignment;
+    size_t total = 0;      // jobs the batch had
+    size_t finished = 0;   // of those, still done
+};
+
+// The journal that lives next to the given config file
+std::string batch_journal_path(const std::string &config_file);
+
+// Start a journal for jobs, replacing any earlier one; the job list is on disk before this returns
+bool open_batch_journal(BatchJournal &journal, const std::string &path, const std::vector<SyncJob> &jobs,
+                        const AlignmentOptions &alignment);
+
+// Thread safe. Lines are flushed to disk in groups, at most a second apart.
+void journal_job_running(BatchJournal &journal, size_t job_index);
+void journal_job_done(BatchJournal &journal, size_t job_index, const std::string &output_file,
+                      const FileFingerprint &video, const FileFingerprint &subtitle);
+void journal_job_failed(BatchJournal &journal, size_t job_index, int exit_code);
+
+// Sync and close; the journal is removed when every job got to the end, done or failed
+void close_batch_journal(BatchJournal &journal, bool every_job_ended);
+
+// Read an interrupted batch. False when there is no journal or nothing is left to do. A torn last line
+// from a crash is ignored.
+bool load_batch_journal(const std::string &path, JournalResume &resume);
+
+void discard_batch_journal(const std::string &path);
+
+#endif // BATCH_JOURNAL_H
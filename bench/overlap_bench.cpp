@@ -0,0 +1,95 @@
+// Micro-benchmark of the overlap scoring kernels on a synthetic 24 minute, 400 line episode.
+// Every kernel scores all lines at every candidate offset; results are checked against the scalar kernel.
+// Exits 1 when any kernel differs from the scalar one. With --check each kernel makes a single pass, for ctest.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <random>
+#include <vector>
+#include "alignment.h"
+#include "overlap_kernel.h"
+
+using steady_clock = std::chrono::steady_clock;
+
+static void make_episode(std::vector<TimeSpan> &reference, std::vector<TimeSpan> &lines) {
+    std::mt19937 rng(24);
+    const int64_t episode_ms = 24 * 60 * 1000;
+    int64_t time = 2000;
+    while (lines.size() < 400 && time < episode_ms) {
+        int64_t length = 900 + rng() % 2600;
+        reference.push_back({time, time + length});
+        lines.push_back({time + 2300, time + 2300 + length});
+        time += length + 300 + rng() % 2000;
+    }
+}
+
+// Scores of one full pass over all lines with kernel, and the best time over several passes
+static double run_pass(const PreparedAlignment &prepared, OverlapKernel kernel, int rounds,
+                       std::vector<double> &totals) {
+    const size_t offset_count = static_cast<size_t>(2 * prepared.half + 1);
+    double best_ms = 1e30;
+    for (int round = 0; round < rounds; ++round) {
+        totals.assign(offset_count, 0.0);
+        const auto start = steady_clock::now();
+        for (const auto &span : prepared.grid) {
+            const int32_t *begin = prepared.coverage.data() + (span.start - prepared.half - prepared.low);
+            const int32_t *end = prepared.coverage.data() + (span.end - prepared.half - prepared.low);
+            kernel(begin, end, 1.0 / static_cast<double>(span.end - span.start), totals.data(), offset_count);
+        }
+        best_ms = std::min(best_ms, std::chrono::duration<double, std::milli>(steady_clock::now() - start).count());
+    }
+    return best_ms;
+}
+
+int main(int argc, char **argv) {
+    const bool check_only = argc > 1 && std::string(argv[1]) == "--check";
+    const int rounds = check_only ? 1 : 20;
+    std::vector<TimeSpan> reference;
+    std::vector<TimeSpan> lines;
+    make_episode(reference, lines);
+
+    AlignmentParams params;
+    params.guess_framerate = false;
+    PreparedAlignment prepared;
+    prepare_alignment(reference, lines, params, prepared);
+    const double scores = static_cast<double>(prepared.grid.size()) * (2 * prepared.half + 1);
+    printf("%zu lines, %lld offsets, active kernel: %s\n", prepared.grid.size(),
+           static_cast<long long>(2 * prepared.half + 1), overlap_kernel_name(active_overlap_kernel()));
+
+    std::vector<double> expected;
+    const double scalar_ms = run_pass(prepared, overlap_kernel(KERNEL_SCALAR), rounds, expected);
+    int mismatches = 0;
+    printf("%-8s %10s %14s %9s %10s\n", "kernel", "ms/pass", "Mscores/s", "speedup", "identical");
+    for (int kind = 0; kind < KERNEL_KIND_COUNT; ++kind) {
+        OverlapKernel kernel = overlap_kernel(static_cast<OverlapKernelKind>(kind));
+        const char *name = overlap_kernel_name(static_cast<OverlapKernelKind>(kind));
+        if (!kernel) {
+            printf("%-8s %10s\n", name, "unsupported");
+            continue;
+        }
+        std::vector<double> totals;
+        const double ms = run_pass(prepared, kernel, rounds, totals);
+        const bool identical = std::memcmp(totals.data(), expected.data(), totals.size() * sizeof(double)) == 0;
+        printf("%-8s %10.3f %14.1f %8.2fx %10s\n", name, ms, scores / ms / 1000.0, scalar_ms / ms,
+               identical ? "yes" : "NO");
+        mismatches += identical ? 0 : 1;
+    }
+    if (mismatches > 0) {
+        printf("%d kernel(s) differ from scalar\n", mismatches);
+        return 1;
+    }
+    if (check_only) {
+        return 0;
+    }
+
+    // The whole split alignment with the active kernel, for scale
+    AlignmentWorkspace workspace;
+    const auto start = steady_clock::now();
+    AlignmentResult result = align_spans(reference, lines, AlignmentParams(), workspace);
+    printf("full alignment with framerate guessing: %.1f ms, offset %lld ms\n",
+           std::chrono::duration<double, std::milli>(steady_clock::now() - start).count(),
+           static_cast<long long>(result.offsets.empty() ? 0 : result.offsets[0]));
+    return 0;
+}
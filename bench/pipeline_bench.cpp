@@ -0,0 +1,368 @@
+// Benchmark of the scan, extract, match, list and sync stages on synthetic libraries.
+// Each size gets a fresh folder of empty videos and subtitles with release-style names; every stage
+// is run several times and the best and median times are reported as JSON, so runs on two commits
+// can be compared directly or with --baseline.
+
+#include <gtk/gtk.h>
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "directory_scanner.h"
+#include "episode_matcher.h"
+#include "episode_pattern.h"
+#include "file_catalog.h"
+#include "file_list_view.h"
+#include "job_scheduler.h"
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+using steady_clock = std::chrono::steady_clock;
+
+static const char *usage =
+    "Usage: pipeline_bench [options]\n"
+    "  --sizes LIST        library sizes in files per side (default 100,1000,10000,100000)\n"
+    "  --repeat N          runs per stage, the best and median are kept (default 5)\n"
+    "  --batch-jobs N      jobs in the end-to-end batch (default 200)\n"
+    "  --stub-sleep MS     how long the stub alass takes per job (default 20)\n"
+    "  --workers N         batch workers (0 = hardware concurrency)\n"
+    "  --output FILE       write the JSON report to FILE instead of stdout\n"
+    "  --baseline FILE     compare against an earlier report and fail on regressions\n"
+    "  --tolerance X       allowed slowdown against the baseline (default 0.25 = 25%)\n"
+    "  --keep              keep the generated libraries\n";
+
+struct BenchOptions {
+    std::vector<size_t> sizes = {100, 1000, 10000, 100000};
+    int repeat = 5;
+    size_t batch_jobs = 200;
+    int stub_sleep_ms = 20;
+    int workers = 0;
+    std::string output_file;
+    std::string baseline_file;
+    double tolerance = 0.25;
+    bool keep = false;
+};
+
+static const char *show_names[] = {"Pocket Monsters", "Cowboy Bebop", "Mushishi", "Planetes", "Monster",
+                                   "Haibane Renmei", "Kaiba", "Ping Pong the Animation"};
+static const char *groups[] = {"SubsPlease", "Erai-raws", "Judas", "BlueLobster"};
+
+// "[Group] Show S03E07 [1080p][CRC].mkv" and "Show.S03E07.WEB.en.srt"; 100 episodes a season keeps keys unique
+static void make_names(size_t count, std::vector<std::string> &videos, std::vector<std::string> &subtitles) {
+    const size_t show_count = sizeof(show_names) / sizeof(show_names[0]);
+    const size_t group_count = sizeof(groups) / sizeof(groups[0]);
+    char name[256];
+    for (size_t i = 0; i < count; ++i) {
+        const char *show = show_names[i % show_count];
+        const unsigned season = static_cast<unsigned>(i / 100 + 1);
+        const unsigned episode = static_cast<unsigned>(i % 100 + 1);
+        snprintf(name, sizeof(name), "[%s] %s S%02uE%02u [1080p][%08X].mkv", groups[i % group_count], show, season,
+                 episode, static_cast<unsigned>(i * 2654435761u));
+        videos.push_back(name);
+        std::string dotted = show;
+        std::replace(dotted.begin(), dotted.end(), ' ', '.');
+        snprintf(name, sizeof(name), "%s.S%02uE%02u.WEB.en.srt", dotted.c_str(), season, episode);
+        subtitles.push_back(name);
+    }
+}
+
+static void create_files(const fs::path &directory, const std::vector<std::string> &names) {
+    fs::create_directories(directory);
+    for (const auto &name : names) {
+        std::ofstream(directory / name).put('\n');
+    }
+}
+
+static double elapsed_ms(steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(steady_clock::now() - start).count();
+}
+
+// Heap bytes of the same paths as one std::string each, the layout the catalog replaced; strings
+// longer than the small-string buffer take an allocation of their own
+static size_t string_list_bytes(const FileCatalog &catalog) {
+    size_t bytes = catalog.size() * sizeof(std::string);
+    for (size_t i = 0; i < catalog.size(); ++i) {
+        const std::string path(catalog.path(i));
+        bytes += path.capacity() > 15 ? path.capacity() + 1 : 0;
+    }
+    return bytes;
+}
+
+// Best and median of repeat runs of stage
+static json time_stage(int repeat, const std::function<void()> &stage) {
+    std::vector<double> times;
+    for (int i = 0; i < repeat; ++i) {
+        const auto start = steady_clock::now();
+        stage();
+        times.push_back(elapsed_ms(start));
+    }
+    std::sort(times.begin(), times.end());
+    return {{"min_ms", times.front()}, {"median_ms", times[times.size() / 2]}};
+}
+
+static json bench_library(const fs::path &root, size_t count, const BenchOptions &options, bool have_gtk) {
+    std::vector<std::string> video_names;
+    std::vector<std::string> subtitle_names;
+    make_names(count, video_names, subtitle_names);
+    const fs::path video_dir = root / ("videos_" + std::to_string(count));
+    const fs::path subtitle_dir = root / ("subtitles_" + std::to_string(count));
+    create_files(video_dir, video_names);
+    create_files(subtitle_dir, subtitle_names);
+
+    json stages;
+    FileCatalog videos;
+    FileCatalog subtitles;
+    stages["get_files_in_directory"] = time_stage(options.repeat, [&]() {
+        videos = get_files_in_directory(video_dir.string());
+        subtitles = get_files_in_directory(subtitle_dir.string());
+    });
+    stages["scan_directory"] = time_stage(options.repeat, [&]() {
+        ScanOptions scan_options;
+        scan_options.extensions = default_video_extensions();
+        ScanControl control;
+        size_t found = 0;
+        scan_directory(video_dir.string(), scan_options, control,
+                       [&found](ScanBatch batch) { found += batch.files.size(); });
+    });
+
+    // The scanner handles the plain pattern, \d{2,} needs the regex fallback
+    stages["extract_episode_numbers"] = time_stage(options.repeat, [&]() {
+        extract_episode_numbers(video_names, "S\\d+E\\d+", 1);
+    });
+    stages["extract_episode_numbers_regex"] = time_stage(options.repeat, [&]() {
+        extract_episode_numbers(video_names, "S\\d{2,}E\\d{2,}", 1);
+    });
+
+    std::vector<EpisodeKey> video_keys;
+    std::vector<EpisodeKey> subtitle_keys;
+    EpisodeMatch match;
+    stages["match"] = time_stage(options.repeat, [&]() {
+        video_keys = extract_episode_keys(videos, "S\\d+E\\d+", 1, false);
+        subtitle_keys = extract_episode_keys(subtitles, "S\\d+E\\d+", 1, false);
+        match = match_episodes(video_keys, subtitle_keys, std::vector<bool>());
+    });
+    // Re-matching with unchanged keys, as the preview does when one side's pattern is edited
+    stages["rematch"] = time_stage(options.repeat, [&]() { match = match_episodes(video_keys, subtitle_keys, std::vector<bool>()); });
+
+    const auto shared_videos = std::make_shared<const FileCatalog>(videos);
+    const auto shared_subtitles = std::make_shared<const FileCatalog>(subtitles);
+    auto video_rows = [&]() {
+        return build_file_rows(shared_videos, video_keys, match.video_partners, shared_subtitles,
+                               match.video_references, shared_subtitles);
+    };
+    stages["build_file_rows"] = time_stage(options.repeat, [&]() {
+        video_rows();
+        build_file_rows(shared_subtitles, subtitle_keys, match.subtitle_partners, shared_videos,
+                        match.subtitle_references, shared_subtitles);
+    });
+    // What show_file_matches does on the UI thread: a first fill, then a refresh that changes nothing
+    if (have_gtk) {
+        stages["list_first_fill"] = time_stage(options.repeat, [&]() {
+            FileListView view;
+            create_file_list_view(view, "Video", "Subtitle");
+            g_object_ref_sink(view.scrolled_window);
+            update_file_list_view(view, video_rows());
+            gtk_widget_destroy(view.scrolled_window);
+            g_object_unref(view.scrolled_window);
+        });
+        FileListView view;
+        create_file_list_view(view, "Video", "Subtitle");
+        g_object_ref_sink(view.scrolled_window);
+        update_file_list_view(view, video_rows());
+        stages["list_refresh"] = time_stage(options.repeat, [&]() {
+            update_file_list_view(view, video_rows());
+        });
+        gtk_widget_destroy(view.scrolled_window);
+        g_object_unref(view.scrolled_window);
+    }
+
+    if (!options.keep) {
+        fs::remove_all(video_dir);
+        fs::remove_all(subtitle_dir);
+    }
+    const json memory = {{"catalog_bytes", catalog_memory_bytes(videos) + catalog_memory_bytes(subtitles)},
+                         {"string_list_bytes", string_list_bytes(videos) + string_list_bytes(subtitles)}};
+    return {{"files", count}, {"pairs", match.pairs}, {"memory", memory}, {"stages", stages}};
+}
+
+// A stand-in alass on the PATH: sleeps, then creates the output file (its last argument)
+static void install_stub_alass(const fs::path &root, int sleep_ms) {
+    const fs::path bin = root / "bin";
+    fs::create_directories(bin);
+    const fs::path stub = bin / "alass";
+    char seconds[32];
+    snprintf(seconds, sizeof(seconds), "%.3f", sleep_ms / 1000.0);
+    std::ofstream(stub) << "#!/bin/sh\nfor last; do :; done\nsleep " << seconds << "\n: > \"$last\"\n";
+    fs::permissions(stub, fs::perms::owner_all, fs::perm_options::add);
+    const char *path = std::getenv("PATH");
+    setenv("PATH", (bin.string() + ":" + (path ? path : "")).c_str(), 1);
+}
+
+static json bench_batch(const fs::path &root, const BenchOptions &options) {
+    install_stub_alass(root, options.stub_sleep_ms);
+    const fs::path work = root / "batch";
+    fs::create_directories(work);
+    std::vector<SyncJob> jobs;
+    for (size_t i = 0; i < options.batch_jobs; ++i) {
+        const std::string stem = (work / ("episode_" + std::to_string(i))).string();
+        jobs.push_back({stem + ".mkv", stem + ".srt", stem + ".synced.srt"});
+    }
+
+    BatchSettings settings;
+    settings.worker_count = resolve_worker_count(options.workers);
+    settings.alignment.engine = ENGINE_ALASS;
+    const auto start = steady_clock::now();
+    BatchReport report = run_sync_jobs(jobs, settings, nullptr, BatchCallbacks());
+    const double wall_ms = elapsed_ms(start);
+
+    // Overhead is everything beyond the stub's own sleeping, per job
+    const double ideal_ms = static_cast<double>(options.batch_jobs) * options.stub_sleep_ms / settings.worker_count;
+    return {{"jobs", options.batch_jobs},
+            {"workers", settings.worker_count},
+            {"stub_sleep_ms", options.stub_sleep_ms},
+            {"succeeded", report.succeeded},
+            {"wall_ms", wall_ms},
+            {"jobs_per_second", options.batch_jobs / (wall_ms / 1000.0)},
+            {"overhead_ms_per_job", (wall_ms - ideal_ms) * settings.worker_count / options.batch_jobs}};
+}
+
+// Stages slower than the baseline by more than tolerance, compared on the best times
+static int compare_baseline(const json &report, const json &baseline, double tolerance) {
+    int regressions = 0;
+    auto check = [&](const std::string &name, double now, double before) {
+        if (before > 0.0 && now > before * (1.0 + tolerance)) {
+            fprintf(stderr, "regression: %s %.3f ms -> %.3f ms (%+.0f%%)\n", name.c_str(), before, now,
+                    (now / before - 1.0) * 100.0);
+            ++regressions;
+        }
+    };
+    for (const auto &library : report["libraries"]) {
+        for (const auto &old_library : baseline.value("libraries", json::array())) {
+            if (old_library.value("files", 0) != library["files"]) {
+                continue;
+            }
+            for (const auto &stage : library["stages"].items()) {
+                if (old_library["stages"].contains(stage.key())) {
+                    check(stage.key() + "@" + library["files"].dump(), stage.value()["min_ms"].get<double>(),
+                          old_library["stages"][stage.key()].value("min_ms", 0.0));
+                }
+            }
+        }
+    }
+    if (report.contains("batch") && baseline.contains("batch") &&
+        report["batch"]["jobs"] == baseline["batch"].value("jobs", 0)) {
+        check("batch", report["batch"]["wall_ms"].get<double>(), baseline["batch"].value("wall_ms", 0.0));
+    }
+    return regressions;
+}
+
+static bool parse_options(int argc, char *argv[], BenchOptions &options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string flag = argv[i];
+        if (flag == "--keep") {
+            options.keep = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const std::string value = argv[++i];
+        try {
+            if (flag == "--sizes") {
+                options.sizes.clear();
+                for (size_t begin = 0; begin < value.size();) {
+                    size_t comma = std::min(value.find(',', begin), value.size());
+                    options.sizes.push_back(std::stoul(value.substr(begin, comma - begin)));
+                    begin = comma + 1;
+                }
+            } else if (flag == "--repeat") {
+                options.repeat = std::max(1, std::stoi(value));
+            } else if (flag == "--batch-jobs") {
+                options.batch_jobs = std::stoul(value);
+            } else if (flag == "--stub-sleep") {
+                options.stub_sleep_ms = std::max(0, std::stoi(value));
+            } else if (flag == "--workers") {
+                options.workers = std::stoi(value);
+            } else if (flag == "--output") {
+                options.output_file = value;
+            } else if (flag == "--baseline") {
+                options.baseline_file = value;
+            } else if (flag == "--tolerance") {
+                options.tolerance = std::stod(value);
+            } else {
+                return false;
+            }
+        } catch (const std::exception &) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options;
+    if (!parse_options(argc, argv, options)) {
+        fputs(usage, stderr);
+        return 2;
+    }
+    // Without a display the list view stages are left out
+    const bool have_gtk = gtk_init_check(nullptr, nullptr);
+
+    char root_template[] = "/tmp/pipeline_bench.XXXXXX";
+    if (!mkdtemp(root_template)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const fs::path root = root_template;
+
+    json report;
+    report["timestamp"] = static_cast<long long>(std::time(nullptr));
+    report["hardware_threads"] = std::thread::hardware_concurrency();
+    report["repeat"] = options.repeat;
+    report["list_view"] = have_gtk;
+    if (const char *commit = std::getenv("BENCH_COMMIT")) {
+        report["commit"] = commit;
+    }
+    report["libraries"] = json::array();
+    for (size_t count : options.sizes) {
+        fprintf(stderr, "library of %zu files...\n", count);
+        report["libraries"].push_back(bench_library(root, count, options, have_gtk));
+    }
+    if (options.batch_jobs > 0) {
+        fprintf(stderr, "batch of %zu stub jobs...\n", options.batch_jobs);
+        report["batch"] = bench_batch(root, options);
+    }
+    if (!options.keep) {
+        fs::remove_all(root);
+    }
+
+    if (options.output_file.empty()) {
+        std::cout << report.dump(2) << std::endl;
+    } else {
+        std::ofstream(options.output_file) << report.dump(2) << std::endl;
+    }
+
+    if (!options.baseline_file.empty()) {
+        std::ifstream file(options.baseline_file);
+        json baseline = json::parse(file, nullptr, false);
+        if (baseline.is_discarded()) {
+            fprintf(stderr, "Cannot read baseline %s\n", options.baseline_file.c_str());
+            return 2;
+        }
+        if (compare_baseline(report, baseline, options.tolerance) > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
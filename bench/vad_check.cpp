@@ -0,0 +1,268 @@
+// Accuracy check of the speech detector against a clip whose speech spans are known.
+// Without arguments the clip is a synthetic 90 s fixture: voiced and unvoiced syllables at varying levels
+// over a quiet room, a music bed and traffic-like rumble with hiss. With CLIP SPANS.json a real clip is decoded
+// through ffmpeg and scored against hand-marked spans, [[start_ms, end_ms], ...].
+// Exits 1 when recall, precision, the share of spans found or the boundary error misses its limit.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "voice_activity.h"
+
+using json = nlohmann::json;
+
+static const int64_t collar_ms = 300;       // around each true boundary, not scored either way
+static const double min_recall = 0.90;      // share of speech time detected
+static const double min_precision = 0.90;   // share of detected time that is speech
+static const double min_spans_found = 0.95; // true spans with any detected overlap
+static const double max_boundary_ms = 200.0; // mean distance of a found span's ends from the true ones
+
+namespace {
+    struct Fixture {
+        std::vector<int16_t> samples;
+        std::vector<TimeSpan> speech;
+    };
+
+    // Background of one stretch of the fixture
+    enum Background { BACKGROUND_ROOM, BACKGROUND_MUSIC, BACKGROUND_NOISE };
+}
+
+static double db_to_amplitude(double db) {
+    return 32767.0 * std::pow(10.0, db / 20.0);
+}
+
+// Syllables of a harmonic voice with a drifting pitch, now and then a fricative, with pauses between
+// syllables short enough to stay one span
+static void add_speech(std::vector<double> &signal, int64_t start_ms, int64_t end_ms, double level_db,
+                       std::mt19937 &rng) {
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::normal_distribution<double> noise(0.0, 1.0);
+    const double amplitude = db_to_amplitude(level_db);
+    const double pitch = 100.0 + 140.0 * unit(rng);
+    double phase = 0.0;
+    int64_t time = start_ms;
+    while (time < end_ms) {
+        const int64_t length = std::min<int64_t>(120 + static_cast<int64_t>(unit(rng) * 200), end_ms - time);
+        const bool fricative = unit(rng) < 0.15;
+        const size_t first = static_cast<size_t>(time * vad_sample_rate / 1000);
+        const size_t count = static_cast<size_t>(length * vad_sample_rate / 1000);
+        double previous = 0.0;
+        for (size_t i = 0; i < count && first + i < signal.size(); ++i) {
+            const double envelope = std::sin(M_PI * static_cast<double>(i) / static_cast<double>(count));
+            double value = 0.0;
+            if (fricative) {
+                // Differenced noise, most of its energy high up
+                const double white = noise(rng);
+                value = 0.5 * (white - previous);
+                previous = white;
+            } else {
+                const double f0 = pitch * (1.0 + 0.1 * std::sin(2.0 * M_PI * 3.0 * (time / 1000.0)));
+                phase += 2.0 * M_PI * f0 / vad_sample_rate;
+                for (int harmonic = 1; harmonic * f0 < vad_sample_rate / 2 - 200; ++harmonic) {
+                    value += std::sin(harmonic * phase) / harmonic;
+                }
+                value *= 0.5;
+            }
+            signal[first + i] += amplitude * envelope * value;
+        }
+        // The gap after each syllable, but the span keeps its marked end
+        time += length + static_cast<int64_t>(unit(rng) * 90);
+    }
+}
+
+static void add_background(std::vector<double> &signal, int64_t start_ms, int64_t end_ms, Background kind,
+                           std::mt19937 &rng) {
+    std::normal_distribution<double> noise(0.0, 1.0);
+    const size_t first = static_cast<size_t>(start_ms * vad_sample_rate / 1000);
+    const size_t last = std::min(signal.size(), static_cast<size_t>(end_ms * vad_sample_rate / 1000));
+    double low = 0.0;
+    for (size_t i = first; i < last; ++i) {
+        const double t = static_cast<double>(i) / vad_sample_rate;
+        switch (kind) {
+        case BACKGROUND_ROOM:
+            signal[i] += db_to_amplitude(-60.0) * noise(rng) + db_to_amplitude(-50.0) * std::sin(2.0 * M_PI * 50.0 * t);
+            break;
+        case BACKGROUND_MUSIC: {
+            // A bass line and a sustained chord that changes every two seconds
+            const double root = 55.0 * std::pow(2.0, static_cast<int>(t / 2.0) % 4 / 12.0 * 5.0);
+            double chord = std::sin(2.0 * M_PI * root * t) + 0.5 * std::sin(2.0 * M_PI * root * 2.0 * t) +
+                           0.3 * std::sin(2.0 * M_PI * root * 3.0 * t) + 0.2 * std::sin(2.0 * M_PI * root * 5.0 * t);
+            signal[i] += db_to_amplitude(-34.0) * chord + db_to_amplitude(-62.0) * noise(rng);
+            break;
+        }
+        case BACKGROUND_NOISE:
+            // Rumble like traffic or a crowd, with some hiss on top
+            low = 0.98 * low + 0.2 * noise(rng);
+            signal[i] += db_to_amplitude(-42.0) * low + db_to_amplitude(-52.0) * noise(rng);
+            break;
+        }
+    }
+}
+
+static Fixture make_fixture() {
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    const int64_t clip_ms = 90 * 1000;
+    std::vector<double> signal(static_cast<size_t>(clip_ms * vad_sample_rate / 1000), 0.0);
+    Fixture fixture;
+
+    // Thirty seconds of each background; the speech is quieter over the noise, as in a busy scene
+    const Background stretches[] = {BACKGROUND_ROOM, BACKGROUND_MUSIC, BACKGROUND_NOISE};
+    for (int stretch = 0; stretch < 3; ++stretch) {
+        const int64_t begin = stretch * 30000;
+        add_background(signal, begin, begin + 30000, stretches[stretch], rng);
+        int64_t time = begin + 1500;
+        while (true) {
+            const int64_t length = 600 + static_cast<int64_t>(unit(rng) * 3400);
+            if (time + length > begin + 29000) {
+                break;
+            }
+            const double level = stretches[stretch] == BACKGROUND_ROOM ? -32.0 + 14.0 * unit(rng)
+                                                                       : -26.0 + 8.0 * unit(rng);
+            add_speech(signal, time, time + length, level, rng);
+            fixture.speech.push_back({time, time + length});
+            time += length + 500 + static_cast<int64_t>(unit(rng) * 2500);
+        }
+    }
+
+    fixture.samples.resize(signal.size());
+    for (size_t i = 0; i < signal.size(); ++i) {
+        fixture.samples[i] = static_cast<int16_t>(std::max(-32768.0, std::min(32767.0, signal[i])));
+    }
+    return fixture;
+}
+
+static bool read_spans(const std::string &path, std::vector<TimeSpan> &spans) {
+    std::ifstream file(path);
+    json list;
+    try {
+        file >> list;
+    } catch (const json::parse_error &) {
+        return false;
+    }
+    for (const auto &item : list) {
+        if (!item.is_array() || item.size() != 2 || !item[0].is_number() || !item[1].is_number()) {
+            return false;
+        }
+        spans.push_back({item[0].get<int64_t>(), item[1].get<int64_t>()});
+    }
+    return true;
+}
+
+// Per 10 ms frame: 1 speech, 0 silence, -1 inside a collar and not scored
+static std::vector<int> truth_frames(const std::vector<TimeSpan> &speech, int64_t length_ms) {
+    std::vector<int> frames(static_cast<size_t>(length_ms / 10 + 1), 0);
+    for (const auto &span : speech) {
+        for (int64_t ms = span.start; ms < span.end && ms / 10 < static_cast<int64_t>(frames.size()); ms += 10) {
+            frames[ms / 10] = 1;
+        }
+    }
+    for (const auto &span : speech) {
+        for (int64_t boundary : {span.start, span.end}) {
+            for (int64_t ms = boundary - collar_ms; ms < boundary + collar_ms; ms += 10) {
+                if (ms >= 0 && ms / 10 < static_cast<int64_t>(frames.size())) {
+                    frames[ms / 10] = -1;
+                }
+            }
+        }
+    }
+    return frames;
+}
+
+static bool score(const std::vector<TimeSpan> &speech, const std::vector<TimeSpan> &detected) {
+    int64_t length_ms = 0;
+    for (const auto &span : speech) {
+        length_ms = std::max(length_ms, span.end);
+    }
+    for (const auto &span : detected) {
+        length_ms = std::max(length_ms, span.end);
+    }
+    const std::vector<int> truth = truth_frames(speech, length_ms);
+    std::vector<bool> found(truth.size(), false);
+    for (const auto &span : detected) {
+        for (int64_t ms = span.start; ms < span.end; ms += 10) {
+            found[ms / 10] = true;
+        }
+    }
+
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t false_alarms = 0;
+    for (size_t i = 0; i < truth.size(); ++i) {
+        if (truth[i] == 1) {
+            ++(found[i] ? hits : misses);
+        } else if (truth[i] == 0 && found[i]) {
+            ++false_alarms;
+        }
+    }
+    // Each true span against the detected span overlapping it most; merged or split spans show up here
+    size_t spans_found = 0;
+    double boundary_total_ms = 0.0;
+    for (const auto &span : speech) {
+        const TimeSpan *best = nullptr;
+        int64_t best_overlap = 0;
+        for (const auto &candidate : detected) {
+            const int64_t overlap = std::min(candidate.end, span.end) - std::max(candidate.start, span.start);
+            if (overlap > best_overlap) {
+                best = &candidate;
+                best_overlap = overlap;
+            }
+        }
+        if (best) {
+            ++spans_found;
+            boundary_total_ms += 0.5 * (std::llabs(best->start - span.start) + std::llabs(best->end - span.end));
+        }
+    }
+
+    const double recall = hits + misses == 0 ? 1.0 : static_cast<double>(hits) / (hits + misses);
+    const double precision = hits + false_alarms == 0 ? 1.0 : static_cast<double>(hits) / (hits + false_alarms);
+    const double spans_share = speech.empty() ? 1.0 : static_cast<double>(spans_found) / speech.size();
+    const double boundary_ms = spans_found == 0 ? 0.0 : boundary_total_ms / spans_found;
+    printf("%zu true spans, %zu detected, collar %lld ms\n", speech.size(), detected.size(),
+           static_cast<long long>(collar_ms));
+    printf("%-12s %8s %8s\n", "measure", "value", "limit");
+    printf("%-12s %8.3f %8.3f\n", "recall", recall, min_recall);
+    printf("%-12s %8.3f %8.3f\n", "precision", precision, min_precision);
+    printf("%-12s %8.3f %8.3f\n", "spans found", spans_share, min_spans_found);
+    printf("%-12s %8.1f %8.1f\n", "boundary ms", boundary_ms, max_boundary_ms);
+    return recall >= min_recall && precision >= min_precision && spans_share >= min_spans_found &&
+           boundary_ms <= max_boundary_ms;
+}
+
+int main(int argc, char **argv) {
+    std::vector<TimeSpan> speech;
+    std::vector<TimeSpan> detected;
+    if (argc == 3) {
+        if (!read_spans(argv[2], speech)) {
+            fprintf(stderr, "cannot read spans from %s\n", argv[2]);
+            return 2;
+        }
+        std::string error;
+        if (!extract_speech_spans(argv[1], detected, error, nullptr)) {
+            fprintf(stderr, "cannot extract speech from %s: %s\n", argv[1], error.c_str());
+            return 2;
+        }
+    } else if (argc == 1) {
+        Fixture fixture = make_fixture();
+        speech = std::move(fixture.speech);
+        // Fed in pipe-sized reads like ffmpeg's output
+        VoiceActivityState state;
+        for (size_t i = 0; i < fixture.samples.size(); i += 2048) {
+            vad_feed(state, fixture.samples.data() + i, std::min<size_t>(2048, fixture.samples.size() - i));
+        }
+        detected = vad_finish(state);
+    } else {
+        fprintf(stderr, "usage: %s [CLIP SPANS.json]\n", argv[0]);
+        return 2;
+    }
+
+    const bool passed = score(speech, detected);
+    printf("%s\n", passed ? "passed" : "FAILED");
+    return passed ? 0 : 1;
+}
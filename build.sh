@@ -1,3 +1,5 @@
-g++ -o bin/sync main.cpp $(pkg-config --cflags --libs gtk+-3.0) -I/usr/local/include/nlohmann/json
+# The SIMD and scalar overlap kernels must stay bit-identical, so no fused multiply-adds there
+g++ -c -o overlap_kernel.o overlap_kernel.cpp -ffp-contract=off
+g++ -o bin/sync main.cpp job_scheduler.cpp process_runner.cpp batch_journal.cpp job_farm.cpp episode_matcher.cpp episode_pattern.cpp file_catalog.cpp file_list_view.cpp stage_table_view.cpp match_preview.cpp directory_scanner.cpp scan_snapshot.cpp sync_cache.cpp sync_core.cpp batch_cli.cpp alignment.cpp subtitle_file.cpp native_aligner.cpp media_probe.cpp voice_activity.cpp span_cache.cpp overlap_kernel.o trace.cpp -pthread $(pkg-config --cflags --libs gtk+-3.0) -I/usr/local/include/nlohmann/json
 cd ./bin/
 ./sync
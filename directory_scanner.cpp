@@ -0,0 +1,273 @@
+#include "directory_scanner.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <sys/stat.h>
+#include "trace.h"
+
+namespace fs = std::filesystem;
+using steady_clock = std::chrono::steady_clock;
+
+// Flush a partial batch after this long, so slow mounts still show progress
+static const auto batch_interval = std::chrono::milliseconds(100);
+
+std::vector<std::string> default_video_extensions() {
+    return {".mkv", ".mp4", ".m4v", ".avi", ".mov", ".webm", ".ts", ".wmv", ".flv"};
+}
+
+std::vector<std::string> default_subtitle_extensions() {
+    return {".srt", ".ass", ".ssa", ".sub", ".idx", ".vtt"};
+}
+
+static std::string to_lower(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::tolower(c); });
+    return text;
+}
+
+std::vector<std::string> normalize_extensions(const std::vector<std::string> &extensions) {
+    std::vector<std::string> normalized;
+    for (const auto &extension : extensions) {
+        if (extension.empty()) {
+            continue;
+        }
+        normalized.push_back(to_lower(extension[0] == '.' ? extension : "." + extension));
+    }
+    return normalized;
+}
+
+namespace {
+    struct DirectoryTask {
+        fs::path relative;
+        int depth = 0;
+    };
+
+    // Owned by one worker, which pops from the back; idle workers steal from the front
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<DirectoryTask> tasks;
+    };
+
+    struct TreeScan {
+        fs::path root;
+        const ScanOptions &options;
+        const ScanControl &control;
+        const ScanBatchCallback &on_batch;
+
+        std::vector<WorkQueue> queues;
+        std::atomic<size_t> pending{0};  // directories queued or being listed
+        std::atomic<size_t> queued{0};   // directories queued only
+
+        // Idle workers sleep here until a directory is queued or the scan ends
+        std::mutex idle_mutex;
+        std::condition_variable wake;
+
+        std::mutex visited_mutex;
+        std::set<std::pair<dev_t, ino_t>> visited;
+
+        std::mutex output_mutex;
+
+        TreeScan(const fs::path &root, const ScanOptions &options, const ScanControl &control,
+                 const ScanBatchCallback &on_batch, unsigned int thread_count)
+            : root(root), options(options), control(control), on_batch(on_batch), queues(thread_count) {
+        }
+
+        // False when the directory was already reached, e.g. through a symlink loop
+        bool mark_visited(const fs::path &path) {
+            struct stat info;
+            if (stat(path.c_str(), &info) != 0) {
+                return true;
+            }
+            std::lock_guard<std::mutex> lock(visited_mutex);
+            return visited.insert({info.st_dev, info.st_ino}).second;
+        }
+
+        bool allowed(const fs::path &path) const {
+            if (options.extensions.empty()) {
+                return true;
+            }
+            std::string extension = to_lower(path.extension().string());
+            return std::find(options.extensions.begin(), options.extensions.end(), extension) !=
+                   options.extensions.end();
+        }
+
+        void push(size_t worker, DirectoryTask task) {
+            ++pending;
+            {
+                std::lock_guard<std::mutex> lock(queues[worker].mutex);
+                queues[worker].tasks.push_back(std::move(task));
+                ++queued;
+            }
+            // Taking the idle lock orders this with a worker that just found nothing to pop
+            std::lock_guard<std::mutex> lock(idle_mutex);
+            wake.notify_one();
+        }
+
+        // Called after listing a directory; the last one, or a cancel, releases every idle worker
+        void finish_task() {
+            if (--pending == 0 || control.cancelled) {
+                std::lock_guard<std::mutex> lock(idle_mutex);
+                wake.notify_all();
+            }
+        }
+
+        bool pop(size_t worker, DirectoryTask &task) {
+            {
+                std::lock_guard<std::mutex> lock(queues[worker].mutex);
+                if (!queues[worker].tasks.empty()) {
+                    task = std::move(queues[worker].tasks.back());
+                    queues[worker].tasks.pop_back();
+                    --queued;
+                    return true;
+                }
+            }
+            for (size_t i = 1; i < queues.size(); ++i) {
+                WorkQueue &victim = queues[(worker + i) % queues.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.tasks.empty()) {
+                    task = std::move(victim.tasks.front());
+                    victim.tasks.pop_front();
+                    --queued;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void flush(ScanBatch &batch, bool finished) {
+            batch.finished = finished;
+            std::lock_guard<std::mutex> lock(output_mutex);
+            on_batch(std::move(batch));
+            batch = ScanBatch();
+        }
+
+        void list_directory(size_t worker, const DirectoryTask &task, ScanBatch &batch,
+                            steady_clock::time_point &last_flush) {
+            TRACE_SCOPE("list_directory");
+            const fs::path directory = root / task.relative;
+            // Taken before listing: an entry added meanwhile leaves the directory newer than recorded
+            struct stat info;
+            if (stat(directory.c_str(), &info) == 0) {
+                batch.directories.push_back({task.relative.generic_string(),
+                                             static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 +
+                                                 info.st_mtim.tv_nsec,
+                                             task.depth});
+            }
+            std::error_code ec;
+            fs::directory_iterator it(directory, ec);
+            if (ec) {
+                batch.errors.push_back({directory.string(), ec.message()});
+                return;
+            }
+
+            for (fs::directory_iterator end; it != end;) {
+                if (control.cancelled) {
+                    return;
+                }
+
+                std::error_code entry_ec;
+                const fs::path relative = task.relative / it->path().filename();
+                if (it->is_directory(entry_ec)) {
+                    bool descend = options.max_depth < 0 || task.depth < options.max_depth;
+                    if (descend && mark_visited(it->path())) {
+                        push(worker, {relative, task.depth + 1});
+                    }
+                } else if (entry_ec) {
+                    batch.errors.push_back({it->path().string(), entry_ec.message()});
+                } else if (it->is_regular_file(entry_ec) && allowed(relative)) {
+                    // Size and mtime stay 0 for a file that vanished since it was listed
+                    struct stat file_info = {};
+                    stat(it->path().c_str(), &file_info);
+                    const int64_t mtime_ns =
+                        static_cast<int64_t>(file_info.st_mtim.tv_sec) * 1000000000 + file_info.st_mtim.tv_nsec;
+                    append_catalog_file(batch.files, relative.generic_string(),
+                                        static_cast<uint64_t>(file_info.st_size), mtime_ns);
+                }
+
+                if (batch.files.size() >= options.batch_size || steady_clock::now() - last_flush >= batch_interval) {
+                    flush(batch, false);
+                    last_flush = steady_clock::now();
+                }
+
+                it.increment(ec);
+                if (ec) {
+                    batch.errors.push_back({directory.string(), ec.message()});
+                    return;
+                }
+            }
+        }
+
+        void run_worker(size_t worker) {
+            ScanBatch batch;
+            auto last_flush = steady_clock::now();
+            while (pending > 0 && !control.cancelled) {
+                DirectoryTask task;
+                if (!pop(worker, task)) {
+                    // Another worker is still listing and may hand out more directories; hand over what was
+                    // found so far rather than holding it while blocked
+                    if (!batch.files.empty() || !batch.directories.empty() || !batch.errors.empty()) {
+                        flush(batch, false);
+                        last_flush = steady_clock::now();
+                    }
+                    std::unique_lock<std::mutex> lock(idle_mutex);
+                    wake.wait(lock, [this]() { return queued > 0 || pending == 0 || control.cancelled; });
+                    continue;
+                }
+                list_directory(worker, task, batch, last_flush);
+                finish_task();
+            }
+            if (!control.cancelled && (!batch.files.empty() || !batch.directories.empty() || !batch.errors.empty())) {
+                flush(batch, false);
+            }
+        }
+    };
+}
+
+void scan_directory(const std::string &directory, const ScanOptions &options, const ScanControl &control,
+                    const ScanBatchCallback &on_batch) {
+    TRACE_SCOPE("scan");
+    unsigned int thread_count = 1;
+    if (options.max_depth != 0) {
+        thread_count = options.thread_count > 0 ? options.thread_count : std::thread::hardware_concurrency();
+        thread_count = std::max(1u, thread_count);
+    }
+
+    TreeScan scan(directory, options, control, on_batch, thread_count);
+    scan.mark_visited(directory);
+    scan.push(0, {fs::path(), 0});
+
+    // The calling thread is worker 0
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < thread_count; ++i) {
+        workers.emplace_back([&scan, i]() {
+            trace_set_thread_name("scan " + std::to_string(i));
+            scan.run_worker(i);
+        });
+    }
+    scan.run_worker(0);
+    for (auto &thread : workers) {
+        thread.join();
+    }
+
+    if (!control.cancelled) {
+        ScanBatch last;
+        scan.flush(last, true);
+    }
+}
+
+FileCatalog get_files_in_directory(const std::string &directory) {
+    FileCatalog files;
+    ScanControl control;
+    ScanOptions options;
+    options.batch_size = SIZE_MAX;
+    scan_directory(directory, options, control, [&files](ScanBatch batch) { append_catalog(files, batch.files); });
+    return files;
+}
@@ -0,0 +1,63 @@
+#ifndef DIRECTORY_SCANNER_H
+#define DIRECTORY_SCANNER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "file_catalog.h"
+
+// A directory entry that could not be read; the scan carries on past it
+struct ScanError {
+    std::string path;
+    std::string message;
+};
+
+// A listed directory and its modification time when the listing began, so a later run can tell
+// whether its entries may have changed
+struct ScannedDirectory {
+    std::string path;  // relative to the scanned folder, "" for the folder itself
+    int64_t mtime_ns = 0;
+    int depth = 0;
+};
+
+// Files found since the previous batch; finished is set on the last batch of a scan
+struct ScanBatch {
+    FileCatalog files;
+    std::vector<ScannedDirectory> directories;
+    std::vector<ScanError> errors;
+    bool finished = false;
+};
+
+// Set cancelled from any thread to stop a running scan at the next entry
+struct ScanControl {
+    std::atomic<bool> cancelled{false};
+};
+
+struct ScanOptions {
+    int max_depth = 0;                    // levels of subfolders to descend into, negative for unlimited
+    std::vector<std::string> extensions;  // allowed extensions with the dot, case-insensitive; empty allows all
+    unsigned int thread_count = 0;        // 0 = hardware concurrency
+    size_t batch_size = 512;
+};
+
+using ScanBatchCallback = std::function<void(ScanBatch batch)>;
+
+std::vector<std::string> default_video_extensions();
+std::vector<std::string> default_subtitle_extensions();
+
+// Lowercase and dot-prefix a user supplied extension list
+std::vector<std::string> normalize_extensions(const std::vector<std::string> &extensions);
+
+// Scan directory and stream the matching files to on_batch, or sooner than batch_size when the
+// listing is slow. Paths are relative to directory. Subfolders are spread over worker threads that
+// steal from each other; directories reached twice through symlinks are only listed once.
+// Blocks the calling thread, on_batch calls are serialized; a cancelled scan sends no final batch.
+void scan_directory(const std::string &directory, const ScanOptions &options, const ScanControl &control,
+                    const ScanBatchCallback &on_batch);
+
+// Synchronous listing of the regular files directly in directory; unreadable entries are skipped
+FileCatalog get_files_in_directory(const std::string &directory);
+
+#endif // DIRECTORY_SCANNER_H
@@ -0,0 +1,135 @@
+#include "episode_matcher.h"
+#include "episode_pattern.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <unordered_map>
+#include "trace.h"
+
+bool parse_episode_key(std::string_view text, EpisodeKey &key) {
+    std::vector<long> numbers;
+    for (size_t i = 0; i < text.size();) {
+        if (text[i] < '0' || text[i] > '9') {
+            ++i;
+            continue;
+        }
+        long value = 0;
+        for (; i < text.size() && text[i] >= '0' && text[i] <= '9'; ++i) {
+            // Clamp absurdly long digit runs instead of overflowing
+            value = value < 100000000 ? value * 10 + (text[i] - '0') : value;
+        }
+        numbers.push_back(value);
+    }
+
+    if (numbers.empty()) {
+        return false;
+    }
+    key.episode = static_cast<int>(numbers.back());
+    key.season = numbers.size() > 1 ? static_cast<int>(numbers[numbers.size() - 2]) : 0;
+    return true;
+}
+
+std::string format_episode_key(const EpisodeKey &key) {
+    if (key.season == 0) {
+        return std::to_string(key.episode);
+    }
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "S%02dE%02d", key.season, key.episode);
+    return buffer;
+}
+
+std::vector<EpisodeKey> extract_episode_keys(const FileCatalog &files, const std::string &regex_str,
+                                             int match_index, bool full_path) {
+    TRACE_SCOPE("extract");
+    std::vector<EpisodeKey> keys(files.size());
+    std::shared_ptr<const EpisodePattern> pattern = compile_episode_pattern(regex_str);
+    if (!pattern) {
+        return keys;
+    }
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        const std::string_view text = full_path ? files.path(i) : catalog_file_name(files.path(i));
+        std::string_view selected;
+        EpisodeKey key;
+        if (find_episode_match(*pattern, text, match_index, selected) && parse_episode_key(selected, key)) {
+            keys[i] = key;
+        }
+    }
+    return keys;
+}
+
+namespace {
+    // What the join knows about one key
+    struct KeySlot {
+        uint32_t video = no_partner;
+        uint32_t subtitle = no_partner;
+        uint32_t reference = no_partner;
+        size_t videos = 0;
+        size_t subtitles = 0;
+        bool reported = false;
+    };
+}
+
+EpisodeMatch match_episodes(const std::vector<EpisodeKey> &video_keys, const std::vector<EpisodeKey> &subtitle_keys,
+                            const std::vector<bool> &trusted) {
+    TRACE_SCOPE("match");
+    EpisodeMatch match;
+    match.video_partners.assign(video_keys.size(), no_partner);
+    match.subtitle_partners.assign(subtitle_keys.size(), no_partner);
+    match.video_references.assign(video_keys.size(), no_partner);
+    match.subtitle_references.assign(subtitle_keys.size(), no_partner);
+
+    std::unordered_map<EpisodeKey, KeySlot, EpisodeKeyHash> slots;
+    slots.reserve(subtitle_keys.size());
+    for (size_t i = 0; i < subtitle_keys.size(); ++i) {
+        if (!subtitle_keys[i].valid()) {
+            continue;
+        }
+        KeySlot &slot = slots[subtitle_keys[i]];
+        if (i < trusted.size() && trusted[i]) {
+            // The first trusted file per key is the reference
+            if (slot.reference == no_partner) {
+                slot.reference = static_cast<uint32_t>(i);
+            }
+            match.subtitle_references[i] = static_cast<uint32_t>(i);
+        } else if (slot.subtitles++ == 0) {
+            slot.subtitle = static_cast<uint32_t>(i);
+        }
+    }
+    for (size_t i = 0; i < video_keys.size(); ++i) {
+        if (!video_keys[i].valid()) {
+            continue;
+        }
+        auto it = slots.find(video_keys[i]);
+        if (it != slots.end() && it->second.videos++ == 0) {
+            it->second.video = static_cast<uint32_t>(i);
+        }
+    }
+
+    for (size_t i = 0; i < video_keys.size(); ++i) {
+        if (!video_keys[i].valid()) {
+            continue;
+        }
+        auto it = slots.find(video_keys[i]);
+        if (it == slots.end() || it->second.subtitles == 0) {
+            continue;
+        }
+        KeySlot &slot = it->second;
+        if (slot.videos > 1 || slot.subtitles > 1) {
+            if (!slot.reported) {
+                slot.reported = true;
+                match.conflicts.push_back({video_keys[i], slot.videos, slot.subtitles});
+            }
+            continue;
+        }
+        match.video_partners[i] = slot.subtitle;
+        match.subtitle_partners[slot.subtitle] = static_cast<uint32_t>(i);
+        ++match.pairs;
+        if (slot.reference != no_partner) {
+            match.video_references[i] = slot.reference;
+            match.subtitle_references[slot.subtitle] = slot.reference;
+            ++match.reference_pairs;
+        }
+    }
+    return match;
+}
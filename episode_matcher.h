@@ -0,0 +1,77 @@
+#ifndef EPISODE_MATCHER_H
+#define EPISODE_MATCHER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "file_catalog.h"
+
+// Normalized episode identity, so "01" and "1" compare equal; season is 0 when the name has none.
+// A default key is "no key", for files the pattern doesn't match.
+struct EpisodeKey {
+    int season = 0;
+    int episode = -1;
+
+    bool valid() const {
+        return episode >= 0;
+    }
+    bool operator==(const EpisodeKey &other) const {
+        return season == other.season && episode == other.episode;
+    }
+};
+
+struct EpisodeKeyHash {
+    size_t operator()(const EpisodeKey &key) const {
+        return (static_cast<size_t>(static_cast<unsigned int>(key.season)) << 32) ^
+               static_cast<unsigned int>(key.episode);
+    }
+};
+
+// Row of a file without a partner in the partner columns
+const uint32_t no_partner = UINT32_MAX;
+
+// A key that several videos or subtitles share while the other side has it too; none of them is paired
+struct KeyConflict {
+    EpisodeKey key;
+    size_t videos = 0;
+    size_t subtitles = 0;  // not counting trusted ones
+};
+
+// Pairing of two key columns, as columns parallel to them
+struct EpisodeMatch {
+    std::vector<uint32_t> video_partners;     // the subtitle each video is paired with
+    std::vector<uint32_t> subtitle_partners;  // the video each subtitle is paired with
+    // The trusted subtitle a pair is aligned against instead of the video, no_partner = the video's audio.
+    // A trusted subtitle refers to itself.
+    std::vector<uint32_t> video_references;
+    std::vector<uint32_t> subtitle_references;
+    size_t pairs = 0;
+    size_t reference_pairs = 0;  // pairs with a trusted subtitle to align against
+    std::vector<KeyConflict> conflicts;  // in the order their first video appears
+};
+
+// Parse the digit runs of a matched text: the last run is the episode, the one before it the season
+bool parse_episode_key(std::string_view text, EpisodeKey &key);
+
+// "S01E05" when a season is present, otherwise the plain episode number
+std::string format_episode_key(const EpisodeKey &key);
+
+// One key per file of files, the key column of the catalog under this pattern. The pattern runs on the
+// file name, or with full_path on the whole path below the scanned folder, e.g. to take the season from
+// a "Season 01/" directory. match_index (1-based) selects that capture group of the first match when
+// the pattern has enough groups, otherwise the match_index-th occurrence of the pattern. Files without
+// a match get an invalid key; an invalid pattern gives every file one.
+std::vector<EpisodeKey> extract_episode_keys(const FileCatalog &files, const std::string &regex_str,
+                                             int match_index, bool full_path);
+
+// Hash join on the normalized keys: a video is paired with the subtitle sharing its key when it is the
+// only one on both sides. Keys held by more than one file of a side are reported as conflicts and left
+// unpaired, so no two pairs ever write the same output. Subtitles flagged in trusted (empty = none) are
+// already synced tracks; they are never paired, but a pair whose episode has one gets the first of them
+// as its reference.
+EpisodeMatch match_episodes(const std::vector<EpisodeKey> &video_keys, const std::vector<EpisodeKey> &subtitle_keys,
+                            const std::vector<bool> &trusted);
+
+#endif // EPISODE_MATCHER_H
@@ -0,0 +1,202 @@
+#include "episode_pattern.h"
+
+#include <cctype>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include "trace.h"
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Translate a pattern into scanner tokens; false when it needs the full regex engine
+static bool parse_scanner_tokens(const std::string &pattern, EpisodePattern &compiled) {
+    static const char *plain_literals = " _-,;:'\"!@#%&=~<>/";
+    static const char *escaped_literals = "[](){}.*+?^$|\\/-_ ";
+
+    std::vector<PatternToken> tokens;
+    auto append_literal = [&tokens](char c) {
+        if (tokens.empty() || tokens.back().digits) {
+            tokens.push_back(PatternToken());
+        }
+        tokens.back().literal += c;
+    };
+
+    for (size_t i = 0; i < pattern.size();) {
+        if (pattern.compare(i, 3, "\\d+") == 0) {
+            tokens.push_back({true, false, ""});
+            i += 3;
+        } else if (pattern.compare(i, 5, "(\\d+)") == 0) {
+            tokens.push_back({true, true, ""});
+            ++compiled.group_count;
+            i += 5;
+        } else if (pattern[i] == '\\' && i + 1 < pattern.size() && std::strchr(escaped_literals, pattern[i + 1])) {
+            append_literal(pattern[i + 1]);
+            i += 2;
+        } else if (std::isalnum(static_cast<unsigned char>(pattern[i])) || std::strchr(plain_literals, pattern[i])) {
+            append_literal(pattern[i]);
+            ++i;
+        } else {
+            return false;
+        }
+    }
+
+    // A digit run must end at a non-digit literal or the end of the pattern, so that greedy
+    // scanning without backtracking gives exactly what std::regex would
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        if (tokens[i].digits && i + 1 < tokens.size() && (tokens[i + 1].digits || is_digit(tokens[i + 1].literal[0]))) {
+            return false;
+        }
+    }
+    if (tokens.empty()) {
+        return false;
+    }
+    compiled.tokens = std::move(tokens);
+    return true;
+}
+
+std::shared_ptr<const EpisodePattern> compile_episode_pattern(const std::string &pattern) {
+    static std::mutex cache_mutex;
+    static std::unordered_map<std::string, std::shared_ptr<const EpisodePattern>> cache;
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = cache.find(pattern);
+    if (it != cache.end()) {
+        return it->second;
+    }
+
+    auto compiled = std::make_shared<EpisodePattern>();
+    compiled->source = pattern;
+    if (parse_scanner_tokens(pattern, *compiled)) {
+        compiled->has_scanner = true;
+    } else {
+        try {
+            compiled->regex.assign(pattern);
+            compiled->group_count = compiled->regex.mark_count();
+        } catch (const std::regex_error &) {
+            compiled.reset();
+        }
+    }
+
+    // Live editing produces a stream of throwaway patterns, so keep the cache bounded
+    if (cache.size() >= 256) {
+        cache.clear();
+    }
+    cache.emplace(pattern, compiled);
+    return compiled;
+}
+
+// Try the scanner at exactly position start; on success match_end is one past the match
+static bool scan_at(const EpisodePattern &pattern, std::string_view name, size_t start, size_t wanted_group,
+                    size_t &match_end, std::string_view &group_text) {
+    size_t pos = start;
+    size_t group = 0;
+    for (const auto &token : pattern.tokens) {
+        if (!token.digits) {
+            if (name.compare(pos, token.literal.size(), token.literal) != 0) {
+                return false;
+            }
+            pos += token.literal.size();
+            continue;
+        }
+        size_t end = pos;
+        while (end < name.size() && is_digit(name[end])) {
+            ++end;
+        }
+        if (end == pos) {
+            return false;
+        }
+        if (token.capture && ++group == wanted_group) {
+            group_text = name.substr(pos, end - pos);
+        }
+        pos = end;
+    }
+    match_end = pos;
+    return true;
+}
+
+// Leftmost scanner match at or after from
+static bool scan_from(const EpisodePattern &pattern, std::string_view name, size_t from, size_t wanted_group,
+                      size_t &match_begin, size_t &match_end, std::string_view &group_text) {
+    const PatternToken &first = pattern.tokens.front();
+    for (size_t start = from; start < name.size(); ++start) {
+        // Skip straight to the next possible start instead of trying every position
+        if (first.digits) {
+            while (start < name.size() && !is_digit(name[start])) {
+                ++start;
+            }
+        } else {
+            start = name.find(first.literal[0], start);
+        }
+        if (start >= name.size()) {
+            return false;
+        }
+        if (scan_at(pattern, name, start, wanted_group, match_end, group_text)) {
+            match_begin = start;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool find_episode_match(const EpisodePattern &pattern, std::string_view name, int match_index,
+                        std::string_view &selected) {
+    const size_t wanted = match_index > 0 ? static_cast<size_t>(match_index) : 1;
+    const bool use_group = pattern.group_count >= wanted;
+
+    if (pattern.has_scanner) {
+        size_t begin = 0;
+        size_t end = 0;
+        std::string_view group_text;
+        size_t occurrence = 0;
+        for (size_t from = 0; scan_from(pattern, name, from, use_group ? wanted : 0, begin, end, group_text);
+             from = end) {
+            if (use_group) {
+                selected = group_text;
+                return true;
+            }
+            if (++occurrence == wanted) {
+                selected = name.substr(begin, end - begin);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const char *first = name.data();
+    const char *last = name.data() + name.size();
+    size_t occurrence = 0;
+    for (std::cregex_iterator it(first, last, pattern.regex), end; it != end; ++it) {
+        const std::cmatch &match = *it;
+        if (use_group) {
+            if (!match[wanted].matched) {
+                return false;
+            }
+            selected = std::string_view(match[wanted].first, match[wanted].length());
+            return true;
+        }
+        if (++occurrence == wanted) {
+            selected = std::string_view(match[0].first, match[0].length());
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<std::string> extract_episode_numbers(const std::vector<std::string> &files, const std::string &regex_str,
+                                                 int match_index) {
+    TRACE_SCOPE("extract");
+    std::vector<std::string> matches;
+    std::shared_ptr<const EpisodePattern> pattern = compile_episode_pattern(regex_str);
+    if (!pattern) {
+        return matches;
+    }
+    for (const auto &file : files) {
+        std::string_view selected;
+        if (find_episode_match(*pattern, file, match_index, selected)) {
+            matches.emplace_back(selected);
+        }
+    }
+    return matches;
+}
@@ -0,0 +1,39 @@
+#ifndef EPISODE_PATTERN_H
+#define EPISODE_PATTERN_H
+
+#include <memory>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// One step of a hand-specialized scanner: a literal run or a run of digits
+struct PatternToken {
+    bool digits = false;
+    bool capture = false;
+    std::string literal;
+};
+
+// Compiled episode pattern. Simple literal/digit-run patterns such as \d+, S\d+E\d+, " - \d+" and
+// \[\d+\] get a dedicated scanner; everything else falls back to a std::regex compiled once.
+struct EpisodePattern {
+    std::string source;
+    size_t group_count = 0;
+    bool has_scanner = false;
+    std::vector<PatternToken> tokens;
+    std::regex regex;
+};
+
+// Cached per pattern string and safe to call from any thread; returns null for an invalid pattern
+std::shared_ptr<const EpisodePattern> compile_episode_pattern(const std::string &pattern);
+
+// Select the episode text in name. match_index (1-based) picks that capture group of the first match
+// when the pattern has enough groups, otherwise the match_index-th occurrence of the whole pattern.
+bool find_episode_match(const EpisodePattern &pattern, std::string_view name, int match_index,
+                        std::string_view &selected);
+
+// Selected text of every matching file, in file order; empty when the pattern is invalid
+std::vector<std::string> extract_episode_numbers(const std::vector<std::string> &files, const std::string &regex_str,
+                                                 int match_index);
+
+#endif // EPISODE_PATTERN_H
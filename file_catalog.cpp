@@ -0,0 +1,29 @@
+#include "file_catalog.h"
+
+std::string_view catalog_file_name(std::string_view path) {
+    const size_t slash = path.rfind('/');
+    return slash == std::string_view::npos ? path : path.substr(slash + 1);
+}
+
+void append_catalog_file(FileCatalog &catalog, std::string_view path, uint64_t size, int64_t mtime_ns) {
+    catalog.arena.append(path.data(), path.size());
+    catalog.path_ends.push_back(static_cast<uint32_t>(catalog.arena.size()));
+    catalog.sizes.push_back(size);
+    catalog.mtimes_ns.push_back(mtime_ns);
+}
+
+void append_catalog(FileCatalog &catalog, const FileCatalog &files) {
+    const uint32_t base = static_cast<uint32_t>(catalog.arena.size());
+    catalog.arena += files.arena;
+    catalog.path_ends.reserve(catalog.path_ends.size() + files.size());
+    for (uint32_t end : files.path_ends) {
+        catalog.path_ends.push_back(base + end);
+    }
+    catalog.sizes.insert(catalog.sizes.end(), files.sizes.begin(), files.sizes.end());
+    catalog.mtimes_ns.insert(catalog.mtimes_ns.end(), files.mtimes_ns.begin(), files.mtimes_ns.end());
+}
+
+size_t catalog_memory_bytes(const FileCatalog &catalog) {
+    return catalog.arena.capacity() + catalog.path_ends.capacity() * sizeof(uint32_t) +
+           catalog.sizes.capacity() * sizeof(uint64_t) + catalog.mtimes_ns.capacity() * sizeof(int64_t);
+}
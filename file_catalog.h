@@ -0,0 +1,42 @@
+#ifndef FILE_CATALOG_H
+#define FILE_CATALOG_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Scanned files of one folder as columns; file i is row i of every column. The paths are stored once,
+// back to back in one arena, and everything past the scan refers to a file by its row, so a library of
+// 100k files costs a few allocations rather than several strings per file and stage.
+struct FileCatalog {
+    std::string arena;                // every path, relative to the scanned folder
+    std::vector<uint32_t> path_ends;  // path i spans arena[path_ends[i - 1], path_ends[i])
+    std::vector<uint64_t> sizes;
+    std::vector<int64_t> mtimes_ns;
+
+    size_t size() const {
+        return path_ends.size();
+    }
+    bool empty() const {
+        return path_ends.empty();
+    }
+    // Valid until the catalog is next appended to
+    std::string_view path(size_t i) const {
+        const uint32_t begin = i == 0 ? 0 : path_ends[i - 1];
+        return std::string_view(arena.data() + begin, path_ends[i] - begin);
+    }
+};
+
+// The last component of a catalog path, the file's own name
+std::string_view catalog_file_name(std::string_view path);
+
+void append_catalog_file(FileCatalog &catalog, std::string_view path, uint64_t size, int64_t mtime_ns);
+
+// Append every file of files, in order
+void append_catalog(FileCatalog &catalog, const FileCatalog &files);
+
+// Heap bytes the catalog holds, for comparing against other layouts
+size_t catalog_memory_bytes(const FileCatalog &catalog);
+
+#endif // FILE_CATALOG_H
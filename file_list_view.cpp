@@ -0,0 +1,157 @@
+#include "file_list_view.h"
+
+#include <algorithm>
+#include <string>
+
+enum {
+    COLUMN_FILE,
+    COLUMN_KEY,
+    COLUMN_PARTNER,
+    COLUMN_REFERENCE,
+    COLUMN_COUNT
+};
+
+static void append_text_column(GtkWidget *tree_view, const char *title, int column, int width) {
+    GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
+    GtkTreeViewColumn *view_column = gtk_tree_view_column_new_with_attributes(title, renderer, "text", column, NULL);
+    // Fixed sizing lets the view skip measuring rows that are not on screen
+    gtk_tree_view_column_set_sizing(view_column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width(view_column, width);
+    gtk_tree_view_column_set_resizable(view_column, TRUE);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(tree_view), view_column);
+}
+
+void create_file_list_view(FileListView &view, const char *file_title, const char *partner_title) {
+    view.store = gtk_list_store_new(COLUMN_COUNT, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
+    view.tree_view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(view.store));
+    g_object_unref(view.store);  // the view holds the reference now
+
+    append_text_column(view.tree_view, file_title, COLUMN_FILE, 360);
+    append_text_column(view.tree_view, "Key", COLUMN_KEY, 80);
+    append_text_column(view.tree_view, partner_title, COLUMN_PARTNER, 360);
+    append_text_column(view.tree_view, "Aligned Against", COLUMN_REFERENCE, 240);
+    gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(view.tree_view), TRUE);
+
+    view.scrolled_window = gtk_scrolled_window_new(NULL, NULL);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(view.scrolled_window), GTK_POLICY_AUTOMATIC,
+                                   GTK_POLICY_AUTOMATIC);
+    gtk_container_add(GTK_CONTAINER(view.scrolled_window), view.tree_view);
+}
+
+FileRows build_file_rows(std::shared_ptr<const FileCatalog> files, const std::vector<EpisodeKey> &keys,
+                         const std::vector<uint32_t> &partners, std::shared_ptr<const FileCatalog> partner_files,
+                         const std::vector<uint32_t> &references,
+                         std::shared_ptr<const FileCatalog> reference_files) {
+    FileRows result;
+    result.rows.resize(files->size());
+    for (size_t i = 0; i < files->size(); ++i) {
+        result.rows[i].file = static_cast<uint32_t>(i);
+        result.rows[i].key = keys[i];
+        result.rows[i].partner = partners[i];
+        result.rows[i].reference = references[i];
+    }
+    const FileCatalog &catalog = *files;
+    std::sort(result.rows.begin(), result.rows.end(), [&catalog](const FileRow &a, const FileRow &b) {
+        return catalog.path(a.file) < catalog.path(b.file);
+    });
+    result.files = std::move(files);
+    result.partner_files = std::move(partner_files);
+    result.reference_files = std::move(reference_files);
+    return result;
+}
+
+static std::string_view partner_path(const FileRows &rows, const FileRow &row) {
+    return row.partner == no_partner ? std::string_view() : rows.partner_files->path(row.partner);
+}
+
+// The trusted subtitle a pair is aligned against, "Audio" for the video, nothing for unpaired files
+static std::string_view reference_label(const FileRows &rows, const FileRow &row) {
+    if (row.reference == no_partner) {
+        return row.partner == no_partner ? std::string_view() : std::string_view("Audio");
+    }
+    if (rows.reference_files == rows.files && row.reference == row.file) {
+        return "Trusted reference";
+    }
+    return rows.reference_files->path(row.reference);
+}
+
+// The texts of a row; the store keeps copies, so they only need to live for the call
+struct RowText {
+    std::string file;
+    std::string key;
+    std::string partner;
+    std::string reference;
+};
+
+static RowText row_text(const FileRows &rows, const FileRow &row) {
+    return {std::string(rows.files->path(row.file)), row.key.valid() ? format_episode_key(row.key) : std::string(),
+            std::string(partner_path(rows, row)), std::string(reference_label(rows, row))};
+}
+
+static void set_row(GtkListStore *store, GtkTreeIter *iter, const FileRows &rows, const FileRow &row) {
+    const RowText text = row_text(rows, row);
+    gtk_list_store_set(store, iter, COLUMN_FILE, text.file.c_str(), COLUMN_KEY, text.key.c_str(), COLUMN_PARTNER,
+                       text.partner.c_str(), COLUMN_REFERENCE, text.reference.c_str(), -1);
+}
+
+void update_file_list_view(FileListView &view, FileRows rows) {
+    GtkListStore *store = view.store;
+    const FileRows &shown = view.shown;
+
+    // A first fill is cheaper with the model detached from the view
+    if (shown.rows.empty()) {
+        g_object_ref(store);
+        gtk_tree_view_set_model(GTK_TREE_VIEW(view.tree_view), NULL);
+        for (const auto &row : rows.rows) {
+            const RowText text = row_text(rows, row);
+            GtkTreeIter iter;
+            gtk_list_store_insert_with_values(store, &iter, -1, COLUMN_FILE, text.file.c_str(), COLUMN_KEY,
+                                              text.key.c_str(), COLUMN_PARTNER, text.partner.c_str(),
+                                              COLUMN_REFERENCE, text.reference.c_str(), -1);
+        }
+        gtk_tree_view_set_model(GTK_TREE_VIEW(view.tree_view), GTK_TREE_MODEL(store));
+        g_object_unref(store);
+        view.shown = std::move(rows);
+        return;
+    }
+
+    // Both sides are sorted by path, so walk them like a merge. Rows of different catalogs are
+    // compared by what they show.
+    GtkTreeIter iter;
+    gboolean valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(store), &iter);
+    size_t old_index = 0;
+    size_t new_index = 0;
+    while (new_index < rows.rows.size()) {
+        const FileRow &row = rows.rows[new_index];
+        const std::string_view file = rows.files->path(row.file);
+        const std::string_view old_file =
+            valid ? shown.files->path(shown.rows[old_index].file) : std::string_view();
+        if (valid && old_file < file) {
+            valid = gtk_list_store_remove(store, &iter);  // advances to the next row
+            ++old_index;
+            continue;
+        }
+        if (valid && old_file == file) {
+            const FileRow &old_row = shown.rows[old_index];
+            if (!(old_row.key == row.key) || partner_path(shown, old_row) != partner_path(rows, row) ||
+                reference_label(shown, old_row) != reference_label(rows, row)) {
+                set_row(store, &iter, rows, row);
+            }
+            valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(store), &iter);
+            ++old_index;
+        } else {
+            GtkTreeIter inserted;
+            if (valid) {
+                gtk_list_store_insert_before(store, &inserted, &iter);
+            } else {
+                gtk_list_store_append(store, &inserted);
+            }
+            set_row(store, &inserted, rows, row);
+        }
+        ++new_index;
+    }
+    while (valid) {
+        valid = gtk_list_store_remove(store, &iter);
+    }
+    view.shown = std::move(rows);
+}
@@ -0,0 +1,50 @@
+#ifndef FILE_LIST_VIEW_H
+#define FILE_LIST_VIEW_H
+
+#include <gtk/gtk.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "episode_matcher.h"
+#include "file_catalog.h"
+
+// One displayed row as rows of the catalogs it was built from: the file, its key, its partner and the
+// trusted subtitle its pair is aligned against (no_partner = the video's audio)
+struct FileRow {
+    uint32_t file = 0;
+    uint32_t partner = no_partner;
+    uint32_t reference = no_partner;
+    EpisodeKey key;
+};
+
+// The rows of one list, sorted by path, with the catalogs they refer to
+struct FileRows {
+    std::shared_ptr<const FileCatalog> files;
+    std::shared_ptr<const FileCatalog> partner_files;
+    std::shared_ptr<const FileCatalog> reference_files;  // the subtitle catalog
+    std::vector<FileRow> rows;
+};
+
+// A GtkTreeView over a GtkListStore; the view only renders the visible rows
+struct FileListView {
+    GtkWidget *scrolled_window = nullptr;
+    GtkWidget *tree_view = nullptr;
+    GtkListStore *store = nullptr;
+    FileRows shown;  // what the store currently holds
+};
+
+// Columns: the file, its key, its partner and what the pair is aligned against
+void create_file_list_view(FileListView &view, const char *file_title, const char *partner_title);
+
+// Rows for one side of the match: every file of files, with its key, partner and reference when it has
+// them. keys, partners and references are the columns of this side; partners index partner_files and
+// references index reference_files.
+FileRows build_file_rows(std::shared_ptr<const FileCatalog> files, const std::vector<EpisodeKey> &keys,
+                         const std::vector<uint32_t> &partners, std::shared_ptr<const FileCatalog> partner_files,
+                         const std::vector<uint32_t> &references,
+                         std::shared_ptr<const FileCatalog> reference_files);
+
+// Apply rows as a diff against what the view shows, touching only rows that changed
+void update_file_list_view(FileListView &view, FileRows rows);
+
+#endif // FILE_LIST_VIEW_H
@@ -0,0 +1,769 @@
+#include "job_farm.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "batch_journal.h"
+#include "nlohmann/json.hpp"
+
+using json = nlohmann::json;
+using steady_clock = std::chrono::steady_clock;
+
+// Anything larger is not from one of our peers
+static const uint32_t max_frame_bytes = 1 << 20;
+
+static double seconds_since(steady_clock::time_point start) {
+    return std::chrono::duration<double>(steady_clock::now() - start).count();
+}
+
+bool parse_farm_address(const std::string &text, FarmAddress &address) {
+    address = FarmAddress();
+    if (text.rfind("unix:", 0) == 0) {
+        address.unix_socket = true;
+        address.path = text.substr(5);
+        return !address.path.empty() && address.path.size() < sizeof(sockaddr_un::sun_path);
+    }
+    const size_t colon = text.rfind(':');
+    if (colon == std::string::npos || colon + 1 == text.size()) {
+        return false;
+    }
+    address.host = text.substr(0, colon);
+    address.port = text.substr(colon + 1);
+    // "[::1]:7000"
+    if (address.host.size() >= 2 && address.host.front() == '[' && address.host.back() == ']') {
+        address.host = address.host.substr(1, address.host.size() - 2);
+    }
+    return true;
+}
+
+static std::string describe_address(const FarmAddress &address) {
+    return address.unix_socket ? "unix:" + address.path : address.host + ":" + address.port;
+}
+
+static std::string encode_frame(const json &message) {
+    const std::string payload = message.dump();
+    const uint32_t size = static_cast<uint32_t>(payload.size());
+    std::string frame = {static_cast<char>(size >> 24), static_cast<char>(size >> 16), static_cast<char>(size >> 8),
+                         static_cast<char>(size)};
+    return frame + payload;
+}
+
+// Take the first complete frame off buffer. False when there is none yet, or with malformed set when the
+// peer sent something that isn't a message of ours.
+static bool take_frame(std::string &buffer, json &message, bool &malformed) {
+    malformed = false;
+    if (buffer.size() < 4) {
+        return false;
+    }
+    const auto byte = [&buffer](size_t i) { return static_cast<uint32_t>(static_cast<unsigned char>(buffer[i])); };
+    const uint32_t size = byte(0) << 24 | byte(1) << 16 | byte(2) << 8 | byte(3);
+    if (size > max_frame_bytes) {
+        malformed = true;
+        return false;
+    }
+    if (buffer.size() < 4 + static_cast<size_t>(size)) {
+        return false;
+    }
+    message = json::parse(buffer.begin() + 4, buffer.begin() + 4 + size, nullptr, false);
+    buffer.erase(0, 4 + static_cast<size_t>(size));
+    if (message.is_discarded() || !message.is_object() || !message.contains("type") ||
+        !message["type"].is_string()) {
+        malformed = true;
+        return false;
+    }
+    return true;
+}
+
+static bool send_all(int fd, const std::string &data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        const ssize_t count = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        sent += static_cast<size_t>(count);
+    }
+    return true;
+}
+
+static void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static int listen_on(const FarmAddress &address, std::string &error) {
+    int fd = -1;
+    if (address.unix_socket) {
+        // A socket file left by a coordinator that died is in the way of bind()
+        struct stat info;
+        if (lstat(address.path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+            unlink(address.path.c_str());
+        }
+        sockaddr_un local = {};
+        local.sun_family = AF_UNIX;
+        std::strncpy(local.sun_path, address.path.c_str(), sizeof(local.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd != -1 && (bind(fd, reinterpret_cast<sockaddr *>(&local), sizeof(local)) != 0 || listen(fd, 64) != 0)) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        addrinfo *found = nullptr;
+        const int status = getaddrinfo(address.host.empty() ? nullptr : address.host.c_str(), address.port.c_str(),
+                                       &hints, &found);
+        if (status != 0) {
+            error = "cannot listen on " + describe_address(address) + ": " + gai_strerror(status);
+            return -1;
+        }
+        for (addrinfo *candidate = found; candidate && fd == -1; candidate = candidate->ai_next) {
+            fd = socket(candidate->ai_family, candidate->ai_socktype | SOCK_CLOEXEC, candidate->ai_protocol);
+            if (fd == -1) {
+                continue;
+            }
+            const int reuse = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            if (bind(fd, candidate->ai_addr, candidate->ai_addrlen) != 0 || listen(fd, 64) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(found);
+    }
+    if (fd == -1) {
+        error = "cannot listen on " + describe_address(address) + ": " + std::strerror(errno);
+        return -1;
+    }
+    set_nonblocking(fd);
+    return fd;
+}
+
+static int connect_to(const FarmAddress &address) {
+    if (address.unix_socket) {
+        sockaddr_un remote = {};
+        remote.sun_family = AF_UNIX;
+        std::strncpy(remote.sun_path, address.path.c_str(), sizeof(remote.sun_path) - 1);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd != -1 && connect(fd, reinterpret_cast<sockaddr *>(&remote), sizeof(remote)) != 0) {
+            close(fd);
+            fd = -1;
+        }
+        return fd;
+    }
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *found = nullptr;
+    if (getaddrinfo(address.host.empty() ? "localhost" : address.host.c_str(), address.port.c_str(), &hints,
+                    &found) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (addrinfo *candidate = found; candidate && fd == -1; candidate = candidate->ai_next) {
+        fd = socket(candidate->ai_family, candidate->ai_socktype | SOCK_CLOEXEC, candidate->ai_protocol);
+        if (fd != -1 && connect(fd, candidate->ai_addr, candidate->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    if (fd != -1) {
+        // Frames are small and each one waits for an answer
+        const int no_delay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    }
+    return fd;
+}
+
+static json alignment_json(const AlignmentOptions &alignment) {
+    return {{"split_penalty", alignment.split_penalty},
+            {"disable_fps_guessing", alignment.disable_fps_guessing},
+            {"engine", alignment.engine == ENGINE_ALASS ? "alass" : "native"},
+            {"penalty_sweep", alignment.penalty_sweep}};
+}
+
+static void read_alignment(const json &value, AlignmentOptions &alignment) {
+    alignment.split_penalty = value.value("split_penalty", alignment.split_penalty);
+    alignment.disable_fps_guessing = value.value("disable_fps_guessing", alignment.disable_fps_guessing);
+    alignment.engine = value.value("engine", std::string()) == "native" ? ENGINE_NATIVE : ENGINE_ALASS;
+    alignment.penalty_sweep = value.value("penalty_sweep", std::vector<double>());
+}
+
+namespace {
+    struct FarmConnection {
+        int fd = -1;
+        std::string worker;  // the name from its hello, empty before
+        std::string inbox;   // bytes of frames not complete yet
+        std::string outbox;  // frames not written yet
+        bool waiting = false;  // sent a pull no job was free for
+        bool told_done = false;
+        bool closed = false;
+        long job = -1;         // leased job, -1 when idle
+        uint64_t lease = 0;
+        steady_clock::time_point deadline;  // the lease is taken back if nothing arrives before
+        steady_clock::time_point connected;
+    };
+
+    struct JobCoordinator {
+        const std::vector<SyncJob> &jobs;
+        const BatchSettings &settings;
+        const FarmSettings &farm;
+        const BatchCallbacks &callbacks;
+        BatchReport &report;
+        int listen_fd = -1;
+        std::vector<FarmConnection> connections;
+        std::deque<size_t> queue;  // jobs waiting for a worker, taken back leases first
+        std::vector<std::string> cache_keys;
+        std::map<std::string, FarmWorkerStats> stats;
+        size_t ended = 0;
+        uint64_t next_lease = 1;
+
+        JobCoordinator(const std::vector<SyncJob> &jobs, const BatchSettings &settings, const FarmSettings &farm,
+                       const BatchCallbacks &callbacks, BatchReport &report)
+            : jobs(jobs), settings(settings), farm(farm), callbacks(callbacks), report(report),
+              cache_keys(jobs.size()) {}
+
+        FarmWorkerStats &stats_of(const FarmConnection &connection) {
+            FarmWorkerStats &entry = stats[connection.worker];
+            entry.worker = connection.worker;
+            return entry;
+        }
+
+        void post(FarmConnection &connection, const json &message) {
+            connection.outbox += encode_frame(message);
+        }
+
+        void end_job(const SyncJob &job, const JobResult &result) {
+            report.results[result.job_index] = result;
+            ++ended;
+            if (settings.journal) {
+                FileFingerprint video;
+                FileFingerprint subtitle;
+                if (result.success && fingerprint_file(job_reference(job), video) &&
+                    fingerprint_file(job.subtitle_file, subtitle)) {
+                    journal_job_done(*settings.journal, result.job_index, job.output_file, video, subtitle);
+                } else {
+                    journal_job_failed(*settings.journal, result.job_index, result.exit_code);
+                }
+            }
+            if (callbacks.on_finished) {
+                callbacks.on_finished(job, result);
+            }
+        }
+
+        // Jobs whose output is still valid never leave this process
+        void queue_jobs() {
+            for (size_t i = 0; i < jobs.size(); ++i) {
+                FileFingerprint video;
+                FileFingerprint subtitle;
+                if (settings.cache && fingerprint_file(job_reference(jobs[i]), video) &&
+                    fingerprint_file(jobs[i].subtitle_file, subtitle)) {
+                    cache_keys[i] = sync_cache_key(video, subtitle, settings.alignment, jobs[i].output_file);
+                    if (sync_cache_lookup(*settings.cache, cache_keys[i], jobs[i].output_file)) {
+                        JobResult result;
+                        result.job_index = i;
+                        result.success = true;
+                        result.cached = true;
+                        result.exit_code = 0;
+                        end_job(jobs[i], result);
+                        continue;
+                    }
+                }
+                queue.push_back(i);
+            }
+        }
+
+        void lease_job(FarmConnection &connection) {
+            const size_t i = queue.front();
+            queue.pop_front();
+            connection.waiting = false;
+            connection.job = static_cast<long>(i);
+            connection.lease = next_lease++;
+            connection.deadline = steady_clock::now() + std::chrono::milliseconds(farm.lease_ms);
+            post(connection, {{"type", "job"},
+                              {"job", i},
+                              {"lease", connection.lease},
+                              {"video", jobs[i].video_file},
+                              {"subtitle", jobs[i].subtitle_file},
+                              {"output", jobs[i].output_file},
+                              {"reference", jobs[i].reference_file}});
+            if (settings.journal) {
+                journal_job_running(*settings.journal, i);
+            }
+            if (callbacks.on_started) {
+                callbacks.on_started(jobs[i], i);
+            }
+        }
+
+        // Hand free jobs to the workers that asked, and tell them when nothing is left at all
+        void dispatch() {
+            for (auto &connection : connections) {
+                if (!connection.waiting || connection.closed) {
+                    continue;
+                }
+                if (!queue.empty()) {
+                    lease_job(connection);
+                } else if (ended == jobs.size()) {
+                    connection.waiting = false;
+                    connection.told_done = true;
+                    post(connection, {{"type", "done"}});
+                }
+            }
+        }
+
+        void close_connection(FarmConnection &connection) {
+            if (connection.closed) {
+                return;
+            }
+            connection.closed = true;
+            close(connection.fd);
+            if (connection.job >= 0) {
+                // Its job goes to the front, it has waited longest
+                queue.push_front(static_cast<size_t>(connection.job));
+                connection.job = -1;
+                ++stats_of(connection).lost;
+            }
+            if (!connection.worker.empty()) {
+                stats_of(connection).connected_seconds += seconds_since(connection.connected);
+            }
+        }
+
+        void handle_result(FarmConnection &connection, const json &message) {
+            if (connection.job < 0 || message.value("job", -1L) != connection.job ||
+                message.value("lease", uint64_t(0)) != connection.lease) {
+                return;  // a job that was taken back meanwhile
+            }
+            const size_t i = static_cast<size_t>(connection.job);
+            connection.job = -1;
+            JobResult result;
+            result.job_index = i;
+            result.success = message.value("success", false);
+            result.cancelled = message.value("cancelled", false);
+            if (result.cancelled) {
+                // The worker was stopped, someone else runs it
+                queue.push_front(i);
+                ++stats_of(connection).lost;
+                return;
+            }
+            result.native = message.value("native", false);
+            result.split_penalty = message.value("split_penalty", settings.alignment.split_penalty);
+            result.exit_code = message.value("exit_code", -1);
+            result.seconds = message.value("seconds", 0.0);
+            result.cpu_seconds = message.value("cpu_seconds", 0.0);
+            result.max_rss_kb = message.value("max_rss_kb", 0L);
+            result.error = message.value("error", std::string());
+            result.output = message.value("output", std::string());
+
+            FarmWorkerStats &worker = stats_of(connection);
+            ++(result.success ? worker.succeeded : worker.failed);
+            worker.busy_seconds += result.seconds;
+            if (result.success && !cache_keys[i].empty()) {
+                sync_cache_store(*settings.cache, cache_keys[i], jobs[i].output_file);
+            }
+            end_job(jobs[i], result);
+        }
+
+        void handle(FarmConnection &connection, const json &message) {
+            const std::string type = message["type"].get<std::string>();
+            if (connection.worker.empty() && type != "hello") {
+                close_connection(connection);
+                return;
+            }
+            // Anything a worker sends shows it is alive
+            connection.deadline = steady_clock::now() + std::chrono::milliseconds(farm.lease_ms);
+            if (type == "hello") {
+                connection.worker = message.value("worker", std::string("worker"));
+                connection.connected = steady_clock::now();
+                stats_of(connection);
+                post(connection, {{"type", "welcome"},
+                                  {"heartbeat_ms", farm.heartbeat_ms},
+                                  {"lease_ms", farm.lease_ms},
+                                  {"alignment", alignment_json(settings.alignment)}});
+            } else if (type == "pull") {
+                connection.waiting = connection.job < 0;
+            } else if (type == "progress") {
+                if (connection.job >= 0 && callbacks.on_progress) {
+                    const size_t i = static_cast<size_t>(connection.job);
+                    callbacks.on_progress(jobs[i], i, message.value("fraction", 0.0));
+                }
+            } else if (type == "result") {
+                handle_result(connection, message);
+            }
+        }
+
+        void read_from(FarmConnection &connection) {
+            char chunk[4096];
+            bool ended_stream = false;
+            while (true) {
+                const ssize_t count = recv(connection.fd, chunk, sizeof(chunk), 0);
+                if (count > 0) {
+                    connection.inbox.append(chunk, static_cast<size_t>(count));
+                    continue;
+                }
+                if (count == -1 && errno == EINTR) {
+                    continue;
+                }
+                ended_stream = count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+                break;
+            }
+            // Frames that arrived before the end still count
+            json message;
+            bool malformed = false;
+            while (!connection.closed && take_frame(connection.inbox, message, malformed)) {
+                try {
+                    handle(connection, message);
+                } catch (const json::exception &) {
+                    malformed = true;
+                    break;
+                }
+            }
+            if (malformed || ended_stream) {
+                close_connection(connection);
+            }
+        }
+
+        void write_to(FarmConnection &connection) {
+            while (!connection.outbox.empty()) {
+                const ssize_t count =
+                    send(connection.fd, connection.outbox.data(), connection.outbox.size(), MSG_NOSIGNAL);
+                if (count > 0) {
+                    connection.outbox.erase(0, static_cast<size_t>(count));
+                } else if (count == -1 && errno == EINTR) {
+                    continue;
+                } else {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        close_connection(connection);
+                    }
+                    return;
+                }
+            }
+        }
+
+        void accept_workers() {
+            while (true) {
+                const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd == -1) {
+                    return;
+                }
+                const int no_delay = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+                FarmConnection connection;
+                connection.fd = fd;
+                connection.connected = steady_clock::now();
+                connection.deadline = connection.connected + std::chrono::milliseconds(farm.lease_ms);
+                connections.push_back(std::move(connection));
+            }
+        }
+
+        // A worker that holds a lease and went quiet is hung or cut off; its socket may never report it
+        void expire_leases() {
+            const auto now = steady_clock::now();
+            for (auto &connection : connections) {
+                if (!connection.closed && connection.job >= 0 && now > connection.deadline) {
+                    close_connection(connection);
+                }
+            }
+        }
+
+        void poll_once(int timeout_ms) {
+            std::vector<pollfd> fds = {{listen_fd, POLLIN, 0}};
+            for (const auto &connection : connections) {
+                fds.push_back({connection.fd, static_cast<short>(POLLIN | (connection.outbox.empty() ? 0 : POLLOUT)),
+                               0});
+            }
+            if (poll(fds.data(), fds.size(), timeout_ms) > 0) {
+                if (fds[0].revents) {
+                    accept_workers();
+                }
+                for (size_t i = 1; i < fds.size(); ++i) {
+                    FarmConnection &connection = connections[i - 1];
+                    if (!connection.closed && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                        read_from(connection);
+                    }
+                    if (!connection.closed && (fds[i].revents & POLLOUT)) {
+                        write_to(connection);
+                    }
+                }
+            }
+            expire_leases();
+            dispatch();
+            // Most frames fit the socket buffer; flush them now instead of after the next poll
+            for (auto &connection : connections) {
+                if (!connection.closed && !connection.outbox.empty()) {
+                    write_to(connection);
+                }
+            }
+            connections.erase(std::remove_if(connections.begin(), connections.end(),
+                                             [](const FarmConnection &connection) { return connection.closed; }),
+                              connections.end());
+        }
+    };
+}
+
+BatchReport run_job_coordinator(const FarmAddress &address, const std::vector<SyncJob> &jobs,
+                                const BatchSettings &settings, const FarmSettings &farm, BatchControl *control,
+                                const BatchCallbacks &callbacks, std::vector<FarmWorkerStats> &stats,
+                                std::string &error) {
+    BatchReport report;
+    report.results.resize(jobs.size());
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        report.results[i].job_index = i;
+        report.results[i].cancelled = true;  // overwritten once a worker returns it
+    }
+    const auto start = steady_clock::now();
+
+    JobCoordinator coordinator(jobs, settings, farm, callbacks, report);
+    coordinator.listen_fd = listen_on(address, error);
+    if (coordinator.listen_fd == -1) {
+        return report;
+    }
+    coordinator.queue_jobs();
+    while (coordinator.ended < jobs.size() && !(control && control->cancelled)) {
+        coordinator.poll_once(100);
+    }
+    // Tell the workers the batch is over, as they come back for more; those that don't find out when the
+    // socket closes
+    const auto done_deadline = steady_clock::now() + std::chrono::seconds(1);
+    while (steady_clock::now() < done_deadline && !(control && control->cancelled)) {
+        bool pending = false;
+        for (const auto &connection : coordinator.connections) {
+            pending = pending || !connection.told_done || !connection.outbox.empty();
+        }
+        if (!pending) {
+            break;
+        }
+        coordinator.poll_once(50);
+    }
+    for (auto &connection : coordinator.connections) {
+        coordinator.close_connection(connection);
+    }
+    close(coordinator.listen_fd);
+    if (address.unix_socket) {
+        unlink(address.path.c_str());
+    }
+
+    for (auto &entry : coordinator.stats) {
+        stats.push_back(entry.second);
+    }
+    count_batch_results(report, settings.alignment);
+    report.worker_count = static_cast<unsigned int>(stats.size());
+    report.wall_seconds = seconds_since(start);
+    return report;
+}
+
+namespace {
+    // Sockets of the running worker slots, for interrupt_job_workers
+    std::mutex worker_sockets_mutex;
+    std::vector<int> worker_sockets;
+
+    // Serializes callbacks.on_finished across the slots
+    std::mutex worker_callback_mutex;
+
+    // One slot's connection; the heartbeats and progress of a running job share it with the slot's own frames
+    struct WorkerConnection {
+        int fd = -1;
+        std::string inbox;
+        std::mutex send_mutex;
+
+        bool send(const json &message) {
+            std::lock_guard<std::mutex> lock(send_mutex);
+            return send_all(fd, encode_frame(message));
+        }
+
+        bool receive(json &message) {
+            char chunk[4096];
+            bool malformed = false;
+            while (!take_frame(inbox, message, malformed)) {
+                if (malformed) {
+                    return false;
+                }
+                const ssize_t count = recv(fd, chunk, sizeof(chunk), 0);
+                if (count == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (count <= 0) {
+                    return false;
+                }
+                inbox.append(chunk, static_cast<size_t>(count));
+            }
+            return true;
+        }
+    };
+}
+
+// Run one leased job while keeping the lease alive. False when the coordinator went away; the job is
+// cancelled then, the coordinator has given it to someone else.
+static bool run_leased_job(WorkerConnection &connection, const json &message, const BatchSettings &settings,
+                           int heartbeat_ms, const BatchCallbacks &callbacks) {
+    const SyncJob job = {message.value("video", std::string()), message.value("subtitle", std::string()),
+                         message.value("output", std::string()), message.value("reference", std::string())};
+    const size_t index = message.value("job", size_t(0));
+    const uint64_t lease = message.value("lease", uint64_t(0));
+
+    BatchControl control;
+    BatchCallbacks job_callbacks;
+    job_callbacks.on_progress = [&connection, index](const SyncJob &, size_t, double fraction) {
+        connection.send({{"type", "progress"}, {"job", index}, {"fraction", fraction}});
+    };
+    std::atomic<bool> finished{false};
+    JobResult result;
+    std::thread runner([&]() {
+        result = run_sync_jobs({job}, settings, &control, job_callbacks).results[0];
+        finished = true;
+    });
+
+    bool connected = true;
+    auto last_sent = steady_clock::now();
+    while (!finished) {
+        pollfd fd = {connection.fd, POLLIN, 0};
+        if (connected && poll(&fd, 1, 50) > 0) {
+            // The coordinator says nothing during a job, so this is it closing the connection
+            connected = false;
+            cancel_batch(control);
+        } else if (!connected) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        if (connected && steady_clock::now() - last_sent >= std::chrono::milliseconds(heartbeat_ms)) {
+            connected = connection.send({{"type", "heartbeat"}});
+            last_sent = steady_clock::now();
+            if (!connected) {
+                cancel_batch(control);
+            }
+        }
+    }
+    runner.join();
+
+    result.job_index = index;
+    if (connected) {
+        connected = connection.send({{"type", "result"},
+                                     {"job", index},
+                                     {"lease", lease},
+                                     {"success", result.success},
+                                     {"cancelled", result.cancelled},
+                                     {"native", result.native},
+                                     {"split_penalty", result.split_penalty},
+                                     {"exit_code", result.exit_code},
+                                     {"seconds", result.seconds},
+                                     {"cpu_seconds", result.cpu_seconds},
+                                     {"max_rss_kb", result.max_rss_kb},
+                                     {"error", result.error},
+                                     {"output", result.output}});
+    }
+    if (callbacks.on_finished) {
+        std::lock_guard<std::mutex> lock(worker_callback_mutex);
+        callbacks.on_finished(job, result);
+    }
+    return connected;
+}
+
+// One connection from hello to done. True when the coordinator said the batch is over.
+// From hello to done on a connected socket. True when the coordinator said the batch is over.
+static bool run_worker_session(WorkerConnection &connection, const std::string &name, const BatchSettings &local,
+                               std::atomic<bool> &stop, const BatchCallbacks &callbacks) {
+    json message;
+    if (stop || !connection.send({{"type", "hello"}, {"worker", name}}) || !connection.receive(message) ||
+        message["type"] != "welcome") {
+        return false;
+    }
+    // The coordinator decides how its jobs are aligned; the span cache and alass stay this host's
+    BatchSettings settings = local;
+    settings.worker_count = 1;
+    settings.cache = nullptr;
+    settings.journal = nullptr;
+    if (message.contains("alignment") && message["alignment"].is_object()) {
+        read_alignment(message["alignment"], settings.alignment);
+    }
+    const int heartbeat_ms = std::max(10, message.value("heartbeat_ms", 1000));
+
+    while (!stop && connection.send({{"type", "pull"}}) && connection.receive(message)) {
+        if (message["type"] == "done") {
+            return true;
+        }
+        if (message["type"] == "job" && !run_leased_job(connection, message, settings, heartbeat_ms, callbacks)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+static bool serve_coordinator(const FarmAddress &address, const std::string &name, const BatchSettings &local,
+                              std::atomic<bool> &stop, const BatchCallbacks &callbacks) {
+    WorkerConnection connection;
+    connection.fd = connect_to(address);
+    if (connection.fd == -1) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(worker_sockets_mutex);
+        worker_sockets.push_back(connection.fd);
+    }
+
+    bool batch_done = false;
+    try {
+        batch_done = run_worker_session(connection, name, local, stop, callbacks);
+    } catch (const json::exception &) {
+        batch_done = false;  // not a coordinator of ours
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(worker_sockets_mutex);
+        worker_sockets.erase(std::remove(worker_sockets.begin(), worker_sockets.end(), connection.fd),
+                             worker_sockets.end());
+    }
+    close(connection.fd);
+    return batch_done;
+}
+
+void run_job_worker(const FarmAddress &address, unsigned int slots, const BatchSettings &settings, bool once,
+                    std::atomic<bool> &stop, const BatchCallbacks &callbacks) {
+    char host[256] = "localhost";
+    gethostname(host, sizeof(host) - 1);
+
+    auto slot = [&](unsigned int number) {
+        const std::string name =
+            std::string(host) + ":" + std::to_string(getpid()) + "/" + std::to_string(number);
+        while (!stop) {
+            if (serve_coordinator(address, name, settings, stop, callbacks) && once) {
+                return;
+            }
+            // No coordinator yet, or it went away; try again shortly
+            for (int i = 0; i < 10 && !stop; ++i) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < std::max(1u, slots); ++i) {
+        threads.emplace_back(slot, i + 1);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+void interrupt_job_workers() {
+    std::lock_guard<std::mutex> lock(worker_sockets_mutex);
+    for (int fd : worker_sockets) {
+        shutdown(fd, SHUT_RDWR);
+    }
+}
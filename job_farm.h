@@ -0,0 +1,62 @@
+#ifndef JOB_FARM_H
+#define JOB_FARM_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "job_scheduler.h"
+
+// Jobs handed out over a socket to worker processes, possibly on other hosts sharing the same paths.
+// Every message is a 4-byte big-endian length followed by that many bytes of JSON.
+//
+//   worker -> coordinator: hello {worker}, pull, heartbeat, progress {job, fraction},
+//                          result {job, lease, success, exit_code, seconds, ...}
+//   coordinator -> worker: welcome {heartbeat_ms, lease_ms, alignment}, job {job, lease, video, subtitle,
+//                          output}, done
+//
+// A pull is answered once a job is free. A leased job goes back in the queue when its worker disconnects or
+// sends nothing for lease_ms; a result for a lease that was taken back is ignored.
+
+// "unix:/path/to/socket" or "host:port"; an empty host listens on every interface
+struct FarmAddress {
+    bool unix_socket = false;
+    std::string path;
+    std::string host;
+    std::string port;
+};
+
+bool parse_farm_address(const std::string &text, FarmAddress &address);
+
+struct FarmSettings {
+    int heartbeat_ms = 1000;
+    int lease_ms = 10000;  // a worker silent for this long is taken for dead
+};
+
+// Totals for one worker name over every connection it made
+struct FarmWorkerStats {
+    std::string worker;
+    size_t succeeded = 0;
+    size_t failed = 0;
+    size_t lost = 0;            // leases taken back from it
+    double busy_seconds = 0.0;  // sum of its jobs' own times
+    double connected_seconds = 0.0;
+};
+
+// Serve jobs on address until each has a result or control is cancelled. settings.alignment is sent to the
+// workers and settings.journal, when set, records the jobs as in a local batch. Callbacks run on the
+// calling thread.
+BatchReport run_job_coordinator(const FarmAddress &address, const std::vector<SyncJob> &jobs,
+                                const BatchSettings &settings, const FarmSettings &farm, BatchControl *control,
+                                const BatchCallbacks &callbacks, std::vector<FarmWorkerStats> &stats,
+                                std::string &error);
+
+// Worker daemon: slots connections to address, each pulling and running one job at a time with the
+// coordinator's alignment options. Reconnects after a batch or a lost coordinator until stop is set,
+// or after the first batch when once is set. callbacks.on_finished reports each job run here.
+void run_job_worker(const FarmAddress &address, unsigned int slots, const BatchSettings &settings, bool once,
+                    std::atomic<bool> &stop, const BatchCallbacks &callbacks);
+
+// Unblock the sockets run_job_worker waits on, after setting stop; safe from any thread
+void interrupt_job_workers();
+
+#endif // JOB_FARM_H
@@ -0,0 +1,493 @@
+#include "job_scheduler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include "batch_journal.h"
+#include "native_aligner.h"
+#include "process_runner.h"
+#include "trace.h"
+
+namespace fs = std::filesystem;
+using steady_clock = std::chrono::steady_clock;
+
+static double seconds_since(steady_clock::time_point start) {
+    return std::chrono::duration<double>(steady_clock::now() - start).count();
+}
+
+unsigned int resolve_worker_count(int configured_workers) {
+    if (configured_workers > 0) {
+        return static_cast<unsigned int>(configured_workers);
+    }
+    // hardware_concurrency() may report 0 when it cannot be determined
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+std::vector<std::string> build_alass_argv(const SyncJob &job, const AlignmentOptions &options) {
+    char penalty[32];
+    snprintf(penalty, sizeof(penalty), "%g", options.split_penalty);
+    std::vector<std::string> argv = {"alass", "--split-penalty", penalty};
+    if (options.disable_fps_guessing) {
+        argv.push_back("--disable-fps-guessing");
+    }
+    argv.push_back(job_reference(job));
+    argv.push_back(job.subtitle_file);
+    argv.push_back(job.output_file);
+    return argv;
+}
+
+AlignmentParams make_alignment_params(const AlignmentOptions &options) {
+    AlignmentParams params;
+    params.split_penalty = options.split_penalty;
+    params.guess_framerate = !options.disable_fps_guessing;
+    params.sweep_penalties = options.penalty_sweep;
+    return params;
+}
+
+static double thread_cpu_seconds() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) != 0) {
+        return 0.0;
+    }
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+// alass writes here and the file is renamed to the real output once alass succeeded. The name keeps the
+// extension, alass picks the output format by it. The counter keeps two runs of one output in this
+// process apart, such as a farm job run again after its lease was taken back.
+static std::string partial_output_path(const std::string &output_file) {
+    static std::atomic<unsigned int> next_partial{0};
+    const fs::path output = output_file;
+    return (output.parent_path() / (".partial-" + std::to_string(getpid()) + "-" + std::to_string(next_partial++) +
+                                    "-" + output.filename().string()))
+        .string();
+}
+
+// Flush a finished output to disk before it is renamed into place
+static bool sync_file(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    const bool synced = fdatasync(fd) == 0;
+    close(fd);
+    return synced;
+}
+
+static JobResult run_job(const SyncJob &job, size_t index, const BatchSettings &settings, BatchControl *control,
+                         NativeAligner &aligner, const std::function<void(double)> &on_progress) {
+    JobResult result;
+    result.job_index = index;
+    result.split_penalty = settings.alignment.split_penalty;
+    const auto start = steady_clock::now();
+
+    // Skip pairs whose inputs and options are unchanged since their output was written
+    std::string cache_key;
+    FileFingerprint video;
+    FileFingerprint subtitle;
+    if (settings.cache) {
+        TRACE_SCOPE("cache_check");
+        if (fingerprint_file(job_reference(job), video) && fingerprint_file(job.subtitle_file, subtitle)) {
+            cache_key = sync_cache_key(video, subtitle, settings.alignment, job.output_file);
+            if (sync_cache_lookup(*settings.cache, cache_key, job.output_file)) {
+                result.cached = true;
+                result.success = true;
+                result.exit_code = 0;
+                result.seconds = seconds_since(start);
+                return result;
+            }
+        }
+    }
+
+    // In-process when the built-in aligner reads both inputs, no fork/exec per episode
+    const std::string &reference = job_reference(job);
+    if (settings.alignment.engine == ENGINE_NATIVE && native_alignment_supported(reference, job.subtitle_file)) {
+        TRACE_SCOPE("native_align");
+        const double cpu_start = thread_cpu_seconds();
+        AlignmentParams params = make_alignment_params(settings.alignment);
+        params.sweep_threads = aligner.sweep_threads;
+        AlignmentResult alignment;
+        result.native = true;
+        result.success = align_subtitle_file(aligner, reference, job.subtitle_file, job.output_file, params, alignment,
+                                             result.error);
+        if (result.success) {
+            result.split_penalty = alignment.split_penalty;
+        }
+        result.exit_code = result.success ? 0 : 1;
+        result.cancelled = !result.success && control && control->cancelled;
+        result.seconds = seconds_since(start);
+        result.cpu_seconds = thread_cpu_seconds() - cpu_start;
+        if (result.success && !cache_key.empty()) {
+            sync_cache_store(*settings.cache, cache_key, job.output_file);
+        }
+        return result;
+    }
+
+    TRACE_SCOPE("process_run");
+    SyncJob partial_job = job;
+    partial_job.output_file = partial_output_path(job.output_file);
+    SpawnedProcess process;
+    if (!spawn_process(build_alass_argv(partial_job, settings.alignment), process)) {
+        result.error = "cannot start alass: " + std::string(strerror(errno));
+        result.seconds = seconds_since(start);
+        return result;
+    }
+    const pid_t pid = process.pid;
+
+    if (control) {
+        std::lock_guard<std::mutex> lock(control->mutex);
+        control->running.push_back(pid);
+        // A cancel may have landed between picking the job and registering the child
+        if (control->cancelled) {
+            kill(-pid, SIGTERM);
+        }
+    }
+
+    // Progress is passed on when it moved by a percent, alass redraws its bar far more often
+    double reported = -1.0;
+    OutputRing output;
+    ProcessUsage usage;
+    collect_process(process, output, [&](const std::string &line) {
+        double fraction = 0.0;
+        if (on_progress && parse_progress(line, fraction) && (fraction - reported >= 0.01 || fraction == 1.0) &&
+            fraction != reported) {
+            reported = fraction;
+            on_progress(fraction);
+        }
+    }, usage);
+    result.seconds = seconds_since(start);
+    result.cpu_seconds = usage.user_seconds + usage.system_seconds;
+    result.max_rss_kb = usage.max_rss_kb;
+
+    result.exit_code = usage.exit_code;
+    if (usage.wait_errno != 0) {
+        result.error = "cannot wait for alass: " + std::string(strerror(usage.wait_errno));
+    }
+    if (control) {
+        std::lock_guard<std::mutex> lock(control->mutex);
+        control->running.erase(std::remove(control->running.begin(), control->running.end(), pid),
+                               control->running.end());
+        // A child that finished before the cancel reached it keeps its output
+        result.cancelled = control->cancelled && result.exit_code != 0;
+    }
+
+    result.success = result.exit_code == 0 && !result.cancelled;
+    if (result.success && (!sync_file(partial_job.output_file) ||
+                           std::rename(partial_job.output_file.c_str(), job.output_file.c_str()) != 0)) {
+        result.success = false;
+        result.error = "cannot move the output into place: " + std::string(strerror(errno));
+    }
+    if (!result.success) {
+        unlink(partial_job.output_file.c_str());
+        result.output = output.text();
+    }
+    if (result.success && !cache_key.empty()) {
+        sync_cache_store(*settings.cache, cache_key, job.output_file);
+    }
+    return result;
+}
+
+// Rough peak memory of aligning against one video: decoding buffers plus audio that grows with its length,
+// which the file size stands in for
+static uint64_t estimate_job_memory(uint64_t video_bytes) {
+    return (64ULL << 20) + video_bytes / 8;
+}
+
+// Whether the block device behind dev is a spinning disk. A partition has no queue of its own,
+// its disk's is one level up.
+static bool is_rotational(dev_t device) {
+    const std::string block = "/sys/dev/block/" + std::to_string(major(device)) + ":" + std::to_string(minor(device));
+    for (const char *queue : {"/queue/rotational", "/../queue/rotational"}) {
+        std::ifstream file(block + queue);
+        int rotational = 0;
+        if (file >> rotational) {
+            return rotational != 0;
+        }
+    }
+    return false;
+}
+
+namespace {
+    struct JobPlan {
+        uint64_t bytes = 0;
+        uint64_t memory = 0;
+        size_t queue = 0;
+    };
+
+    struct DeviceQueue {
+        dev_t device = 0;
+        std::vector<size_t> jobs;  // largest at the back
+        unsigned int running = 0;
+        unsigned int limit = 1;
+        unsigned int max_limit = 1;
+        // Throughput of the current round, one round being as many completions as the limit allows
+        steady_clock::time_point round_start = steady_clock::now();
+        unsigned int round_jobs = 0;
+        double round_work = 0.0;
+        double last_throughput = 0.0;
+        bool last_grew = false;
+        bool slow_start = true;
+    };
+
+    // Hands out jobs: one queue per disk so a busy HDD doesn't hold back jobs on an SSD, largest video
+    // first so the batch doesn't end waiting on one long movie, within the memory budget
+    struct JobDispatcher {
+        const BatchSettings &settings;
+        BatchControl *control;
+        std::vector<JobPlan> plans;
+        std::vector<DeviceQueue> queues;
+        std::mutex mutex;
+        std::condition_variable wake;
+        uint64_t memory_in_use = 0;
+        double rss_per_byte = 0.0;  // highest peak RSS per video byte any alass child reached so far
+
+        JobDispatcher(const std::vector<SyncJob> &jobs, const BatchSettings &settings, BatchControl *control)
+            : settings(settings), control(control), plans(jobs.size()) {
+            for (size_t i = 0; i < jobs.size(); ++i) {
+                struct stat info;
+                dev_t device = 0;
+                if (stat(job_reference(jobs[i]).c_str(), &info) == 0) {
+                    device = info.st_dev;
+                    plans[i].bytes = static_cast<uint64_t>(info.st_size);
+                }
+                plans[i].memory = estimate_job_memory(plans[i].bytes);
+                plans[i].queue = queue_for(device);
+                queues[plans[i].queue].jobs.push_back(i);
+            }
+            // Popped from the back: the largest last, equal sizes in job order
+            for (auto &queue : queues) {
+                std::sort(queue.jobs.begin(), queue.jobs.end(), [&](size_t a, size_t b) {
+                    return plans[a].bytes != plans[b].bytes ? plans[a].bytes < plans[b].bytes : a > b;
+                });
+            }
+        }
+
+        size_t queue_for(dev_t device) {
+            for (size_t i = 0; i < queues.size(); ++i) {
+                if (queues[i].device == device) {
+                    return i;
+                }
+            }
+            DeviceQueue queue;
+            queue.device = device;
+            const unsigned int workers = std::max(1u, settings.worker_count);
+            queue.max_limit = workers;
+            if (settings.hdd_jobs > 0 && device != 0 && is_rotational(device)) {
+                queue.max_limit = std::min(workers, settings.hdd_jobs);
+            }
+            // Adaptive disks start halfway and find their level from there
+            queue.limit = settings.adaptive ? std::max(1u, queue.max_limit / 2) : queue.max_limit;
+            queues.push_back(std::move(queue));
+            return queues.size() - 1;
+        }
+
+        // The static estimate until finished children showed that jobs take more
+        uint64_t memory_estimate(const JobPlan &plan) const {
+            const double measured = estimate_job_memory(0) + rss_per_byte * static_cast<double>(plan.bytes);
+            return std::max(plan.memory, static_cast<uint64_t>(measured));
+        }
+
+        // A job larger than the whole budget still runs, alone
+        bool memory_fits(const JobPlan &plan) const {
+            return settings.memory_budget == 0 || memory_in_use == 0 ||
+                   memory_in_use + memory_estimate(plan) <= settings.memory_budget;
+        }
+
+        // Block until a job may start; false once every job is handed out or the batch is cancelled
+        bool next(size_t &job) {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                if (control && control->cancelled) {
+                    return false;
+                }
+                bool any_left = false;
+                DeviceQueue *best = nullptr;
+                for (auto &queue : queues) {
+                    if (queue.jobs.empty()) {
+                        continue;
+                    }
+                    any_left = true;
+                    const JobPlan &plan = plans[queue.jobs.back()];
+                    if (queue.running >= queue.limit || !memory_fits(plan)) {
+                        continue;
+                    }
+                    if (!best || plan.bytes > plans[best->jobs.back()].bytes) {
+                        best = &queue;
+                    }
+                }
+                if (best) {
+                    job = best->jobs.back();
+                    best->jobs.pop_back();
+                    ++best->running;
+                    // What is reserved now is what finished() gives back
+                    plans[job].memory = memory_estimate(plans[job]);
+                    memory_in_use += plans[job].memory;
+                    return true;
+                }
+                if (!any_left) {
+                    return false;
+                }
+                // Woken by a finished job; the timeout only catches a cancel, which doesn't notify
+                wake.wait_for(lock, std::chrono::milliseconds(50));
+            }
+        }
+
+        void finished(size_t job, const JobResult &result) {
+            std::lock_guard<std::mutex> lock(mutex);
+            DeviceQueue &queue = queues[plans[job].queue];
+            --queue.running;
+            memory_in_use -= plans[job].memory;
+            // The fixed part of the estimate is taken off so small jobs don't inflate the ratio
+            if (result.max_rss_kb > 0) {
+                const double bytes = static_cast<double>(std::max<uint64_t>(plans[job].bytes, 1ULL << 20));
+                const double grown = static_cast<double>(result.max_rss_kb) * 1024.0 - estimate_job_memory(0);
+                rss_per_byte = std::max(rss_per_byte, grown / bytes);
+            }
+            // A cached job says nothing about how fast the disk aligns
+            if (settings.adaptive && !result.cached && !result.cancelled) {
+                record_throughput(queue, plans[job]);
+            }
+            wake.notify_all();
+        }
+
+        // Hill climbing on throughput: double the limit while each round is clearly faster, then step by
+        // one. A raise that didn't pay off, or a round that got slower, takes one job away again.
+        void record_throughput(DeviceQueue &queue, const JobPlan &plan) {
+            // Jobs too small to say anything about I/O count as 1 MiB so equal jobs weigh the same
+            queue.round_work += static_cast<double>(std::max<uint64_t>(plan.bytes, 1ULL << 20));
+            if (++queue.round_jobs < queue.limit) {
+                return;
+            }
+            const auto now = steady_clock::now();
+            const double seconds = std::max(1e-6, std::chrono::duration<double>(now - queue.round_start).count());
+            const double throughput = queue.round_work / seconds;
+            const unsigned int previous = queue.limit;
+            if (queue.last_throughput == 0.0 || throughput > queue.last_throughput * 1.1) {
+                queue.limit = std::min(queue.max_limit, queue.slow_start ? queue.limit * 2 : queue.limit + 1);
+            } else if (queue.last_grew || throughput < queue.last_throughput * 0.9) {
+                queue.limit = std::max(1u, queue.limit - 1);
+                queue.slow_start = false;
+            } else {
+                queue.slow_start = false;
+            }
+            queue.last_grew = queue.limit > previous;
+            queue.last_throughput = throughput;
+            queue.round_start = now;
+            queue.round_jobs = 0;
+            queue.round_work = 0.0;
+        }
+    };
+}
+
+BatchReport run_sync_jobs(const std::vector<SyncJob> &jobs, const BatchSettings &settings, BatchControl *control,
+                          const BatchCallbacks &callbacks) {
+    BatchReport report;
+    report.results.resize(jobs.size());
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        report.results[i].job_index = i;
+        report.results[i].cancelled = true;  // overwritten once the job actually runs
+    }
+    report.worker_count = std::max(1u, std::min<unsigned int>(settings.worker_count, jobs.size()));
+
+    const auto start = steady_clock::now();
+    const int64_t start_us = trace_now_us();
+    JobDispatcher dispatcher(jobs, settings, control);
+    std::mutex callback_mutex;
+
+    // Each worker takes the next job the dispatcher allows until none are left or the batch is cancelled
+    auto worker = [&](unsigned int number) {
+        trace_set_thread_name("worker " + std::to_string(number));
+        NativeAligner aligner;  // reused by every native job of this worker
+        aligner.span_cache_dir = settings.span_cache_dir;
+        aligner.cancelled = control ? &control->cancelled : nullptr;
+        // A sweep gets the cores the batch workers leave idle
+        aligner.sweep_threads = std::max(1u, std::thread::hardware_concurrency() / report.worker_count);
+        size_t i = 0;
+        while (dispatcher.next(i)) {
+            // Every job is queued when the batch starts
+            if (trace_enabled()) {
+                trace_record("queue_wait", start_us, trace_now_us() - start_us);
+            }
+            if (callbacks.on_started) {
+                std::lock_guard<std::mutex> lock(callback_mutex);
+                callbacks.on_started(jobs[i], i);
+            }
+            if (settings.journal) {
+                journal_job_running(*settings.journal, i);
+            }
+            report.results[i] = run_job(jobs[i], i, settings, control, aligner, [&](double fraction) {
+                if (callbacks.on_progress) {
+                    std::lock_guard<std::mutex> lock(callback_mutex);
+                    callbacks.on_progress(jobs[i], i, fraction);
+                }
+            });
+            dispatcher.finished(i, report.results[i]);
+            // A cancelled job stays "running" in the journal and is resumed with the rest
+            if (settings.journal && !report.results[i].cancelled) {
+                FileFingerprint video;
+                FileFingerprint subtitle;
+                if (report.results[i].success && fingerprint_file(job_reference(jobs[i]), video) &&
+                    fingerprint_file(jobs[i].subtitle_file, subtitle)) {
+                    journal_job_done(*settings.journal, i, jobs[i].output_file, video, subtitle);
+                } else {
+                    journal_job_failed(*settings.journal, i, report.results[i].exit_code);
+                }
+            }
+            if (callbacks.on_finished) {
+                std::lock_guard<std::mutex> lock(callback_mutex);
+                callbacks.on_finished(jobs[i], report.results[i]);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < report.worker_count && !jobs.empty(); ++i) {
+        workers.emplace_back(worker, i + 1);
+    }
+    for (auto &thread : workers) {
+        thread.join();
+    }
+
+    count_batch_results(report, settings.alignment);
+    report.wall_seconds = seconds_since(start);
+    return report;
+}
+
+void count_batch_results(BatchReport &report, const AlignmentOptions &alignment) {
+    for (const auto &result : report.results) {
+        if (result.cached) {
+            ++report.cached;
+        }
+        if (result.success) {
+            ++report.succeeded;
+        } else if (result.cancelled) {
+            ++report.cancelled;
+        } else {
+            ++report.failed;
+        }
+        // Inputs the built-in aligner can't read go to alass, which has no sweep
+        if (result.success && !result.cached && !result.native && !alignment.penalty_sweep.empty()) {
+            ++report.unswept;
+        }
+    }
+}
+
+void cancel_batch(BatchControl &control) {
+    std::lock_guard<std::mutex> lock(control.mutex);
+    control.cancelled = true;
+    for (pid_t pid : control.running) {
+        kill(-pid, SIGTERM);
+    }
+}
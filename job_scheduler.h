@@ -0,0 +1,103 @@
+#ifndef JOB_SCHEDULER_H
+#define JOB_SCHEDULER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "alignment.h"
+#include "sync_cache.h"
+
+// One alass invocation: align subtitle_file against video_file and write output_file
+struct SyncJob {
+    std::string video_file;
+    std::string subtitle_file;
+    std::string output_file;
+    std::string reference_file;  // a trusted subtitle of the episode aligned against instead, empty = the video
+};
+
+// What the job's subtitle is aligned against: its reference subtitle, or else the video
+inline const std::string &job_reference(const SyncJob &job) {
+    return job.reference_file.empty() ? job.video_file : job.reference_file;
+}
+
+// Outcome of a single job
+struct JobResult {
+    size_t job_index = 0;
+    bool success = false;
+    bool cancelled = false;
+    bool cached = false;  // skipped, the output from an earlier run is still valid
+    bool native = false;  // aligned in-process rather than by an alass child
+    double split_penalty = 0.0;  // the one used, or the one a penalty sweep picked
+    int exit_code = -1;
+    double seconds = 0.0;
+    double cpu_seconds = 0.0;  // user plus system time of the alass child or the native worker thread
+    long max_rss_kb = 0;       // peak resident size of the alass child, 0 for native jobs
+    std::string error;    // why a native alignment failed, or why alass could not start
+    std::string output;   // the last of what alass printed, kept for failures
+};
+
+// Outcome of a whole batch, results are in job order
+struct BatchReport {
+    std::vector<JobResult> results;
+    size_t succeeded = 0;
+    size_t failed = 0;
+    size_t cancelled = 0;
+    size_t cached = 0;
+    size_t unswept = 0;  // synced by alass with the single penalty although a sweep was asked for
+    unsigned int worker_count = 0;
+    double wall_seconds = 0.0;
+};
+
+// Shared between the batch and whoever may cancel it; tracks the in-flight child processes
+struct BatchControl {
+    std::atomic<bool> cancelled{false};
+    std::mutex mutex;
+    std::vector<pid_t> running;
+};
+
+struct BatchJournal;
+
+struct BatchSettings {
+    unsigned int worker_count = 1;
+    uint64_t memory_budget = 0;  // bytes the running jobs may take together by estimate, 0 = unlimited
+    unsigned int hdd_jobs = 2;   // jobs at once reading from one spinning disk, 0 = as many as workers
+    bool adaptive = true;        // grow or shrink each disk's concurrency by its measured throughput
+    AlignmentOptions alignment;
+    SyncCache *cache = nullptr;  // optional; jobs with a valid cached output are skipped
+    std::string span_cache_dir;  // where speech spans of videos are kept, empty = extract every time
+    BatchJournal *journal = nullptr;  // optional; each job's start and end is recorded for resuming
+};
+
+// The callbacks are invoked from the worker threads, serialized by the scheduler
+struct BatchCallbacks {
+    std::function<void(const SyncJob &job, size_t job_index)> on_started;
+    // Progress alass reports while it runs, 0 to 1, at most once per percent
+    std::function<void(const SyncJob &job, size_t job_index, double fraction)> on_progress;
+    std::function<void(const SyncJob &job, const JobResult &result)> on_finished;
+};
+
+// Number of workers to use: the configured value if positive, otherwise the hardware concurrency
+unsigned int resolve_worker_count(int configured_workers);
+
+// The alass invocation as an argument vector; paths are passed as they are, no quoting needed
+std::vector<std::string> build_alass_argv(const SyncJob &job, const AlignmentOptions &options);
+
+AlignmentParams make_alignment_params(const AlignmentOptions &options);
+
+// Run all jobs across settings.worker_count threads and block until the batch is done or cancelled.
+// Jobs are queued per disk of their reference, largest first, and a worker takes the largest job whose
+// disk and the memory budget have room. control may be null when the batch never needs cancelling.
+BatchReport run_sync_jobs(const std::vector<SyncJob> &jobs, const BatchSettings &settings, BatchControl *control,
+                          const BatchCallbacks &callbacks);
+
+// Fill the totals of report from its results
+void count_batch_results(BatchReport &report, const AlignmentOptions &alignment);
+
+// Stop handing out jobs and terminate the running children; safe to call from any thread
+void cancel_batch(BatchControl &control);
+
+#endif // JOB_SCHEDULER_H
@@ -1,11 +1,22 @@
 #include <gtk/gtk.h>
+#include <chrono>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <filesystem>
 #include <fstream>
-#include <regex>
+#include <thread>
 #include <vector>
 #include "nlohmann/json.hpp"
+#include "batch_cli.h"
+#include "batch_journal.h"
+#include "episode_pattern.h"
+#include "file_list_view.h"
+#include "match_preview.h"
+#include "scan_snapshot.h"
+#include "span_cache.h"
+#include "stage_table_view.h"
+#include "sync_core.h"
 
 namespace fs = std::filesystem;
 using json = nlohmann::json;
@@ -22,6 +33,7 @@ typedef struct {
     GtkWidget *srt_folder_label;
     GtkWidget *video_regex_label;
     GtkWidget *subtitle_regex_label;
+    GtkWidget *reference_regex_label;
     GtkWidget *video_match_index_label;
     GtkWidget *subtitle_match_index_label;
 
@@ -30,6 +42,8 @@ typedef struct {
     GtkWidget *srt_folder_entry;
     GtkWidget *video_regex_entry;
     GtkWidget *subtitle_regex_entry;
+    GtkWidget *reference_regex_entry;
+    GtkWidget *match_full_path_checkbox;
 
     // Spin buttons
     GtkWidget *video_match_index_input;
@@ -41,40 +55,85 @@ typedef struct {
     GtkWidget *show_video_dir_button;
     GtkWidget *show_srt_dir_button;
 
-    // File list boxes
-    GtkWidget *video_file_list_box;
-    GtkWidget *srt_file_list_box;
+    // File lists
+    FileListView video_file_list;
+    FileListView srt_file_list;
 
     // Add new widgets to AppWidgets structure
     GtkWidget *output_name_label;
     GtkWidget *output_name_entry;
     GtkWidget *disable_fps_guessing_checkbox;
+    GtkWidget *native_aligner_checkbox;
+    GtkWidget *sweep_penalty_checkbox;
     GtkWidget *ui_scale_slider;
     GtkWidget *scrollbar_checkbox;
     GtkWidget *split_penalty_slider;
     GtkWidget *show_video_folder_button;
     GtkWidget *show_srt_folder_button;
 
-    std::vector<std::string> video_files;
-    std::vector<std::string> subtitle_files;
+    // Batch progress
+    GtkWidget *progress_bar;
+    GtkWidget *current_file_label;
+    GtkWidget *cancel_button;
+    StageTableView stage_table;  // where the last batch spent its time
+
+    FileCatalog video_files;
+    FileCatalog subtitle_files;
+    // Immutable copies of the catalogs for the preview thread and the list views, rebuilt only after
+    // the catalogs change
+    std::shared_ptr<const FileCatalog> video_snapshot;
+    std::shared_ptr<const FileCatalog> subtitle_snapshot;
+    // Where each list came from, with the directories its scan listed; folder stays empty until a scan
+    // finishes, so an incomplete list is never saved as the scan snapshot
+    FolderSnapshot video_source;
+    FolderSnapshot subtitle_source;
     std::string config_file = "sync_config.json";
+    SyncSettings settings;  // config values without a widget
     bool video_dir_visible = true;
     bool srt_dir_visible = true;
+
+    // Background sync batch, only touched from the GTK thread
+    std::thread batch_thread;
+    std::shared_ptr<BatchControl> batch_control;
+    std::chrono::steady_clock::time_point batch_start;
+    size_t batch_total = 0;
+    size_t batch_finished = 0;
+    SyncCache sync_cache;
+    bool closing = false;
+
+    // Directory scans in flight, one per folder; replaced or cancelled when the folder changes
+    std::shared_ptr<ScanControl> video_scan;
+    std::shared_ptr<ScanControl> srt_scan;
+    guint refresh_view_source = 0;
+
+    // Live preview of regex and index edits, matched off the GTK thread
+    MatchPreview match_preview;
+    guint preview_source = 0;
 } AppWidgets;
 
 // Function declarations
+static void start_sync_batch(AppWidgets *app_widgets, std::vector<SyncJob> jobs, BatchSettings settings);
 void on_refresh_button_clicked(GtkWidget *widget, gpointer data);
+void on_video_folder_entry_changed(GtkWidget *widget, gpointer data);
+void on_srt_folder_entry_changed(GtkWidget *widget, gpointer data);
 void on_sync_button_clicked(GtkWidget *widget, gpointer data);
+void on_cancel_button_clicked(GtkWidget *widget, gpointer data);
+void on_window_destroy(GtkWidget *widget, gpointer data);
 void on_episode_regex_value_changed(GtkWidget *widget, gpointer data);
+void on_native_aligner_toggled(GtkWidget *widget, gpointer data);
 void on_show_video_dir_button_clicked(GtkWidget *widget, gpointer data);
 void on_show_srt_dir_button_clicked(GtkWidget *widget, gpointer data);
 void show_file_matches(AppWidgets *app_widgets);
+std::shared_ptr<const FileCatalog> shared_files(AppWidgets *app_widgets, bool video_side);
+void start_live_preview(AppWidgets *app_widgets);
+void restore_scan_snapshot(AppWidgets *app_widgets);
+void schedule_batch_resume(AppWidgets *app_widgets);
+void store_scan_state(AppWidgets *app_widgets);
 void save_values(AppWidgets *app_widgets);
+SyncRequest read_sync_request_from_widgets(AppWidgets *app_widgets);
 void load_saved_values(AppWidgets *app_widgets);
 void log_message(const std::string &message);
 void log_error(const std::string &message);
-std::vector<std::string> get_files_in_directory(const std::string &directory);
-std::vector<std::string> extract_episode_numbers(const std::vector<std::string> &files, const std::string &regex);
 
 
 // Folder selection function
@@ -122,16 +181,17 @@ std::string escape_backslashes(const std::string &input) {
 
 // Function to validate the regex
 bool is_valid_regex(const std::string &regex_str) {
-    try {
-        std::regex re(regex_str);
-        return true;
-    } catch (const std::regex_error &) {
-        return false;
-    }
+    // Compiling through the pattern cache means the later extraction reuses this work
+    return compile_episode_pattern(regex_str) != nullptr;
 }
 
 // Main function
 int main(int argc, char *argv[]) {
+    // Headless batch mode never touches GTK
+    if (is_batch_cli_invocation(argc, argv)) {
+        return run_batch_cli(argc, argv);
+    }
+
     gtk_init(&argc, &argv);
 
     AppWidgets app_widgets = {};
@@ -150,6 +210,7 @@ int main(int argc, char *argv[]) {
     app_widgets.srt_folder_label = gtk_label_new("Subtitle Folder:");
     app_widgets.video_regex_label = gtk_label_new("Video Matching Regex:");
     app_widgets.subtitle_regex_label = gtk_label_new("Subtitle Matching Regex:");
+    app_widgets.reference_regex_label = gtk_label_new("Trusted Reference Subtitle Regex (empty = none):");
     app_widgets.video_match_index_label = gtk_label_new("Video Regex Match Index:");
     app_widgets.subtitle_match_index_label = gtk_label_new("Subtitle Regex Match Index:");
 
@@ -160,6 +221,11 @@ int main(int argc, char *argv[]) {
     gtk_entry_set_text(GTK_ENTRY(app_widgets.video_regex_entry), R"(\d+)");  // Default regex for videos
     app_widgets.subtitle_regex_entry = gtk_entry_new();
     gtk_entry_set_text(GTK_ENTRY(app_widgets.subtitle_regex_entry), R"(\d+)");  // Default regex for subtitles
+    // Already synced subtitles, e.g. \.en\.srt; others of their episode are aligned against them
+    app_widgets.reference_regex_entry = gtk_entry_new();
+    app_widgets.match_full_path_checkbox = gtk_check_button_new_with_label("Match Patterns Against Subfolder Paths");
+    gtk_widget_set_tooltip_text(app_widgets.match_full_path_checkbox,
+                                "Off: only the file name is matched. On: e.g. \"Season 01/Show - 05.mkv\"");
 
     // Spin buttons for match index
     app_widgets.video_match_index_input = gtk_spin_button_new_with_range(1, 10, 1);
@@ -171,14 +237,18 @@ int main(int argc, char *argv[]) {
     app_widgets.show_video_dir_button = gtk_button_new_with_label("Show Video Files");
     app_widgets.show_srt_dir_button = gtk_button_new_with_label("Show Subtitle Files");
 
-    // File list boxes
-    app_widgets.video_file_list_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 2);
-    app_widgets.srt_file_list_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 2);
+    // File lists
+    create_file_list_view(app_widgets.video_file_list, "Video File", "Matched Subtitle");
+    create_file_list_view(app_widgets.srt_file_list, "Subtitle File", "Matched Video");
 
     app_widgets.output_name_label = gtk_label_new("Output File Name:");
     app_widgets.output_name_entry = gtk_entry_new();
 
     app_widgets.disable_fps_guessing_checkbox = gtk_check_button_new_with_label("Disable FPS Guessing");
+    app_widgets.native_aligner_checkbox = gtk_check_button_new_with_label("Use Built-in Aligner (Experimental)");
+    gtk_widget_set_tooltip_text(app_widgets.native_aligner_checkbox,
+                                "Align in-process instead of running alass; not yet checked against alass results");
+    app_widgets.sweep_penalty_checkbox = gtk_check_button_new_with_label("Sweep Split Penalty Per Episode");
     
     // Added scale for UI scaling
     app_widgets.ui_scale_slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 0, 4, 0.1);
@@ -187,12 +257,22 @@ int main(int argc, char *argv[]) {
     app_widgets.scrollbar_checkbox = gtk_check_button_new_with_label("Enable Scrollbar");
     // Added split penalty slider
     app_widgets.split_penalty_slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 0, 300, 1);
+    gtk_range_set_value(GTK_RANGE(app_widgets.split_penalty_slider), 7);  // alass' own default
+    gtk_widget_set_tooltip_text(app_widgets.split_penalty_slider, "0 keeps one constant offset for the whole file");
     gtk_scale_set_value_pos(GTK_SCALE(app_widgets.split_penalty_slider), GTK_POS_RIGHT);
 
     // Added folder select buttons
     app_widgets.show_video_folder_button = gtk_button_new_with_label("Select Video Folder");
     app_widgets.show_srt_folder_button = gtk_button_new_with_label("Select Subtitle Folder");
 
+    // Batch progress widgets
+    app_widgets.progress_bar = gtk_progress_bar_new();
+    gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(app_widgets.progress_bar), TRUE);
+    app_widgets.current_file_label = gtk_label_new("");
+    app_widgets.cancel_button = gtk_button_new_with_label("Cancel Sync");
+    gtk_widget_set_sensitive(app_widgets.cancel_button, FALSE);
+    create_stage_table_view(app_widgets.stage_table);
+
     // Add widgets to the vertical box container
     gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.video_folder_label, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.video_folder_entry, FALSE, FALSE, 0);
@@ -204,6 +284,9 @@ int main(int argc, char *argv[]) {
     gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.video_regex_entry, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.subtitle_regex_label, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.subtitle_regex_entry, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.reference_regex_label, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.reference_regex_entry, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.match_full_path_checkbox, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.video_match_index_label, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.video_match_index_input, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.subtitle_match_index_label, FALSE, FALSE, 0);
@@ -213,23 +296,40 @@ int main(int argc, char *argv[]) {
     gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.output_name_label, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.output_name_entry, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.disable_fps_guessing_checkbox, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.native_aligner_checkbox, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.ui_scale_slider, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.scrollbar_checkbox, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.split_penalty_slider, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.sweep_penalty_checkbox, FALSE, FALSE, 0);
 
     gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.refresh_button, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.sync_button, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.cancel_button, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.progress_bar, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.current_file_label, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.stage_table.tree_view, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.show_video_dir_button, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.show_srt_dir_button, FALSE, FALSE, 0);
-    gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.video_file_list_box, TRUE, TRUE, 0);
-    gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.srt_file_list_box, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.video_file_list.scrolled_window, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(app_widgets.vbox), app_widgets.srt_file_list.scrolled_window, TRUE, TRUE, 0);
 
     // Load saved configurations (if any)
-    // load_saved_values(&app_widgets); // You would need to implement this function
+    load_saved_values(&app_widgets);
 
     // Set up signal handlers for widgets
     g_signal_connect(app_widgets.refresh_button, "clicked", G_CALLBACK(on_refresh_button_clicked), &app_widgets);
+    g_signal_connect(app_widgets.video_folder_entry, "changed", G_CALLBACK(on_video_folder_entry_changed), &app_widgets);
+    g_signal_connect(app_widgets.srt_folder_entry, "changed", G_CALLBACK(on_srt_folder_entry_changed), &app_widgets);
     g_signal_connect(app_widgets.sync_button, "clicked", G_CALLBACK(on_sync_button_clicked), &app_widgets);
+    g_signal_connect(app_widgets.video_regex_entry, "changed", G_CALLBACK(on_episode_regex_value_changed), &app_widgets);
+    g_signal_connect(app_widgets.subtitle_regex_entry, "changed", G_CALLBACK(on_episode_regex_value_changed), &app_widgets);
+    g_signal_connect(app_widgets.reference_regex_entry, "changed", G_CALLBACK(on_episode_regex_value_changed), &app_widgets);
+    g_signal_connect(app_widgets.match_full_path_checkbox, "toggled", G_CALLBACK(on_episode_regex_value_changed), &app_widgets);
+    g_signal_connect(app_widgets.video_match_index_input, "value-changed", G_CALLBACK(on_episode_regex_value_changed), &app_widgets);
+    g_signal_connect(app_widgets.subtitle_match_index_input, "value-changed", G_CALLBACK(on_episode_regex_value_changed), &app_widgets);
+    g_signal_connect(app_widgets.cancel_button, "clicked", G_CALLBACK(on_cancel_button_clicked), &app_widgets);
+    g_signal_connect(app_widgets.native_aligner_checkbox, "toggled", G_CALLBACK(on_native_aligner_toggled), &app_widgets);
+    on_native_aligner_toggled(app_widgets.native_aligner_checkbox, &app_widgets);
     g_signal_connect(app_widgets.show_video_dir_button, "clicked", G_CALLBACK(on_show_video_dir_button_clicked), &app_widgets);
     g_signal_connect(app_widgets.show_srt_dir_button, "clicked", G_CALLBACK(on_show_srt_dir_button_clicked), &app_widgets);
 
@@ -237,104 +337,658 @@ int main(int argc, char *argv[]) {
     g_signal_connect(app_widgets.show_video_folder_button, "clicked", G_CALLBACK(on_video_folder_select_button_clicked), &app_widgets);
     g_signal_connect(app_widgets.show_srt_folder_button, "clicked", G_CALLBACK(on_srt_folder_select_button_clicked), &app_widgets);
 
+    start_live_preview(&app_widgets);
+    restore_scan_snapshot(&app_widgets);
+
     // Ensure the widgets are properly displayed
     gtk_widget_show_all(app_widgets.window);
+    schedule_batch_resume(&app_widgets);
 
     // Main event loop
-    g_signal_connect(app_widgets.window, "destroy", G_CALLBACK(gtk_main_quit), NULL);
+    g_signal_connect(app_widgets.window, "destroy", G_CALLBACK(on_window_destroy), &app_widgets);
     gtk_main();
 
     return 0;
 }
 
+// Batch of scanned files posted from a scan thread to the GTK main loop
+struct ScanEvent {
+    AppWidgets *app_widgets;
+    std::shared_ptr<ScanControl> control;
+    bool video_side;
+    std::string folder;
+    uint64_t options_hash;
+    ScanBatch batch;
+};
+
+static gboolean on_refresh_view_timeout(gpointer data) {
+    AppWidgets *app_widgets = static_cast<AppWidgets *>(data);
+    app_widgets->refresh_view_source = 0;
+    if (!app_widgets->closing) {
+        show_file_matches(app_widgets);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+// Coalesce list refreshes while batches stream in
+static void schedule_view_refresh(AppWidgets *app_widgets) {
+    if (app_widgets->refresh_view_source == 0) {
+        app_widgets->refresh_view_source = g_timeout_add(100, on_refresh_view_timeout, app_widgets);
+    }
+}
+
+static gboolean on_scan_batch(gpointer data) {
+    std::unique_ptr<ScanEvent> event(static_cast<ScanEvent *>(data));
+    AppWidgets *app_widgets = event->app_widgets;
+    std::shared_ptr<ScanControl> &current = event->video_side ? app_widgets->video_scan : app_widgets->srt_scan;
+    // Drop batches from a scan that was cancelled or superseded after they were posted
+    if (app_widgets->closing || event->control != current || event->control->cancelled) {
+        return G_SOURCE_REMOVE;
+    }
+
+    FileCatalog &files = event->video_side ? app_widgets->video_files : app_widgets->subtitle_files;
+    append_catalog(files, event->batch.files);
+    (event->video_side ? app_widgets->video_snapshot : app_widgets->subtitle_snapshot).reset();
+    FolderSnapshot &source = event->video_side ? app_widgets->video_source : app_widgets->subtitle_source;
+    source.directories.insert(source.directories.end(), event->batch.directories.begin(),
+                              event->batch.directories.end());
+    for (const auto &error : event->batch.errors) {
+        log_error("Cannot read " + error.path + ": " + error.message);
+    }
+
+    if (event->batch.finished) {
+        log_message(std::string(event->video_side ? "Video" : "Subtitle") + " scan found " +
+                    std::to_string(files.size()) + " files.");
+        source.folder = event->folder;
+        source.options_hash = event->options_hash;
+        current.reset();
+    }
+    schedule_view_refresh(app_widgets);
+    return G_SOURCE_REMOVE;
+}
+
+static void cancel_scan(std::shared_ptr<ScanControl> &scan) {
+    if (scan) {
+        scan->cancelled = true;
+        scan.reset();
+    }
+}
+
+// Start streaming one folder into its file list on a background thread
+static void start_scan(AppWidgets *app_widgets, const std::string &folder, bool video_side) {
+    std::shared_ptr<ScanControl> &scan = video_side ? app_widgets->video_scan : app_widgets->srt_scan;
+    cancel_scan(scan);
+    (video_side ? app_widgets->video_files : app_widgets->subtitle_files) = FileCatalog();
+    (video_side ? app_widgets->video_snapshot : app_widgets->subtitle_snapshot).reset();
+    (video_side ? app_widgets->video_source : app_widgets->subtitle_source) = FolderSnapshot();
+    scan = std::make_shared<ScanControl>();
+
+    // Detached: a listing stuck on a dead network mount must not block closing the window
+    std::shared_ptr<ScanControl> control = scan;
+    ScanOptions options = make_scan_options(app_widgets->settings, video_side);
+    const uint64_t options_hash = scan_options_hash(options);
+
+    std::thread([app_widgets, control, folder, video_side, options, options_hash]() {
+        trace_set_thread_name(video_side ? "scan videos" : "scan subtitles");
+        scan_directory(folder, options, *control, [&](ScanBatch batch) {
+            g_idle_add(on_scan_batch,
+                       new ScanEvent{app_widgets, control, video_side, folder, options_hash, std::move(batch)});
+        });
+    }).detach();
+}
+
+// A restored folder after its changed directories were listed again
+struct RevalidateEvent {
+    AppWidgets *app_widgets;
+    std::shared_ptr<ScanControl> control;
+    bool video_side;
+    FolderSnapshot folder;
+    size_t changed_directories;
+    std::vector<ScanError> errors;
+};
+
+static gboolean on_revalidate_done(gpointer data) {
+    std::unique_ptr<RevalidateEvent> event(static_cast<RevalidateEvent *>(data));
+    AppWidgets *app_widgets = event->app_widgets;
+    std::shared_ptr<ScanControl> &current = event->video_side ? app_widgets->video_scan : app_widgets->srt_scan;
+    if (app_widgets->closing || event->control != current || event->control->cancelled) {
+        return G_SOURCE_REMOVE;
+    }
+    current.reset();
+    for (const auto &error : event->errors) {
+        log_error("Cannot read " + error.path + ": " + error.message);
+    }
+    if (event->changed_directories == 0) {
+        return G_SOURCE_REMOVE;
+    }
+
+    log_message(std::string(event->video_side ? "Video" : "Subtitle") + " folder changed in " +
+                std::to_string(event->changed_directories) + " directories since the last run, now " +
+                std::to_string(event->folder.files.size()) + " files.");
+    (event->video_side ? app_widgets->video_files : app_widgets->subtitle_files) = event->folder.files;
+    (event->video_side ? app_widgets->video_snapshot : app_widgets->subtitle_snapshot).reset();
+    (event->video_side ? app_widgets->video_source : app_widgets->subtitle_source) = std::move(event->folder);
+    schedule_view_refresh(app_widgets);
+    return G_SOURCE_REMOVE;
+}
+
+// Check a restored folder against the disk in the background; it takes the scan slot so a refresh or
+// folder change supersedes it like any other scan
+static void start_revalidation(AppWidgets *app_widgets, FolderSnapshot folder, bool video_side) {
+    std::shared_ptr<ScanControl> &scan = video_side ? app_widgets->video_scan : app_widgets->srt_scan;
+    cancel_scan(scan);
+    scan = std::make_shared<ScanControl>();
+
+    std::shared_ptr<ScanControl> control = scan;
+    ScanOptions options = make_scan_options(app_widgets->settings, video_side);
+
+    std::thread([app_widgets, control, video_side, options, folder]() mutable {
+        trace_set_thread_name(video_side ? "revalidate videos" : "revalidate subtitles");
+        TRACE_SCOPE("revalidate");
+        std::vector<ScanError> errors;
+        const size_t changed = revalidate_folder(folder, options, *control, errors);
+        g_idle_add(on_revalidate_done, new RevalidateEvent{app_widgets, control, video_side, std::move(folder), changed,
+                                                           std::move(errors)});
+    }).detach();
+}
+
+// Fill both lists from the last run's snapshot without touching the folders, then revalidate them.
+// A folder that moved or was scanned with other options is scanned from scratch instead.
+void restore_scan_snapshot(AppWidgets *app_widgets) {
+    const auto start = std::chrono::steady_clock::now();
+    ScanSnapshot snapshot;
+    const bool loaded = load_scan_snapshot(scan_snapshot_path(app_widgets->config_file), snapshot);
+    const std::string video_folder = gtk_entry_get_text(GTK_ENTRY(app_widgets->video_folder_entry));
+    const std::string srt_folder = gtk_entry_get_text(GTK_ENTRY(app_widgets->srt_folder_entry));
+    const bool videos_valid = loaded && !video_folder.empty() && snapshot.videos.folder == video_folder &&
+                              snapshot.videos.options_hash ==
+                                  scan_options_hash(make_scan_options(app_widgets->settings, true));
+    const bool subtitles_valid = loaded && !srt_folder.empty() && snapshot.subtitles.folder == srt_folder &&
+                                 snapshot.subtitles.options_hash ==
+                                     scan_options_hash(make_scan_options(app_widgets->settings, false));
+
+    if (videos_valid) {
+        app_widgets->video_files = snapshot.videos.files;
+        app_widgets->video_source = snapshot.videos;
+    }
+    if (subtitles_valid) {
+        app_widgets->subtitle_files = snapshot.subtitles.files;
+        app_widgets->subtitle_source = snapshot.subtitles;
+    }
+
+    // Stored keys and pairs are only good for the patterns they were extracted with
+    const SyncRequest request = read_sync_request_from_widgets(app_widgets);
+    if (videos_valid && subtitles_valid && snapshot.video_regex == request.video_regex &&
+        snapshot.subtitle_regex == request.subtitle_regex &&
+        snapshot.video_match_index == request.video_match_index &&
+        snapshot.subtitle_match_index == request.subtitle_match_index &&
+        snapshot.reference_regex == request.reference_regex &&
+        snapshot.match_full_path == request.match_full_path &&
+        snapshot.video_keys.size() == app_widgets->video_files.size() &&
+        snapshot.subtitle_keys.size() == app_widgets->subtitle_files.size() &&
+        snapshot.match.video_references.size() == app_widgets->video_files.size() &&
+        snapshot.match.subtitle_references.size() == app_widgets->subtitle_files.size()) {
+        update_file_list_view(app_widgets->video_file_list,
+                              build_file_rows(shared_files(app_widgets, true), snapshot.video_keys,
+                                              snapshot.match.video_partners, shared_files(app_widgets, false),
+                                              snapshot.match.video_references, shared_files(app_widgets, false)));
+        update_file_list_view(app_widgets->srt_file_list,
+                              build_file_rows(shared_files(app_widgets, false), snapshot.subtitle_keys,
+                                              snapshot.match.subtitle_partners, shared_files(app_widgets, true),
+                                              snapshot.match.subtitle_references, shared_files(app_widgets, false)));
+    } else if (videos_valid || subtitles_valid) {
+        show_file_matches(app_widgets);
+    }
+    if (videos_valid || subtitles_valid) {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        log_message("Restored " + std::to_string(app_widgets->video_files.size()) + " video and " +
+                    std::to_string(app_widgets->subtitle_files.size()) + " subtitle files from the last scan in " +
+                    std::to_string(elapsed.count()) + " ms.");
+    }
+
+    if (videos_valid) {
+        start_revalidation(app_widgets, std::move(snapshot.videos), true);
+    } else if (!video_folder.empty()) {
+        start_scan(app_widgets, video_folder, true);
+    }
+    if (subtitles_valid) {
+        start_revalidation(app_widgets, std::move(snapshot.subtitles), false);
+    } else if (!srt_folder.empty()) {
+        start_scan(app_widgets, srt_folder, false);
+    }
+}
+
+// Save the lists as the next start's snapshot. Keys and pairs are extracted here once more so they
+// match the patterns in the widgets, whatever the last preview showed.
+void store_scan_state(AppWidgets *app_widgets) {
+    ScanSnapshot snapshot;
+    snapshot.videos = app_widgets->video_source;
+    snapshot.subtitles = app_widgets->subtitle_source;
+    if (snapshot.videos.folder.empty() && snapshot.subtitles.folder.empty()) {
+        return;
+    }
+    const SyncRequest request = read_sync_request_from_widgets(app_widgets);
+    snapshot.video_regex = request.video_regex;
+    snapshot.subtitle_regex = request.subtitle_regex;
+    snapshot.video_match_index = request.video_match_index;
+    snapshot.subtitle_match_index = request.subtitle_match_index;
+    snapshot.reference_regex = request.reference_regex;
+    snapshot.match_full_path = request.match_full_path;
+    snapshot.videos.files = app_widgets->video_files;
+    snapshot.subtitles.files = app_widgets->subtitle_files;
+    if (!snapshot.videos.folder.empty() && !snapshot.subtitles.folder.empty() &&
+        compile_episode_pattern(request.video_regex) && compile_episode_pattern(request.subtitle_regex)) {
+        MatchedLibrary library = match_library(request, app_widgets->video_files, app_widgets->subtitle_files);
+        snapshot.video_keys = std::move(library.video_keys);
+        snapshot.subtitle_keys = std::move(library.subtitle_keys);
+        snapshot.match = std::move(library.match);
+    }
+    if (!store_scan_snapshot(scan_snapshot_path(app_widgets->config_file), snapshot)) {
+        log_error("Cannot write the scan snapshot next to " + app_widgets->config_file);
+    }
+}
+
 void on_refresh_button_clicked(GtkWidget *widget, gpointer data) {
     AppWidgets *app_widgets = static_cast<AppWidgets *>(data);
     // Get the directories and update the file lists
     const std::string video_folder = gtk_entry_get_text(GTK_ENTRY(app_widgets->video_folder_entry));
     const std::string srt_folder = gtk_entry_get_text(GTK_ENTRY(app_widgets->srt_folder_entry));
-    
-    // Fetch files from directories
-    app_widgets->video_files = get_files_in_directory(video_folder);
-    app_widgets->subtitle_files = get_files_in_directory(srt_folder);
 
-    // Show matches of episode numbers from both directories
+    // Scan both directories in the background; the lists fill in as batches arrive
+    start_scan(app_widgets, video_folder, true);
+    start_scan(app_widgets, srt_folder, false);
     show_file_matches(app_widgets);
 }
+
+void on_video_folder_entry_changed(GtkWidget *widget, gpointer data) {
+    AppWidgets *app_widgets = static_cast<AppWidgets *>(data);
+    cancel_scan(app_widgets->video_scan);
+}
+
+void on_srt_folder_entry_changed(GtkWidget *widget, gpointer data) {
+    AppWidgets *app_widgets = static_cast<AppWidgets *>(data);
+    cancel_scan(app_widgets->srt_scan);
+}
+
+// Progress event posted from a worker thread to the GTK main loop
+struct BatchEvent {
+    AppWidgets *app_widgets;
+    bool finished_job;
+    std::string file;
+    double fraction = -1.0;  // progress alass reported for file, negative when it just started
+};
+
+// Final report posted once the batch thread is done
+struct BatchDone {
+    AppWidgets *app_widgets;
+    BatchReport report;
+};
+
+static std::string format_duration(double seconds) {
+    long total = static_cast<long>(seconds + 0.5);
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%ld:%02ld:%02ld", total / 3600, (total / 60) % 60, total % 60);
+    return buffer;
+}
+
+// CPU time and peak memory of an alass child, for the job's log line
+static std::string format_usage(const JobResult &result) {
+    if (result.max_rss_kb == 0) {
+        return "";
+    }
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), ", %.1fs CPU, %ld MB", result.cpu_seconds, result.max_rss_kb / 1024);
+    return buffer;
+}
+
+// The last non-empty line alass printed, usually the reason it failed
+static std::string last_output_line(const std::string &output) {
+    size_t end = output.find_last_not_of("\r\n");
+    if (end == std::string::npos) {
+        return "";
+    }
+    size_t begin = output.find_last_of("\r\n", end);
+    return output.substr(begin == std::string::npos ? 0 : begin + 1, end - (begin == std::string::npos ? 0 : begin + 1) + 1);
+}
+
+static gboolean on_batch_event(gpointer data) {
+    std::unique_ptr<BatchEvent> event(static_cast<BatchEvent *>(data));
+    AppWidgets *app_widgets = event->app_widgets;
+    if (app_widgets->closing) {
+        return G_SOURCE_REMOVE;
+    }
+
+    if (event->finished_job) {
+        ++app_widgets->batch_finished;
+    } else if (event->fraction >= 0.0) {
+        const std::string text = "Syncing: " + event->file + " (" + std::to_string(int(event->fraction * 100)) + "%)";
+        gtk_label_set_text(GTK_LABEL(app_widgets->current_file_label), text.c_str());
+        return G_SOURCE_REMOVE;
+    } else {
+        gtk_label_set_text(GTK_LABEL(app_widgets->current_file_label), ("Syncing: " + event->file).c_str());
+    }
+
+    const size_t finished = app_widgets->batch_finished;
+    const size_t total = app_widgets->batch_total;
+    std::string text = std::to_string(finished) + " / " + std::to_string(total);
+    if (finished > 0 && finished < total) {
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - app_widgets->batch_start).count();
+        text += "  ETA " + format_duration(elapsed / finished * (total - finished));
+    }
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(app_widgets->progress_bar), total ? double(finished) / total : 0.0);
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(app_widgets->progress_bar), text.c_str());
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean on_batch_done(gpointer data) {
+    std::unique_ptr<BatchDone> done(static_cast<BatchDone *>(data));
+    AppWidgets *app_widgets = done->app_widgets;
+    const BatchReport &report = done->report;
+    if (app_widgets->closing) {
+        return G_SOURCE_REMOVE;
+    }
+
+    if (app_widgets->batch_thread.joinable()) {
+        app_widgets->batch_thread.join();
+    }
+    app_widgets->batch_control.reset();
+
+    gtk_widget_set_sensitive(app_widgets->sync_button, TRUE);
+    gtk_widget_set_sensitive(app_widgets->cancel_button, FALSE);
+    gtk_label_set_text(GTK_LABEL(app_widgets->current_file_label), "");
+
+    std::string summary = std::to_string(report.succeeded) + " succeeded (" + std::to_string(report.cached) +
+                          " cached), " + std::to_string(report.failed) + " failed, " +
+                          std::to_string(report.cancelled) + " cancelled in " +
+                          format_duration(report.wall_seconds);
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(app_widgets->progress_bar), summary.c_str());
+    if (report.unswept > 0) {
+        log_message(std::to_string(report.unswept) + " episodes went to alass, which can't sweep; they were synced "
+                    "with the single split penalty.");
+    }
+    log_message(summary + " on " + std::to_string(report.worker_count) + " workers.");
+
+    // Tracing ran for this batch only, so the stage table describes just this batch
+    trace_enable(false);
+    const std::vector<TraceEvent> events = trace_collect(true);
+    update_stage_table_view(app_widgets->stage_table, summarize_trace(events));
+    if (!app_widgets->settings.trace_file.empty()) {
+        std::string error;
+        if (write_chrome_trace(app_widgets->settings.trace_file, events, error)) {
+            log_message("Wrote trace to " + app_widgets->settings.trace_file);
+        } else {
+            log_error(error);
+        }
+    }
+    log_message("Subtitle synchronization completed.");
+    return G_SOURCE_REMOVE;
+}
+
 void on_sync_button_clicked(GtkWidget *widget, gpointer data) {
     AppWidgets *app_widgets = static_cast<AppWidgets *>(data);
+    if (app_widgets->batch_control) {
+        log_error("A synchronization batch is already running.");
+        return;
+    }
 
     log_message("Starting subtitle synchronization...");
-    std::string video_regex = gtk_entry_get_text(GTK_ENTRY(app_widgets->video_regex_entry));
-    std::string subtitle_regex = gtk_entry_get_text(GTK_ENTRY(app_widgets->subtitle_regex_entry));
+    SyncRequest request = read_sync_request_from_widgets(app_widgets);
 
-    if (!is_valid_regex(video_regex) || !is_valid_regex(subtitle_regex)) {
+    if (!is_valid_regex(request.video_regex) || !is_valid_regex(request.subtitle_regex)) {
         log_error("One or both regex patterns are invalid. Please correct them.");
         return;
     }
+    if (!request.reference_regex.empty() && !is_valid_regex(request.reference_regex)) {
+        log_error("The trusted reference regex is invalid. Please correct it or clear it.");
+        return;
+    }
 
-    // Extract episode numbers for videos and subtitles
-    std::vector<std::string> video_matches = extract_episode_numbers(app_widgets->video_files, video_regex);
-    std::vector<std::string> subtitle_matches = extract_episode_numbers(app_widgets->subtitle_files, subtitle_regex);
+    // Extract normalized episode keys for videos and subtitles and pair them
+    MatchedLibrary library = match_library(request, app_widgets->video_files, app_widgets->subtitle_files);
 
-    if (video_matches.empty()) {
+    if (library.video_matches == 0) {
         log_error("No video matches found. Check the video regex pattern.");
         return;
     }
-    if (subtitle_matches.empty()) {
+    if (library.subtitle_matches == 0) {
         log_error("No subtitle matches found. Check the subtitle regex pattern.");
         return;
     }
 
-    log_message("Found " + std::to_string(video_matches.size()) + " video matches.");
-    log_message("Found " + std::to_string(subtitle_matches.size()) + " subtitle matches.");
+    log_message("Found " + std::to_string(library.video_matches) + " video matches.");
+    log_message("Found " + std::to_string(library.subtitle_matches) + " subtitle matches.");
+    for (const auto &conflict : library.match.conflicts) {
+        log_error("Episode " + format_episode_key(conflict.key) + " matches " + std::to_string(conflict.videos) +
+                  " videos and " + std::to_string(conflict.subtitles) + " subtitles; it is skipped.");
+    }
+    if (library.match.reference_pairs > 0) {
+        log_message(std::to_string(library.match.reference_pairs) + " of " + std::to_string(library.match.pairs) +
+                    " pairs align against a trusted subtitle instead of the video.");
+    }
 
-    // Match and sync
-    for (size_t i = 0; i < video_matches.size(); ++i) {
-        for (size_t j = 0; j < subtitle_matches.size(); ++j) {
-            if (video_matches[i] == subtitle_matches[j]) {
-                std::string video_file = app_widgets->video_files[i];
-                std::string subtitle_file = app_widgets->subtitle_files[j];
-                std::string output_file = "synced_" + video_matches[i] + ".mkv";
+    std::vector<SyncJob> jobs =
+        build_sync_jobs(request, app_widgets->video_files, app_widgets->subtitle_files, library);
+    if (jobs.empty()) {
+        log_error("No video and subtitle episodes matched.");
+        return;
+    }
 
-                std::string command = "alass \"" + video_file + "\" \"" + subtitle_file + "\" \"" + output_file + "\"";
-                log_message("Executing: " + command);
+    start_sync_batch(app_widgets, std::move(jobs), make_batch_settings(request));
+}
 
-                int result = system(command.c_str());
-                if (result != 0) {
-                    log_error("Failed to sync subtitles for " + video_file);
-                } else {
-                    log_message("Successfully synced subtitles for " + video_file);
-                }
+// Run jobs on the batch thread with progress in the window. Each job is journaled next to the config so a
+// batch cut short can be resumed on the next start.
+static void start_sync_batch(AppWidgets *app_widgets, std::vector<SyncJob> jobs, BatchSettings settings) {
+    if (app_widgets->sync_cache.path.empty()) {
+        load_sync_cache(app_widgets->sync_cache, sync_cache_path(app_widgets->config_file));
+    }
+    settings.cache = &app_widgets->sync_cache;
+    settings.span_cache_dir = span_cache_dir(app_widgets->config_file);
+    auto journal = std::make_shared<BatchJournal>();
+    if (open_batch_journal(*journal, batch_journal_path(app_widgets->config_file), jobs, settings.alignment)) {
+        settings.journal = journal.get();
+    } else {
+        log_error("Cannot write the batch journal, this batch can't be resumed if it is interrupted.");
+    }
+    log_message("Running " + std::to_string(jobs.size()) + " jobs on " + std::to_string(settings.worker_count) +
+                " workers.");
+
+    // Spans are coarse (per scan, match and job), cheap enough to always collect while a batch runs.
+    // Anything left from before, e.g. a preview that finished after the last batch, is dropped.
+    trace_collect(true);
+    trace_enable(true);
+    trace_set_thread_name("main");
+
+    app_widgets->batch_control = std::make_shared<BatchControl>();
+    app_widgets->batch_start = std::chrono::steady_clock::now();
+    app_widgets->batch_total = jobs.size();
+    app_widgets->batch_finished = 0;
+    gtk_widget_set_sensitive(app_widgets->sync_button, FALSE);
+    gtk_widget_set_sensitive(app_widgets->cancel_button, TRUE);
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(app_widgets->progress_bar), 0.0);
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(app_widgets->progress_bar), ("0 / " + std::to_string(jobs.size())).c_str());
+
+    // The batch runs off the GTK thread; every UI update goes back through g_idle_add
+    std::shared_ptr<BatchControl> control = app_widgets->batch_control;
+    app_widgets->batch_thread = std::thread([app_widgets, control, jobs, settings, journal]() {
+        trace_set_thread_name("batch");
+        BatchCallbacks callbacks;
+        callbacks.on_started = [app_widgets](const SyncJob &job, size_t) {
+            g_idle_add(on_batch_event, new BatchEvent{app_widgets, false, job.video_file});
+        };
+        callbacks.on_progress = [app_widgets](const SyncJob &job, size_t, double fraction) {
+            g_idle_add(on_batch_event, new BatchEvent{app_widgets, false, job.video_file, fraction});
+        };
+        // The penalty a sweep picked is logged so outlier episodes stand out
+        const bool sweep = !settings.alignment.penalty_sweep.empty();
+        callbacks.on_finished = [app_widgets, sweep](const SyncJob &job, const JobResult &result) {
+            if (result.cached) {
+                log_message("Up to date, skipped " + job.video_file);
+            } else if (result.success && result.native && sweep) {
+                char penalty[32];
+                snprintf(penalty, sizeof(penalty), "%g", result.split_penalty);
+                log_message("Successfully synced subtitles for " + job.video_file + " (" +
+                            std::to_string(result.seconds) + "s, split penalty " + penalty + ")");
+            } else if (result.success && !job.reference_file.empty()) {
+                log_message("Successfully synced subtitles for " + job.video_file + " against " + job.reference_file +
+                            " (" + std::to_string(result.seconds) + "s" + format_usage(result) + ")");
+            } else if (result.success) {
+                log_message("Successfully synced subtitles for " + job.video_file + " (" +
+                            std::to_string(result.seconds) + "s" + format_usage(result) + ")");
+            } else if (result.cancelled) {
+                log_message("Cancelled sync for " + job.video_file);
+            } else if (result.native || !result.error.empty()) {
+                log_error("Failed to sync subtitles for " + job.video_file + ": " + result.error);
+            } else {
+                const std::string reason = last_output_line(result.output);
+                log_error("Failed to sync subtitles for " + job.video_file + " (exit code " +
+                          std::to_string(result.exit_code) + ")" + (reason.empty() ? "" : ": " + reason));
             }
+            g_idle_add(on_batch_event, new BatchEvent{app_widgets, true, job.video_file});
+        };
+
+        BatchReport report = run_sync_jobs(jobs, settings, control.get(), callbacks);
+        // Kept while jobs are left, so closing the window mid-batch can be resumed too
+        close_batch_journal(*journal, report.cancelled == 0);
+        if (!save_sync_cache(*settings.cache)) {
+            log_error("Could not write the sync cache to " + settings.cache->path);
         }
+        g_idle_add(on_batch_done, new BatchDone{app_widgets, report});
+    });
+}
+
+// Offered once the window is up: an earlier batch was interrupted with episodes left
+static gboolean offer_batch_resume(gpointer data) {
+    AppWidgets *app_widgets = static_cast<AppWidgets *>(data);
+    const std::string path = batch_journal_path(app_widgets->config_file);
+    JournalResume resume;
+    if (app_widgets->closing || app_widgets->batch_control) {
+        return G_SOURCE_REMOVE;
+    }
+    if (!load_batch_journal(path, resume)) {
+        discard_batch_journal(path);
+        return G_SOURCE_REMOVE;
     }
 
-    log_message("Subtitle synchronization completed.");
+    GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(app_widgets->window), GTK_DIALOG_MODAL,
+        GTK_MESSAGE_QUESTION, GTK_BUTTONS_YES_NO,
+        "The last sync was interrupted after %zu of %zu episodes. Resume the remaining %zu?",
+        resume.finished, resume.total, resume.jobs.size());
+    const gint response = gtk_dialog_run(GTK_DIALOG(dialog));
+    gtk_widget_destroy(dialog);
+    if (response != GTK_RESPONSE_YES) {
+        discard_batch_journal(path);
+        return G_SOURCE_REMOVE;
+    }
+
+    log_message("Resuming " + std::to_string(resume.jobs.size()) + " unfinished jobs of the interrupted batch.");
+    // The remaining jobs run with the options the batch was started with
+    BatchSettings settings = make_batch_settings(read_sync_request_from_widgets(app_widgets));
+    settings.alignment = resume.alignment;
+    start_sync_batch(app_widgets, std::move(resume.jobs), settings);
+    return G_SOURCE_REMOVE;
 }
 
-void on_episode_regex_value_changed(GtkWidget *widget, gpointer data) {
+void schedule_batch_resume(AppWidgets *app_widgets) {
+    g_idle_add(offer_batch_resume, app_widgets);
+}
+
+void on_cancel_button_clicked(GtkWidget *widget, gpointer data) {
     AppWidgets *app_widgets = static_cast<AppWidgets *>(data);
+    if (app_widgets->batch_control) {
+        log_message("Cancelling subtitle synchronization...");
+        cancel_batch(*app_widgets->batch_control);
+        gtk_widget_set_sensitive(app_widgets->cancel_button, FALSE);
+    }
+}
 
-    // Get the regex from the input and escape backslashes
-    std::string video_regex = gtk_entry_get_text(GTK_ENTRY(app_widgets->video_regex_entry));
-    video_regex = escape_backslashes(video_regex);  // Escape backslashes
+void on_window_destroy(GtkWidget *widget, gpointer data) {
+    AppWidgets *app_widgets = static_cast<AppWidgets *>(data);
+    // Don't leave alass children or a thread pointing at freed widgets behind
+    app_widgets->closing = true;
+    save_values(app_widgets);
+    // A scan still in flight leaves its source empty, so only finished lists are saved
+    store_scan_state(app_widgets);
+    cancel_scan(app_widgets->video_scan);
+    cancel_scan(app_widgets->srt_scan);
+    if (app_widgets->batch_control) {
+        cancel_batch(*app_widgets->batch_control);
+    }
+    if (app_widgets->batch_thread.joinable()) {
+        app_widgets->batch_thread.join();
+    }
+    if (app_widgets->preview_source != 0) {
+        g_source_remove(app_widgets->preview_source);
+    }
+    stop_match_preview(app_widgets->match_preview);
+    gtk_main_quit();
+}
 
-    // Validate the regex before proceeding
-    if (is_valid_regex(video_regex)) {
-        // Refresh file matches if the regex is valid
+static gboolean on_preview_timeout(gpointer data) {
+    AppWidgets *app_widgets = static_cast<AppWidgets *>(data);
+    app_widgets->preview_source = 0;
+    if (!app_widgets->closing) {
         show_file_matches(app_widgets);
-    } else {
+    }
+    return G_SOURCE_REMOVE;
+}
+
+// Wait for a pause in typing; every edit restarts the delay
+void on_episode_regex_value_changed(GtkWidget *widget, gpointer data) {
+    AppWidgets *app_widgets = static_cast<AppWidgets *>(data);
+    if (app_widgets->preview_source != 0) {
+        g_source_remove(app_widgets->preview_source);
+    }
+    app_widgets->preview_source = g_timeout_add(150, on_preview_timeout, app_widgets);
+}
+
+// alass takes a single split penalty, so the sweep is only offered with the built-in aligner
+void on_native_aligner_toggled(GtkWidget *widget, gpointer data) {
+    AppWidgets *app_widgets = static_cast<AppWidgets *>(data);
+    const bool native = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget));
+    gtk_widget_set_sensitive(app_widgets->sweep_penalty_checkbox, native);
+    gtk_widget_set_tooltip_text(app_widgets->sweep_penalty_checkbox,
+                                native ? nullptr : "Needs the built-in aligner; alass runs with the one penalty above");
+}
+
+// Rows of the newest preview, posted from the preview thread
+struct PreviewEvent {
+    AppWidgets *app_widgets;
+    MatchPreviewResult result;
+};
+
+static gboolean on_preview_result(gpointer data) {
+    std::unique_ptr<PreviewEvent> event(static_cast<PreviewEvent *>(data));
+    AppWidgets *app_widgets = event->app_widgets;
+    // A newer edit was made after this result was posted
+    if (app_widgets->closing || !match_preview_current(app_widgets->match_preview, event->result.generation)) {
+        return G_SOURCE_REMOVE;
+    }
+    if (!event->result.valid_patterns) {
         log_error("Invalid regex. Please fix the pattern.");
+        return G_SOURCE_REMOVE;
     }
+
+    // Only the rows whose file, key or partner changed are touched
+    TRACE_SCOPE("list_update");
+    update_file_list_view(app_widgets->video_file_list, std::move(event->result.video_rows));
+    update_file_list_view(app_widgets->srt_file_list, std::move(event->result.subtitle_rows));
+    return G_SOURCE_REMOVE;
+}
+
+void start_live_preview(AppWidgets *app_widgets) {
+    start_match_preview(app_widgets->match_preview, [app_widgets](MatchPreviewResult result) {
+        g_idle_add(on_preview_result, new PreviewEvent{app_widgets, std::move(result)});
+    });
 }
 
 void on_show_video_dir_button_clicked(GtkWidget *widget, gpointer data) {
     AppWidgets *app_widgets = static_cast<AppWidgets *>(data);
     app_widgets->video_dir_visible = !app_widgets->video_dir_visible;
     if (app_widgets->video_dir_visible) {
-        gtk_widget_show(app_widgets->video_file_list_box);
+        gtk_widget_show(app_widgets->video_file_list.scrolled_window);
     } else {
-        gtk_widget_hide(app_widgets->video_file_list_box);
+        gtk_widget_hide(app_widgets->video_file_list.scrolled_window);
     }
 }
 
@@ -342,61 +996,50 @@ void on_show_srt_dir_button_clicked(GtkWidget *widget, gpointer data) {
     AppWidgets *app_widgets = static_cast<AppWidgets *>(data);
     app_widgets->srt_dir_visible = !app_widgets->srt_dir_visible;
     if (app_widgets->srt_dir_visible) {
-        gtk_widget_show(app_widgets->srt_file_list_box);
+        gtk_widget_show(app_widgets->srt_file_list.scrolled_window);
     } else {
-        gtk_widget_hide(app_widgets->srt_file_list_box);
+        gtk_widget_hide(app_widgets->srt_file_list.scrolled_window);
     }
 }
 
+// Extract and pair episode keys of the scanned files on the preview thread; the lists update when it's done
 void show_file_matches(AppWidgets *app_widgets) {
-    // Clear previous list
-    GtkWidget *video_file_list_box = app_widgets->video_file_list_box;
-    GList *children = gtk_container_get_children(GTK_CONTAINER(video_file_list_box));
-    for (GList *iter = children; iter != NULL; iter = iter->next) {
-        gtk_widget_destroy(GTK_WIDGET(iter->data));
-    }
-    g_list_free(children);
-
-    GtkWidget *srt_file_list_box = app_widgets->srt_file_list_box;
-    children = gtk_container_get_children(GTK_CONTAINER(srt_file_list_box));
-    for (GList *iter = children; iter != NULL; iter = iter->next) {
-        gtk_widget_destroy(GTK_WIDGET(iter->data));
-    }
-    g_list_free(children);
-
-    // Show file entries from both video and subtitle directories
-    for (const auto &file : app_widgets->video_files) {
-        GtkWidget *label = gtk_label_new(file.c_str());
-        gtk_box_pack_start(GTK_BOX(video_file_list_box), label, FALSE, FALSE, 0);
-    }
-
-    for (const auto &file : app_widgets->subtitle_files) {
-        GtkWidget *label = gtk_label_new(file.c_str());
-        gtk_box_pack_start(GTK_BOX(srt_file_list_box), label, FALSE, FALSE, 0);
-    }
-
-    // Show episode number matches for video and subtitle files
-    const std::string video_episode_regex = gtk_entry_get_text(GTK_ENTRY(app_widgets->video_regex_entry));
-    const std::string subtitle_episode_regex = gtk_entry_get_text(GTK_ENTRY(app_widgets->subtitle_regex_entry));
-
-    // Extract episode numbers using regex for video and subtitle files
-    std::vector<std::string> video_matches = extract_episode_numbers(app_widgets->video_files, video_episode_regex);
-    std::vector<std::string> subtitle_matches = extract_episode_numbers(app_widgets->subtitle_files, subtitle_episode_regex);
-  
-    // Display matches for video files
-    for (const auto &match : video_matches) {
-        GtkWidget *label = gtk_label_new(("Video Match: " + match).c_str());
-        gtk_box_pack_start(GTK_BOX(video_file_list_box), label, FALSE, FALSE, 0);
-    }
+    request_match_preview(app_widgets->match_preview, read_sync_request_from_widgets(app_widgets),
+                          shared_files(app_widgets, true), shared_files(app_widgets, false));
+}
 
-    // Display matches for subtitle files
-    for (const auto &match : subtitle_matches) {
-        GtkWidget *label = gtk_label_new(("Subtitle Match: " + match).c_str());
-        gtk_box_pack_start(GTK_BOX(srt_file_list_box), label, FALSE, FALSE, 0);
+// The immutable copy of one side's catalog, made on first use after it changed
+std::shared_ptr<const FileCatalog> shared_files(AppWidgets *app_widgets, bool video_side) {
+    std::shared_ptr<const FileCatalog> &snapshot =
+        video_side ? app_widgets->video_snapshot : app_widgets->subtitle_snapshot;
+    if (!snapshot) {
+        snapshot =
+            std::make_shared<const FileCatalog>(video_side ? app_widgets->video_files : app_widgets->subtitle_files);
     }
+    return snapshot;
+}
 
-    gtk_widget_show_all(video_file_list_box);
-    gtk_widget_show_all(srt_file_list_box);
+// The GTK-free view of the current widget values
+SyncRequest read_sync_request_from_widgets(AppWidgets *app_widgets) {
+    SyncRequest request;
+    request.video_folder = gtk_entry_get_text(GTK_ENTRY(app_widgets->video_folder_entry));
+    request.srt_folder = gtk_entry_get_text(GTK_ENTRY(app_widgets->srt_folder_entry));
+    request.video_regex = gtk_entry_get_text(GTK_ENTRY(app_widgets->video_regex_entry));
+    request.subtitle_regex = gtk_entry_get_text(GTK_ENTRY(app_widgets->subtitle_regex_entry));
+    request.reference_regex = gtk_entry_get_text(GTK_ENTRY(app_widgets->reference_regex_entry));
+    request.match_full_path = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(app_widgets->match_full_path_checkbox));
+    request.video_match_index = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(app_widgets->video_match_index_input));
+    request.subtitle_match_index =
+        gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(app_widgets->subtitle_match_index_input));
+    request.alignment.split_penalty = gtk_range_get_value(GTK_RANGE(app_widgets->split_penalty_slider));
+    request.alignment.disable_fps_guessing =
+        gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(app_widgets->disable_fps_guessing_checkbox));
+    request.alignment.engine =
+        gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(app_widgets->native_aligner_checkbox)) ? ENGINE_NATIVE : ENGINE_ALASS;
+    request.settings = app_widgets->settings;
+    request.sweep_split_penalty = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(app_widgets->sweep_penalty_checkbox));
+    request.alignment.penalty_sweep = sweep_penalties(request);
+    return request;
 }
 
 void save_values(AppWidgets *app_widgets) {
@@ -405,14 +1048,19 @@ void save_values(AppWidgets *app_widgets) {
         {"srt_folder", gtk_entry_get_text(GTK_ENTRY(app_widgets->srt_folder_entry))},
         {"video_regex", gtk_entry_get_text(GTK_ENTRY(app_widgets->video_regex_entry))},
         {"subtitle_regex", gtk_entry_get_text(GTK_ENTRY(app_widgets->subtitle_regex_entry))},
+        {"reference_regex", gtk_entry_get_text(GTK_ENTRY(app_widgets->reference_regex_entry))},
+        {"match_full_path", gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(app_widgets->match_full_path_checkbox))},
         {"video_match_index", gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(app_widgets->video_match_index_input))},
         {"subtitle_match_index", gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(app_widgets->subtitle_match_index_input))},
         {"output_name", gtk_entry_get_text(GTK_ENTRY(app_widgets->output_name_entry))},
         {"disable_fps_guessing", gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(app_widgets->disable_fps_guessing_checkbox))},
+        {"alignment_engine", gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(app_widgets->native_aligner_checkbox)) ? "native" : "alass"},
         {"ui_scale", gtk_range_get_value(GTK_RANGE(app_widgets->ui_scale_slider))},
         {"scrollbar_enabled", gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(app_widgets->scrollbar_checkbox))},
-        {"split_penalty", gtk_range_get_value(GTK_RANGE(app_widgets->split_penalty_slider))}
+        {"split_penalty", gtk_range_get_value(GTK_RANGE(app_widgets->split_penalty_slider))},
+        {"sweep_split_penalty", gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(app_widgets->sweep_penalty_checkbox))}
     };
+    write_sync_settings(app_widgets->settings, config);
 
     std::ofstream config_file(app_widgets->config_file);
     config_file << config.dump(4);
@@ -454,6 +1102,12 @@ void load_saved_values(AppWidgets *app_widgets) {
         } else {
             log_error("Missing or invalid 'subtitle_regex' in config.");
         }
+        if (config.contains("reference_regex") && config["reference_regex"].is_string()) {
+            gtk_entry_set_text(GTK_ENTRY(app_widgets->reference_regex_entry), config["reference_regex"].get<std::string>().c_str());
+        }
+        if (config.contains("match_full_path") && config["match_full_path"].is_boolean()) {
+            gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(app_widgets->match_full_path_checkbox), config["match_full_path"].get<bool>());
+        }
 
         if (config.contains("video_match_index") && config["video_match_index"].is_number_integer()) {
             gtk_spin_button_set_value(GTK_SPIN_BUTTON(app_widgets->video_match_index_input), config["video_match_index"].get<int>());
@@ -472,6 +1126,9 @@ void load_saved_values(AppWidgets *app_widgets) {
         if (config.contains("disable_fps_guessing") && config["disable_fps_guessing"].is_boolean()) {
             gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(app_widgets->disable_fps_guessing_checkbox), config["disable_fps_guessing"].get<bool>());
         }
+        if (config.contains("alignment_engine") && config["alignment_engine"].is_string()) {
+            gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(app_widgets->native_aligner_checkbox), config["alignment_engine"] == "native");
+        }
         if (config.contains("ui_scale") && config["ui_scale"].is_number()) {
             gtk_range_set_value(GTK_RANGE(app_widgets->ui_scale_slider), config["ui_scale"].get<double>());
         }
@@ -481,6 +1138,10 @@ void load_saved_values(AppWidgets *app_widgets) {
         if (config.contains("split_penalty") && config["split_penalty"].is_number()) {
             gtk_range_set_value(GTK_RANGE(app_widgets->split_penalty_slider), config["split_penalty"].get<double>());
         }
+        if (config.contains("sweep_split_penalty") && config["sweep_split_penalty"].is_boolean()) {
+            gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(app_widgets->sweep_penalty_checkbox), config["sweep_split_penalty"].get<bool>());
+        }
+        read_sync_settings(config, app_widgets->settings);
     } else {
         log_error("Config file does not exist.");
     }
@@ -494,31 +1155,6 @@ void log_error(const std::string &message) {
     std::cerr << "[ERROR]: " << message << std::endl;
 }
 
-std::vector<std::string> get_files_in_directory(const std::string &directory) {
-    std::vector<std::string> files;
-    for (const auto &entry : fs::directory_iterator(directory)) {
-        if (entry.is_regular_file()) {
-            files.push_back(entry.path().filename().string());
-        }
-    }
-    return files;
-}
-
-std::vector<std::string> extract_episode_numbers(const std::vector<std::string> &files, const std::string &regex_str) {
-    std::vector<std::string> matches;
-    try {
-        std::regex re(regex_str);
-        for (const auto &file : files) {
-            std::smatch match;
-            if (std::regex_search(file, match, re)) {
-                matches.push_back(match.str());
-            }
-        }
-    } catch (const std::regex_error &) {
-        log_error("Invalid regex for episode extraction.");
-    }
-    return matches;
-}
 /*
 values are not saving and loading on start
 on sync click not having the new variables (video/.subtitlle search)
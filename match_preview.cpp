@@ -0,0 +1,137 @@
+#include "match_preview.h"
+
+#include "episode_pattern.h"
+#include "trace.h"
+
+namespace {
+    // The key column of one side from the last evaluation, with what it was extracted from
+    struct KeyColumn {
+        std::shared_ptr<const FileCatalog> files;
+        std::string regex;
+        int match_index = 0;
+        bool full_path = false;
+        std::vector<EpisodeKey> keys;
+    };
+
+    // The trusted flags of the subtitles from the last evaluation, with what they were found with
+    struct TrustedColumn {
+        std::shared_ptr<const FileCatalog> files;
+        std::string regex;
+        bool full_path = false;
+        std::vector<bool> trusted;
+    };
+}
+
+// Editing one side's pattern leaves the other side's keys as they were
+static const std::vector<EpisodeKey> &side_keys(KeyColumn &column, const SyncRequest &request,
+                                                const std::shared_ptr<const FileCatalog> &files, bool video_side) {
+    const std::string &regex = video_side ? request.video_regex : request.subtitle_regex;
+    const int match_index = video_side ? request.video_match_index : request.subtitle_match_index;
+    if (column.files != files || column.regex != regex || column.match_index != match_index ||
+        column.full_path != request.match_full_path) {
+        column.keys = extract_library_keys(request, *files, video_side);
+        column.files = files;
+        column.regex = regex;
+        column.match_index = match_index;
+        column.full_path = request.match_full_path;
+    }
+    return column.keys;
+}
+
+static const std::vector<bool> &trusted_subtitles(TrustedColumn &column, const SyncRequest &request,
+                                                  const std::shared_ptr<const FileCatalog> &files) {
+    if (column.files != files || column.regex != request.reference_regex ||
+        column.full_path != request.match_full_path) {
+        column.trusted = find_trusted_subtitles(request, *files);
+        column.files = files;
+        column.regex = request.reference_regex;
+        column.full_path = request.match_full_path;
+    }
+    return column.trusted;
+}
+
+static void run_preview(MatchPreview &preview) {
+    trace_set_thread_name("preview");
+    KeyColumn video_column;
+    KeyColumn subtitle_column;
+    TrustedColumn trusted_column;
+    for (;;) {
+        SyncRequest request;
+        std::shared_ptr<const FileCatalog> video_files;
+        std::shared_ptr<const FileCatalog> subtitle_files;
+        uint64_t generation = 0;
+        {
+            std::unique_lock<std::mutex> lock(preview.mutex);
+            preview.wake.wait(lock, [&preview]() { return preview.pending || preview.stopping; });
+            if (preview.stopping) {
+                return;
+            }
+            preview.pending = false;
+            generation = preview.generation;
+            request = std::move(preview.request);
+            video_files = std::move(preview.video_files);
+            subtitle_files = std::move(preview.subtitle_files);
+        }
+
+        TRACE_SCOPE("preview");
+        MatchPreviewResult result;
+        result.generation = generation;
+        result.valid_patterns =
+            compile_episode_pattern(request.video_regex) && compile_episode_pattern(request.subtitle_regex) &&
+            (request.reference_regex.empty() || compile_episode_pattern(request.reference_regex));
+        if (result.valid_patterns && match_preview_current(preview, generation)) {
+            const std::vector<EpisodeKey> &video_keys = side_keys(video_column, request, video_files, true);
+            if (!match_preview_current(preview, generation)) {
+                continue;
+            }
+            const std::vector<EpisodeKey> &subtitle_keys =
+                side_keys(subtitle_column, request, subtitle_files, false);
+            if (!match_preview_current(preview, generation)) {
+                continue;
+            }
+            const std::vector<bool> &trusted = trusted_subtitles(trusted_column, request, subtitle_files);
+            const EpisodeMatch match = match_episodes(video_keys, subtitle_keys, trusted);
+            result.video_rows = build_file_rows(video_files, video_keys, match.video_partners, subtitle_files,
+                                                match.video_references, subtitle_files);
+            result.subtitle_rows = build_file_rows(subtitle_files, subtitle_keys, match.subtitle_partners, video_files,
+                                                   match.subtitle_references, subtitle_files);
+        }
+        if (match_preview_current(preview, generation)) {
+            preview.on_result(std::move(result));
+        }
+    }
+}
+
+void start_match_preview(MatchPreview &preview, std::function<void(MatchPreviewResult result)> on_result) {
+    preview.on_result = std::move(on_result);
+    preview.thread = std::thread(run_preview, std::ref(preview));
+}
+
+uint64_t request_match_preview(MatchPreview &preview, const SyncRequest &request,
+                               std::shared_ptr<const FileCatalog> video_files,
+                               std::shared_ptr<const FileCatalog> subtitle_files) {
+    std::lock_guard<std::mutex> lock(preview.mutex);
+    preview.request = request;
+    preview.video_files = std::move(video_files);
+    preview.subtitle_files = std::move(subtitle_files);
+    preview.pending = true;
+    const uint64_t generation = ++preview.generation;
+    preview.wake.notify_one();
+    return generation;
+}
+
+bool match_preview_current(const MatchPreview &preview, uint64_t generation) {
+    return preview.generation.load() == generation;
+}
+
+void stop_match_preview(MatchPreview &preview) {
+    {
+        std::lock_guard<std::mutex> lock(preview.mutex);
+        preview.stopping = true;
+        ++preview.generation;  // whatever is running is stale now
+    }
+    preview.wake.notify_one();
+    if (preview.thread.joinable()) {
+        preview.thread.join();
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef MATCH_PREVIEW_H
+#define MATCH_PREVIEW_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "file_list_view.h"
+#include "sync_core.h"
+
+// Rows for both file lists under one regex/index setting
+struct MatchPreviewResult {
+    uint64_t generation = 0;
+    bool valid_patterns = true;
+    FileRows video_rows;
+    FileRows subtitle_rows;
+};
+
+// Latest-wins matcher on its own thread. Each request supersedes the one before it; an evaluation
+// that has been superseded stops at its next stage boundary and never reports.
+struct MatchPreview {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::atomic<uint64_t> generation{0};
+    bool pending = false;
+    bool stopping = false;
+    SyncRequest request;
+    std::shared_ptr<const FileCatalog> video_files;
+    std::shared_ptr<const FileCatalog> subtitle_files;
+    std::function<void(MatchPreviewResult result)> on_result;  // called on the preview thread
+};
+
+void start_match_preview(MatchPreview &preview, std::function<void(MatchPreviewResult result)> on_result);
+
+// Queue a match of the given catalogs; returns the generation its result will carry.
+// The catalogs are shared snapshots, so a request costs the caller no copying. A side whose catalog
+// and pattern are the same as in the last evaluation keeps its key column.
+uint64_t request_match_preview(MatchPreview &preview, const SyncRequest &request,
+                               std::shared_ptr<const FileCatalog> video_files,
+                               std::shared_ptr<const FileCatalog> subtitle_files);
+
+// True while generation is the newest request, i.e. its result should still be shown
+bool match_preview_current(const MatchPreview &preview, uint64_t generation);
+
+void stop_match_preview(MatchPreview &preview);
+
+#endif // MATCH_PREVIEW_H
@@ -0,0 +1,367 @@
+#include "media_probe.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Header sections are read whole; a larger one is damage rather than anything this probe reads
+static const uint64_t max_section_bytes = 64ULL << 20;
+
+// Matroska element IDs, length marker included as the spec writes them
+static const uint32_t ebml_header_id = 0x1A45DFA3;
+static const uint32_t segment_id = 0x18538067;
+static const uint32_t info_id = 0x1549A966;
+static const uint32_t timecode_scale_id = 0x2AD7B1;
+static const uint32_t duration_id = 0x4489;
+static const uint32_t tracks_id = 0x1654AE6B;
+static const uint32_t track_entry_id = 0xAE;
+static const uint32_t track_type_id = 0x83;
+static const uint32_t default_duration_id = 0x23E383;
+static const uint32_t cluster_id = 0x1F43B675;
+static const uint64_t video_track_type = 1;
+
+static constexpr uint32_t fourcc(const char (&name)[5]) {
+    return static_cast<uint32_t>(name[0]) << 24 | static_cast<uint32_t>(name[1]) << 16 |
+           static_cast<uint32_t>(name[2]) << 8 | static_cast<uint32_t>(name[3]);
+}
+
+static uint64_t read_be(const uint8_t *data, size_t length) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < length; ++i) {
+        value = value << 8 | data[i];
+    }
+    return value;
+}
+
+static bool read_at(int fd, uint64_t offset, void *buffer, size_t length) {
+    char *out = static_cast<char *>(buffer);
+    while (length > 0) {
+        ssize_t count = pread(fd, out, length, static_cast<off_t>(offset));
+        if (count <= 0) {
+            return false;
+        }
+        out += count;
+        offset += static_cast<uint64_t>(count);
+        length -= static_cast<size_t>(count);
+    }
+    return true;
+}
+
+static bool read_section(int fd, uint64_t offset, uint64_t length, std::vector<uint8_t> &data) {
+    if (length > max_section_bytes) {
+        return false;
+    }
+    data.resize(static_cast<size_t>(length));
+    return read_at(fd, offset, data.data(), data.size());
+}
+
+struct EbmlElement {
+    uint32_t id = 0;
+    uint64_t size = 0;
+    size_t header_length = 0;
+    bool unknown_size = false;  // runs to the end of its parent, allowed for segments and clusters
+};
+
+// Leading zero bits of the first byte give the length of a variable-size integer
+static size_t vint_length(uint8_t first) {
+    size_t length = 1;
+    while (length <= 8 && !(first & (0x80 >> (length - 1)))) {
+        ++length;
+    }
+    return length;
+}
+
+static bool parse_ebml_element(const uint8_t *data, size_t available, EbmlElement &element) {
+    if (available == 0) {
+        return false;
+    }
+    const size_t id_length = vint_length(data[0]);
+    if (id_length > 4 || id_length >= available) {
+        return false;
+    }
+    element.id = static_cast<uint32_t>(read_be(data, id_length));
+    const uint8_t first = data[id_length];
+    const size_t size_length = vint_length(first);
+    if (size_length > 8 || id_length + size_length > available) {
+        return false;
+    }
+    const uint8_t value_mask = static_cast<uint8_t>(0xFF >> size_length);
+    uint64_t size = first & value_mask;
+    bool all_ones = (first & value_mask) == value_mask;
+    for (size_t i = 1; i < size_length; ++i) {
+        size = size << 8 | data[id_length + i];
+        all_ones = all_ones && data[id_length + i] == 0xFF;
+    }
+    element.size = size;
+    element.unknown_size = all_ones;
+    element.header_length = id_length + size_length;
+    return true;
+}
+
+// Call visit(id, payload, size) for every child of an element read into memory
+template <typename Visit>
+static void for_each_ebml_child(const uint8_t *data, size_t size, Visit &&visit) {
+    size_t pos = 0;
+    EbmlElement element;
+    while (pos < size && parse_ebml_element(data + pos, size - pos, element) && !element.unknown_size &&
+           element.size <= size - pos - element.header_length) {
+        visit(element.id, data + pos + element.header_length, static_cast<size_t>(element.size));
+        pos += element.header_length + static_cast<size_t>(element.size);
+    }
+}
+
+static double read_ebml_float(const uint8_t *data, size_t size) {
+    if (size == 4) {
+        const uint32_t bits = static_cast<uint32_t>(read_be(data, 4));
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    if (size == 8) {
+        const uint64_t bits = read_be(data, 8);
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    return 0.0;
+}
+
+// Info and Tracks come before the first cluster in what mkvmerge and ffmpeg write, so the walk stops there
+// instead of following the seek head to the end of the file
+static bool probe_matroska(int fd, uint64_t file_size, MediaInfo &info) {
+    uint8_t buffer[12];
+    EbmlElement element;
+    uint64_t pos = 0;
+    if (!read_at(fd, pos, buffer, std::min<uint64_t>(sizeof(buffer), file_size)) ||
+        !parse_ebml_element(buffer, std::min<uint64_t>(sizeof(buffer), file_size), element) ||
+        element.id != ebml_header_id || element.unknown_size) {
+        return false;
+    }
+    pos += element.header_length + element.size;
+    if (pos >= file_size || !read_at(fd, pos, buffer, std::min<uint64_t>(sizeof(buffer), file_size - pos)) ||
+        !parse_ebml_element(buffer, std::min<uint64_t>(sizeof(buffer), file_size - pos), element) ||
+        element.id != segment_id) {
+        return false;
+    }
+    const uint64_t segment_end =
+        element.unknown_size ? file_size : std::min(file_size, pos + element.header_length + element.size);
+    pos += element.header_length;
+
+    uint64_t timecode_scale = 1000000;  // nanoseconds per timecode unit, the spec's default
+    double duration = 0.0;              // in timecode units
+    uint64_t frame_duration_ns = 0;
+    bool have_info = false;
+    bool have_tracks = false;
+    std::vector<uint8_t> section;
+    while (pos < segment_end && !(have_info && have_tracks)) {
+        const size_t available = static_cast<size_t>(std::min<uint64_t>(sizeof(buffer), segment_end - pos));
+        if (!read_at(fd, pos, buffer, available) || !parse_ebml_element(buffer, available, element) ||
+            element.id == cluster_id || element.unknown_size) {
+            break;
+        }
+        const uint64_t payload = pos + element.header_length;
+        if (element.id == info_id && !have_info) {
+            if (!read_section(fd, payload, element.size, section)) {
+                break;
+            }
+            have_info = true;
+            for_each_ebml_child(section.data(), section.size(), [&](uint32_t id, const uint8_t *data, size_t size) {
+                if (id == timecode_scale_id && size > 0 && size <= 8) {
+                    timecode_scale = read_be(data, size);
+                } else if (id == duration_id) {
+                    duration = read_ebml_float(data, size);
+                }
+            });
+        } else if (element.id == tracks_id && !have_tracks) {
+            if (!read_section(fd, payload, element.size, section)) {
+                break;
+            }
+            have_tracks = true;
+            for_each_ebml_child(section.data(), section.size(), [&](uint32_t id, const uint8_t *data, size_t size) {
+                if (id != track_entry_id || frame_duration_ns != 0) {
+                    return;
+                }
+                uint64_t type = 0;
+                uint64_t default_duration = 0;
+                for_each_ebml_child(data, size, [&](uint32_t child, const uint8_t *value, size_t length) {
+                    if (child == track_type_id && length > 0 && length <= 8) {
+                        type = read_be(value, length);
+                    } else if (child == default_duration_id && length > 0 && length <= 8) {
+                        default_duration = read_be(value, length);
+                    }
+                });
+                if (type == video_track_type) {
+                    frame_duration_ns = default_duration;
+                }
+            });
+        }
+        pos = payload + element.size;
+    }
+
+    if (frame_duration_ns > 0) {
+        info.frame_rate = 1e9 / static_cast<double>(frame_duration_ns);
+    }
+    if (duration > 0.0) {
+        info.duration_ms = static_cast<int64_t>(duration * static_cast<double>(timecode_scale) / 1e6);
+    }
+    return have_info || have_tracks;
+}
+
+// Call visit(type, payload, size) for every box of a section read into memory
+template <typename Visit>
+static void for_each_box(const uint8_t *data, size_t size, Visit &&visit) {
+    size_t pos = 0;
+    while (size - pos >= 8) {
+        uint64_t length = read_be(data + pos, 4);
+        const uint32_t type = static_cast<uint32_t>(read_be(data + pos + 4, 4));
+        size_t header = 8;
+        if (length == 1) {
+            if (size - pos < 16) {
+                return;
+            }
+            length = read_be(data + pos + 8, 8);
+            header = 16;
+        } else if (length == 0) {
+            length = size - pos;
+        }
+        if (length < header || length > size - pos) {
+            return;
+        }
+        visit(type, data + pos + header, static_cast<size_t>(length - header));
+        pos += static_cast<size_t>(length);
+    }
+}
+
+// Timescale and duration of an mvhd or mdhd box, whose layouts agree up to there
+static bool read_media_header(const uint8_t *data, size_t size, uint32_t &timescale, uint64_t &duration) {
+    if (size >= 32 && data[0] == 1) {
+        timescale = static_cast<uint32_t>(read_be(data + 20, 4));
+        duration = read_be(data + 24, 8);
+        return true;
+    }
+    if (size >= 20 && data[0] == 0) {
+        timescale = static_cast<uint32_t>(read_be(data + 12, 4));
+        duration = read_be(data + 16, 4);
+        return true;
+    }
+    return false;
+}
+
+// Average frame rate of a video track from its time-to-sample table, exact for constant frame rates.
+// 0 for other tracks and for fragmented files, whose samples are described in the fragments instead.
+static double mp4_track_frame_rate(const uint8_t *trak, size_t trak_size) {
+    bool video = false;
+    uint32_t timescale = 0;
+    uint64_t frames = 0;
+    uint64_t ticks = 0;
+    for_each_box(trak, trak_size, [&](uint32_t type, const uint8_t *mdia, size_t mdia_size) {
+        if (type != fourcc("mdia")) {
+            return;
+        }
+        for_each_box(mdia, mdia_size, [&](uint32_t type, const uint8_t *data, size_t size) {
+            uint64_t duration = 0;
+            if (type == fourcc("hdlr") && size >= 12) {
+                video = read_be(data + 8, 4) == fourcc("vide");
+            } else if (type == fourcc("mdhd")) {
+                read_media_header(data, size, timescale, duration);
+            } else if (type == fourcc("minf")) {
+                for_each_box(data, size, [&](uint32_t type, const uint8_t *stbl, size_t stbl_size) {
+                    if (type != fourcc("stbl")) {
+                        return;
+                    }
+                    for_each_box(stbl, stbl_size, [&](uint32_t type, const uint8_t *stts, size_t stts_size) {
+                        if (type != fourcc("stts") || stts_size < 8) {
+                            return;
+                        }
+                        const uint64_t count = std::min<uint64_t>(read_be(stts + 4, 4), (stts_size - 8) / 8);
+                        for (uint64_t i = 0; i < count; ++i) {
+                            const uint64_t samples = read_be(stts + 8 + i * 8, 4);
+                            frames += samples;
+                            ticks += samples * read_be(stts + 12 + i * 8, 4);
+                        }
+                    });
+                });
+            }
+        });
+    });
+    if (!video || timescale == 0 || ticks == 0) {
+        return 0.0;
+    }
+    return static_cast<double>(timescale) * static_cast<double>(frames) / static_cast<double>(ticks);
+}
+
+// The moov box may sit at either end of the file; the boxes before it are stepped over, not read
+static bool probe_mp4(int fd, uint64_t file_size, MediaInfo &info) {
+    uint64_t pos = 0;
+    uint8_t header[16];
+    while (file_size - pos >= 8) {
+        if (!read_at(fd, pos, header, static_cast<size_t>(std::min<uint64_t>(sizeof(header), file_size - pos)))) {
+            return false;
+        }
+        uint64_t length = read_be(header, 4);
+        const uint32_t type = static_cast<uint32_t>(read_be(header + 4, 4));
+        uint64_t header_length = 8;
+        if (length == 1) {
+            if (file_size - pos < 16) {
+                return false;
+            }
+            length = read_be(header + 8, 8);
+            header_length = 16;
+        } else if (length == 0) {
+            length = file_size - pos;
+        }
+        if (length < header_length || length > file_size - pos) {
+            return false;
+        }
+        if (type != fourcc("moov")) {
+            pos += length;
+            continue;
+        }
+
+        std::vector<uint8_t> moov;
+        if (!read_section(fd, pos + header_length, length - header_length, moov)) {
+            return false;
+        }
+        for_each_box(moov.data(), moov.size(), [&](uint32_t type, const uint8_t *data, size_t size) {
+            uint32_t timescale = 0;
+            uint64_t duration = 0;
+            if (type == fourcc("mvhd") && read_media_header(data, size, timescale, duration) && timescale > 0) {
+                info.duration_ms = static_cast<int64_t>(duration * 1000 / timescale);
+            } else if (type == fourcc("trak") && info.frame_rate == 0.0) {
+                info.frame_rate = mp4_track_frame_rate(data, size);
+            }
+        });
+        return true;
+    }
+    return false;
+}
+
+// First box types of MP4 and QuickTime files; old QuickTime files have no ftyp
+static bool is_mp4_box(uint32_t type) {
+    return type == fourcc("ftyp") || type == fourcc("moov") || type == fourcc("mdat") || type == fourcc("wide") ||
+           type == fourcc("free") || type == fourcc("skip");
+}
+
+bool probe_media_file(const std::string &path, MediaInfo &info) {
+    info = MediaInfo();
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat file_info;
+    uint8_t magic[8];
+    bool probed = false;
+    if (fstat(fd, &file_info) == 0 && file_info.st_size >= 8 && read_at(fd, 0, magic, sizeof(magic))) {
+        const uint64_t file_size = static_cast<uint64_t>(file_info.st_size);
+        if (read_be(magic, 4) == ebml_header_id) {
+            probed = probe_matroska(fd, file_size, info);
+        } else if (is_mp4_box(static_cast<uint32_t>(read_be(magic + 4, 4)))) {
+            probed = probe_mp4(fd, file_size, info);
+        }
+    }
+    close(fd);
+    return probed;
+}
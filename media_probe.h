@@ -0,0 +1,17 @@
+#ifndef MEDIA_PROBE_H
+#define MEDIA_PROBE_H
+
+#include <cstdint>
+#include <string>
+
+// What a video's container headers say about it; nothing is decoded
+struct MediaInfo {
+    double frame_rate = 0.0;  // frames per second of the first video track, 0 = unknown
+    int64_t duration_ms = 0;  // 0 = unknown
+};
+
+// Matroska/WebM and MP4/QuickTime, told apart by their first bytes. False for other formats or when the
+// headers can't be read; only the header sections are read, never the media data.
+bool probe_media_file(const std::string &path, MediaInfo &info);
+
+#endif // MEDIA_PROBE_H
@@ -0,0 +1,108 @@
+#include "native_aligner.h"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include "span_cache.h"
+#include "trace.h"
+#include "voice_activity.h"
+
+namespace fs = std::filesystem;
+
+static std::string lower_extension(const std::string &path) {
+    std::string extension = fs::path(path).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return extension;
+}
+
+static bool is_text_subtitle(const std::string &extension) {
+    return extension == ".srt" || extension == ".ass" || extension == ".ssa";
+}
+
+// Subtitle formats alass reads that the built-in aligner doesn't, so they are never decoded as audio
+static bool is_other_subtitle(const std::string &extension) {
+    return extension == ".sub" || extension == ".idx" || extension == ".vtt";
+}
+
+bool native_alignment_supported(const std::string &reference_file, const std::string &subtitle_file) {
+    if (!is_text_subtitle(lower_extension(subtitle_file))) {
+        return false;
+    }
+    const std::string extension = lower_extension(reference_file);
+    return is_text_subtitle(extension) || (!is_other_subtitle(extension) && ffmpeg_available());
+}
+
+// Probing only reads the container headers, but the result is cached anyway so a re-sync touches nothing
+// but the fingerprint's blocks
+static double probe_frame_rate(const NativeAligner &aligner, const std::string &video_file,
+                               const FileFingerprint *fingerprint) {
+    TRACE_SCOPE("media_probe");
+    MediaInfo info;
+    if (fingerprint && load_cached_media_info(aligner.span_cache_dir, *fingerprint, info)) {
+        return info.frame_rate;
+    }
+    probe_media_file(video_file, info);
+    if (fingerprint) {
+        store_cached_media_info(aligner.span_cache_dir, *fingerprint, info);
+    }
+    return info.frame_rate;
+}
+
+bool load_reference_spans(NativeAligner &aligner, const std::string &reference_file, std::vector<TimeSpan> &spans,
+                          double &frame_rate, std::string &error) {
+    TRACE_SCOPE("reference_load");
+    frame_rate = 0.0;
+    if (is_text_subtitle(lower_extension(reference_file))) {
+        if (!load_subtitle_file(reference_file, aligner.reference, error)) {
+            return false;
+        }
+        spans = subtitle_spans(aligner.reference);
+        return true;
+    }
+
+    FileFingerprint fingerprint;
+    const bool cacheable = !aligner.span_cache_dir.empty() && fingerprint_file(reference_file, fingerprint);
+    frame_rate = probe_frame_rate(aligner, reference_file, cacheable ? &fingerprint : nullptr);
+    if (cacheable && load_cached_spans(aligner.span_cache_dir, fingerprint, spans)) {
+        return true;
+    }
+    {
+        TRACE_SCOPE("speech_extract");
+        if (!extract_speech_spans(reference_file, spans, error, aligner.cancelled)) {
+            return false;
+        }
+    }
+    if (cacheable) {
+        store_cached_spans(aligner.span_cache_dir, fingerprint, spans);
+    }
+    return true;
+}
+
+bool align_subtitle_file(NativeAligner &aligner, const std::string &reference_file, const std::string &subtitle_file,
+                         const std::string &output_file, const AlignmentParams &params, AlignmentResult &result,
+                         std::string &error) {
+    {
+        TRACE_SCOPE("subtitle_parse");
+        if (!load_subtitle_file(subtitle_file, aligner.subtitle, error)) {
+            return false;
+        }
+    }
+    std::vector<TimeSpan> reference;
+    AlignmentParams probed = params;
+    if (!load_reference_spans(aligner, reference_file, reference, probed.reference_frame_rate, error)) {
+        return false;
+    }
+    if (reference.empty()) {
+        error = "No speech or timed lines found in " + reference_file;
+        return false;
+    }
+
+    const std::vector<TimeSpan> spans = subtitle_spans(aligner.subtitle);
+    {
+        TRACE_SCOPE("align");
+        result = sweep_split_penalties(reference, spans, probed, aligner.workspaces);
+    }
+    TRACE_SCOPE("output_write");
+    return write_retimed_subtitle(output_file, aligner.subtitle, apply_alignment(spans, result), error);
+}
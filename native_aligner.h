@@ -0,0 +1,38 @@
+#ifndef NATIVE_ALIGNER_H
+#define NATIVE_ALIGNER_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "alignment.h"
+#include "subtitle_file.h"
+
+// One worker's aligner; its buffers are reused from job to job
+struct NativeAligner {
+    std::string span_cache_dir;                    // empty = never keep extracted speech spans
+    const std::atomic<bool> *cancelled = nullptr;  // stops a running audio extraction
+    unsigned int sweep_threads = 1;                // threads a penalty sweep may use
+    std::vector<AlignmentWorkspace> workspaces;    // one per sweep thread, the first for single runs
+    SubtitleDocument subtitle;                     // parsed subtitle, its cue arena reused per job
+    SubtitleDocument reference;                    // parsed subtitle reference
+};
+
+// True when the built-in aligner can read both files (SRT or ASS/SSA subtitles); otherwise the job has
+// to go to alass. Video references need ffmpeg on the PATH for their audio. Only asked for jobs of the
+// opt-in native engine; bench/vad_check.cpp measures its speech detection against known spans.
+bool native_alignment_supported(const std::string &reference_file, const std::string &subtitle_file);
+
+// Timing of a reference: the cues of a subtitle, or the speech in a video's audio. Speech spans come
+// from the span cache when the video is unchanged and are extracted and stored otherwise. frame_rate is
+// what a video's container headers say, cached the same way; 0 for subtitles or when unknown.
+bool load_reference_spans(NativeAligner &aligner, const std::string &reference_file, std::vector<TimeSpan> &spans,
+                          double &frame_rate, std::string &error);
+
+// Align subtitle_file to the timing of reference_file and write the result to output_file.
+// With params.sweep_penalties set the reference is loaded once and every penalty aligned against it.
+// A video reference's probed frame rate narrows the framerate guess.
+bool align_subtitle_file(NativeAligner &aligner, const std::string &reference_file, const std::string &subtitle_file,
+                         const std::string &output_file, const AlignmentParams &params, AlignmentResult &result,
+                         std::string &error);
+
+#endif // NATIVE_ALIGNER_H
@@ -0,0 +1,99 @@
+#include "overlap_kernel.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define OVERLAP_KERNEL_X86 1
+#endif
+
+static void overlap_scores_scalar(const int32_t *begin, const int32_t *end, double weight, double *out,
+                                  size_t count) {
+    for (size_t k = 0; k < count; ++k) {
+        out[k] += static_cast<double>(end[k] - begin[k]) * weight;
+    }
+}
+
+#ifdef OVERLAP_KERNEL_X86
+__attribute__((target("sse4.1"))) static void overlap_scores_sse4(const int32_t *begin, const int32_t *end,
+                                                                  double weight, double *out, size_t count) {
+    const __m128d scale = _mm_set1_pd(weight);
+    size_t k = 0;
+    for (; k + 4 <= count; k += 4) {
+        __m128i diff = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(end + k)),
+                                     _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin + k)));
+        __m128d low = _mm_mul_pd(_mm_cvtepi32_pd(diff), scale);
+        __m128d high = _mm_mul_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(diff, diff)), scale);
+        _mm_storeu_pd(out + k, _mm_add_pd(_mm_loadu_pd(out + k), low));
+        _mm_storeu_pd(out + k + 2, _mm_add_pd(_mm_loadu_pd(out + k + 2), high));
+    }
+    overlap_scores_scalar(begin + k, end + k, weight, out + k, count - k);
+}
+
+__attribute__((target("avx2"))) static void overlap_scores_avx2(const int32_t *begin, const int32_t *end,
+                                                                double weight, double *out, size_t count) {
+    const __m256d scale = _mm256_set1_pd(weight);
+    size_t k = 0;
+    for (; k + 8 <= count; k += 8) {
+        __m256i diff = _mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(end + k)),
+                                        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin + k)));
+        __m256d low = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(diff)), scale);
+        __m256d high = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(diff, 1)), scale);
+        _mm256_storeu_pd(out + k, _mm256_add_pd(_mm256_loadu_pd(out + k), low));
+        _mm256_storeu_pd(out + k + 4, _mm256_add_pd(_mm256_loadu_pd(out + k + 4), high));
+    }
+    overlap_scores_scalar(begin + k, end + k, weight, out + k, count - k);
+}
+#endif
+
+const char *overlap_kernel_name(OverlapKernelKind kind) {
+    switch (kind) {
+    case KERNEL_SSE4:
+        return "sse4";
+    case KERNEL_AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+OverlapKernel overlap_kernel(OverlapKernelKind kind) {
+    switch (kind) {
+    case KERNEL_SCALAR:
+        return overlap_scores_scalar;
+#ifdef OVERLAP_KERNEL_X86
+    case KERNEL_SSE4:
+        return __builtin_cpu_supports("sse4.1") ? overlap_scores_sse4 : nullptr;
+    case KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2") ? overlap_scores_avx2 : nullptr;
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+OverlapKernelKind active_overlap_kernel() {
+    static const OverlapKernelKind active = []() {
+        int limit = KERNEL_KIND_COUNT - 1;
+        if (const char *forced = std::getenv("SYNC_OVERLAP_KERNEL")) {
+            for (int kind = 0; kind < KERNEL_KIND_COUNT; ++kind) {
+                if (std::strcmp(forced, overlap_kernel_name(static_cast<OverlapKernelKind>(kind))) == 0) {
+                    limit = kind;
+                }
+            }
+        }
+        for (int kind = limit; kind > KERNEL_SCALAR; --kind) {
+            if (overlap_kernel(static_cast<OverlapKernelKind>(kind))) {
+                return static_cast<OverlapKernelKind>(kind);
+            }
+        }
+        return KERNEL_SCALAR;
+    }();
+    return active;
+}
+
+void add_overlap_scores(const int32_t *begin, const int32_t *end, double weight, double *out, size_t count) {
+    static const OverlapKernel kernel = overlap_kernel(active_overlap_kernel());
+    kernel(begin, end, weight, out, count);
+}
@@ -0,0 +1,25 @@
+#ifndef OVERLAP_KERNEL_H
+#define OVERLAP_KERNEL_H
+
+#include <cstddef>
+#include <cstdint>
+
+// The alignment hot loop: for one line, out[k] += (end[k] - begin[k]) * weight over every candidate offset k,
+// where begin/end point into the prefix sums of the rasterized reference. Every variant does the same
+// conversions, one multiply and one add per element in the same order (no fused multiply-add), so all of
+// them produce bit-identical results.
+typedef void (*OverlapKernel)(const int32_t *begin, const int32_t *end, double weight, double *out, size_t count);
+
+enum OverlapKernelKind { KERNEL_SCALAR, KERNEL_SSE4, KERNEL_AVX2, KERNEL_KIND_COUNT };
+
+const char *overlap_kernel_name(OverlapKernelKind kind);
+
+// The kernel for kind, or null when this build or CPU can't run it
+OverlapKernel overlap_kernel(OverlapKernelKind kind);
+
+// Best kernel the CPU supports, picked once. SYNC_OVERLAP_KERNEL=scalar|sse4|avx2 forces a lower one.
+OverlapKernelKind active_overlap_kernel();
+
+void add_overlap_scores(const int32_t *begin, const int32_t *end, double weight, double *out, size_t count);
+
+#endif // OVERLAP_KERNEL_H
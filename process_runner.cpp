@@ -0,0 +1,252 @@
+#include "process_runner.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+void OutputRing::append(const char *data, size_t size) {
+    const size_t capacity = buffer.size();
+    // Only the tail that survives is copied
+    if (size > capacity) {
+        head = (head + size - capacity) % capacity;
+        data += size - capacity;
+        total += size - capacity;
+        size = capacity;
+    }
+    const size_t first = std::min(size, capacity - head);
+    std::copy(data, data + first, buffer.begin() + head);
+    std::copy(data + first, data + size, buffer.begin());
+    head = (head + size) % capacity;
+    total += size;
+}
+
+std::string OutputRing::text() const {
+    if (total < buffer.size()) {
+        return std::string(buffer.begin(), buffer.begin() + head);
+    }
+    std::string text(buffer.begin() + head, buffer.end());
+    text.append(buffer.begin(), buffer.begin() + head);
+    return text;
+}
+
+bool spawn_process(const std::vector<std::string> &argv, SpawnedProcess &process) {
+    if (argv.empty()) {
+        return false;
+    }
+    // Close-on-exec so children spawned by other workers at the same time don't hold our write ends open
+    int out_pipe[2];
+    int err_pipe[2];
+    if (pipe2(out_pipe, O_CLOEXEC) != 0) {
+        return false;
+    }
+    if (pipe2(err_pipe, O_CLOEXEC) != 0) {
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        return false;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err_pipe[1], STDERR_FILENO);
+
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+    sigset_t default_signals;
+    sigemptyset(&default_signals);
+    sigaddset(&default_signals, SIGINT);
+    sigaddset(&default_signals, SIGTERM);
+    sigaddset(&default_signals, SIGPIPE);
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setsigmask(&attr, &no_signals);
+    posix_spawnattr_setsigdefault(&attr, &default_signals);
+
+    std::vector<char *> args;
+    for (const auto &arg : argv) {
+        args.push_back(const_cast<char *>(arg.c_str()));
+    }
+    args.push_back(nullptr);
+
+    pid_t pid = -1;
+    const int error = posix_spawnp(&pid, argv[0].c_str(), &actions, &attr, args.data(), environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    close(out_pipe[1]);
+    close(err_pipe[1]);
+    if (error != 0) {
+        close(out_pipe[0]);
+        close(err_pipe[0]);
+        errno = error;
+        return false;
+    }
+
+    fcntl(out_pipe[0], F_SETFL, fcntl(out_pipe[0], F_GETFL) | O_NONBLOCK);
+    fcntl(err_pipe[0], F_SETFL, fcntl(err_pipe[0], F_GETFL) | O_NONBLOCK);
+    process.pid = pid;
+    process.stdout_fd = out_pipe[0];
+    process.stderr_fd = err_pipe[0];
+    return true;
+}
+
+// Cuts one stream into lines; the unfinished rest waits for the next read
+static void split_lines(std::string &partial, const char *data, size_t size, const OutputLineCallback &on_line) {
+    for (size_t i = 0; i < size; ++i) {
+        if (data[i] == '\n' || data[i] == '\r') {
+            if (!partial.empty() && on_line) {
+                on_line(partial);
+            }
+            partial.clear();
+        } else {
+            partial += data[i];
+        }
+    }
+}
+
+void collect_process(SpawnedProcess &process, OutputRing &output, const OutputLineCallback &on_line,
+                     ProcessUsage &usage) {
+    pollfd fds[2] = {{process.stdout_fd, POLLIN, 0}, {process.stderr_fd, POLLIN, 0}};
+    std::string partial[2];
+    char chunk[4096];
+    while (fds[0].fd >= 0 || fds[1].fd >= 0) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for (int i = 0; i < 2; ++i) {
+            if (fds[i].fd < 0 || fds[i].revents == 0) {
+                continue;
+            }
+            // Read until the pipe is empty or closed
+            while (true) {
+                const ssize_t count = read(fds[i].fd, chunk, sizeof(chunk));
+                if (count > 0) {
+                    output.append(chunk, static_cast<size_t>(count));
+                    split_lines(partial[i], chunk, static_cast<size_t>(count), on_line);
+                    continue;
+                }
+                if (count == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    close(fds[i].fd);
+                    fds[i].fd = -1;
+                }
+                break;
+            }
+        }
+    }
+    // poll() stopping early leaves descriptors to close
+    for (auto &fd : fds) {
+        if (fd.fd >= 0) {
+            close(fd.fd);
+        }
+    }
+    for (const auto &rest : partial) {
+        if (!rest.empty() && on_line) {
+            on_line(rest);
+        }
+    }
+    process.stdout_fd = -1;
+    process.stderr_fd = -1;
+
+    int status = 0;
+    struct rusage resources = {};
+    int reaped = -1;
+    while ((reaped = wait4(process.pid, &status, 0, &resources)) == -1 && errno == EINTR) {
+    }
+    // status and resources are only filled in for a reaped child
+    if (reaped == -1) {
+        usage.wait_errno = errno;
+        return;
+    }
+    if (WIFEXITED(status)) {
+        usage.exit_code = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        usage.term_signal = WTERMSIG(status);
+    }
+    usage.user_seconds = resources.ru_utime.tv_sec + resources.ru_utime.tv_usec / 1e6;
+    usage.system_seconds = resources.ru_stime.tv_sec + resources.ru_stime.tv_usec / 1e6;
+    usage.max_rss_kb = resources.ru_maxrss;
+}
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// The "340 / 1000 " counter that ends right before a bar opening at open
+static bool parse_counter(const std::string &line, size_t open, double &current, double &total) {
+    if (open < 2 || line[open - 1] != ' ') {
+        return false;
+    }
+    size_t i = open - 1;
+    const size_t total_end = i;
+    while (i > 0 && is_digit(line[i - 1])) {
+        --i;
+    }
+    if (i == total_end || i < 4 || line.compare(i - 3, 3, " / ") != 0) {
+        return false;
+    }
+    total = std::strtod(line.c_str() + i, nullptr);
+    i -= 3;
+    const size_t current_end = i;
+    while (i > 0 && is_digit(line[i - 1])) {
+        --i;
+    }
+    if (i == current_end) {
+        return false;
+    }
+    current = std::strtod(line.c_str() + i, nullptr);
+    return true;
+}
+
+// The " 34.00 %" that follows the bar closing at close
+static bool parse_percent(const std::string &line, size_t close) {
+    size_t i = close + 1;
+    if (i >= line.size() || line[i] != ' ') {
+        return false;
+    }
+    ++i;
+    const size_t start = i;
+    while (i < line.size() && (is_digit(line[i]) || line[i] == '.')) {
+        ++i;
+    }
+    if (i == start) {
+        return false;
+    }
+    if (i < line.size() && line[i] == ' ') {
+        ++i;
+    }
+    return i < line.size() && line[i] == '%';
+}
+
+bool parse_progress(const std::string &line, double &fraction) {
+    for (size_t open = line.find('['); open != std::string::npos; open = line.find('[', open + 1)) {
+        const size_t close = line.find(']', open + 1);
+        if (close == std::string::npos) {
+            return false;
+        }
+        double current = 0.0;
+        double total = 0.0;
+        if (parse_counter(line, open, current, total) && total > 0.0 && parse_percent(line, close)) {
+            fraction = std::min(1.0, std::max(0.0, current / total));
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,54 @@
+#ifndef PROCESS_RUNNER_H
+#define PROCESS_RUNNER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// Last bytes a child printed; once full, the oldest are overwritten
+struct OutputRing {
+    std::vector<char> buffer = std::vector<char>(16 * 1024);
+    size_t head = 0;    // next write position
+    size_t total = 0;   // bytes ever appended
+
+    void append(const char *data, size_t size);
+    std::string text() const;  // oldest first
+};
+
+// How the child ended and what it cost, from wait4
+struct ProcessUsage {
+    int exit_code = -1;    // -1 when it didn't exit normally
+    int term_signal = 0;   // the signal that killed it, 0 otherwise
+    int wait_errno = 0;    // errno when the child could not be reaped; exit_code stays -1
+    double user_seconds = 0.0;
+    double system_seconds = 0.0;
+    long max_rss_kb = 0;
+};
+
+// A child with its stdout and stderr on non-blocking pipes
+struct SpawnedProcess {
+    pid_t pid = -1;
+    int stdout_fd = -1;
+    int stderr_fd = -1;
+};
+
+// Invoked with every complete line of either stream as it arrives; \r ends a line too, so progress bars
+// that redraw in place come through as they update
+using OutputLineCallback = std::function<void(const std::string &line)>;
+
+// Start argv[0] (looked up on the PATH) with argv, no shell involved. The child runs in its own process
+// group so kill(-pid) also reaches anything it starts, and with a clean signal mask even when the caller
+// blocks signals for a watcher thread. False with errno set when it could not be started.
+bool spawn_process(const std::vector<std::string> &argv, SpawnedProcess &process);
+
+// Drain both pipes into output until the child closes them, then reap it
+void collect_process(SpawnedProcess &process, OutputRing &output, const OutputLineCallback &on_line,
+                     ProcessUsage &usage);
+
+// The fraction done on one of alass's progress lines, which its progress bar crate draws as
+// "340 / 1000 [=====>------] 34.00 % 120.50/s 5s". Only a counter followed by a bar and a percentage
+// counts; any other line is ignored, however many "N/M" figures such as dates or 24000/1001 it has.
+bool parse_progress(const std::string &line, double &fraction);
+
+#endif // PROCESS_RUNNER_H
@@ -0,0 +1,380 @@
+#include "scan_snapshot.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <unordered_set>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "subtitle_file.h"
+
+namespace fs = std::filesystem;
+
+// Bumped whenever the layout changes; older snapshots are ignored and the folders rescanned
+static const uint32_t snapshot_version = 4;
+
+std::string scan_snapshot_path(const std::string &config_file) {
+    return (fs::path(config_file).parent_path() / "scan_snapshot.bin").string();
+}
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+uint64_t scan_options_hash(const ScanOptions &options) {
+    uint64_t hash = fnv1a(14695981039346656037ULL, &options.max_depth, sizeof(options.max_depth));
+    for (const auto &extension : options.extensions) {
+        hash = fnv1a(hash, extension.c_str(), extension.size() + 1);
+    }
+    return hash;
+}
+
+// Little-endian fields appended to a byte string; strings are length prefixed
+struct SnapshotWriter {
+    std::string data;
+
+    template <typename T>
+    void put(T value) {
+        data.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+    void put_string(const std::string &text) {
+        put(static_cast<uint32_t>(text.size()));
+        data += text;
+    }
+};
+
+// Bounds-checked reads over the mapped file; ok turns false on the first overrun and stays false
+struct SnapshotReader {
+    const char *data;
+    size_t size;
+    size_t pos = 0;
+    bool ok = true;
+
+    template <typename T>
+    T get() {
+        T value{};
+        if (!ok || size - pos < sizeof(T)) {
+            ok = false;
+            return value;
+        }
+        std::memcpy(&value, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+    std::string get_string() {
+        const uint32_t length = get<uint32_t>();
+        if (!ok || size - pos < length) {
+            ok = false;
+            return std::string();
+        }
+        std::string text(data + pos, length);
+        pos += length;
+        return text;
+    }
+    // A count that can't possibly fit in what is left means a damaged file, not a huge allocation
+    uint32_t get_count(size_t min_record_size) {
+        const uint32_t count = get<uint32_t>();
+        if (ok && static_cast<uint64_t>(count) * min_record_size > size - pos) {
+            ok = false;
+        }
+        return ok ? count : 0;
+    }
+};
+
+template <typename T>
+static void put_column(SnapshotWriter &out, const std::vector<T> &column) {
+    out.data.append(reinterpret_cast<const char *>(column.data()), column.size() * sizeof(T));
+}
+
+template <typename T>
+static void get_column(SnapshotReader &in, std::vector<T> &column, size_t count) {
+    if (!in.ok || (in.size - in.pos) / sizeof(T) < count) {
+        in.ok = false;
+        return;
+    }
+    column.resize(count);
+    std::memcpy(column.data(), in.data + in.pos, count * sizeof(T));
+    in.pos += count * sizeof(T);
+}
+
+// The catalog goes to disk as it is in memory: the arena, then one column after the other
+static void put_folder(SnapshotWriter &out, const FolderSnapshot &folder) {
+    out.put_string(folder.folder);
+    out.put(folder.options_hash);
+    out.put(static_cast<uint32_t>(folder.directories.size()));
+    for (const auto &directory : folder.directories) {
+        out.put_string(directory.path);
+        out.put(directory.mtime_ns);
+        out.put(static_cast<int32_t>(directory.depth));
+    }
+    out.put_string(folder.files.arena);
+    out.put(static_cast<uint32_t>(folder.files.size()));
+    put_column(out, folder.files.path_ends);
+    put_column(out, folder.files.sizes);
+    put_column(out, folder.files.mtimes_ns);
+}
+
+static void get_folder(SnapshotReader &in, FolderSnapshot &folder) {
+    folder.folder = in.get_string();
+    folder.options_hash = in.get<uint64_t>();
+    folder.directories.resize(in.get_count(16));
+    for (auto &directory : folder.directories) {
+        directory.path = in.get_string();
+        directory.mtime_ns = in.get<int64_t>();
+        directory.depth = in.get<int32_t>();
+    }
+    FileCatalog &files = folder.files;
+    files.arena = in.get_string();
+    const uint32_t count = in.get_count(20);
+    get_column(in, files.path_ends, count);
+    get_column(in, files.sizes, count);
+    get_column(in, files.mtimes_ns, count);
+    // Every path has to lie within the arena, in order
+    for (size_t i = 0; in.ok && i < count; ++i) {
+        const uint32_t begin = i == 0 ? 0 : files.path_ends[i - 1];
+        in.ok = files.path_ends[i] >= begin && files.path_ends[i] <= files.arena.size();
+    }
+}
+
+// One key per file, or none at all when the patterns were invalid
+static void put_keys(SnapshotWriter &out, const std::vector<EpisodeKey> &keys) {
+    out.put(static_cast<uint32_t>(keys.size()));
+    for (const auto &key : keys) {
+        out.put(static_cast<int32_t>(key.season));
+        out.put(static_cast<int32_t>(key.episode));
+    }
+}
+
+static void get_keys(SnapshotReader &in, std::vector<EpisodeKey> &keys, size_t file_count) {
+    keys.resize(in.get_count(8));
+    in.ok = in.ok && (keys.empty() || keys.size() == file_count);
+    for (auto &key : keys) {
+        key.season = in.get<int32_t>();
+        key.episode = in.get<int32_t>();
+    }
+}
+
+static void put_partners(SnapshotWriter &out, const std::vector<uint32_t> &partners) {
+    out.put(static_cast<uint32_t>(partners.size()));
+    put_column(out, partners);
+}
+
+static void get_partners(SnapshotReader &in, std::vector<uint32_t> &partners, size_t file_count,
+                         size_t partner_count) {
+    const uint32_t count = in.get_count(4);
+    in.ok = in.ok && (count == 0 || count == file_count);
+    get_column(in, partners, count);
+    for (size_t i = 0; in.ok && i < partners.size(); ++i) {
+        in.ok = partners[i] == no_partner || partners[i] < partner_count;
+    }
+}
+
+bool load_scan_snapshot(const std::string &path, ScanSnapshot &snapshot) {
+    MappedFile file;
+    std::string error;
+    if (!map_file(path, file, error) || file.size < 8) {
+        return false;
+    }
+    SnapshotReader in{file.data, file.size};
+    char magic[4];
+    for (char &c : magic) {
+        c = in.get<char>();
+    }
+    if (std::memcmp(magic, "SCNS", 4) != 0 || in.get<uint32_t>() != snapshot_version) {
+        return false;
+    }
+
+    ScanSnapshot loaded;
+    get_folder(in, loaded.videos);
+    get_folder(in, loaded.subtitles);
+    loaded.video_regex = in.get_string();
+    loaded.video_match_index = in.get<int32_t>();
+    loaded.subtitle_regex = in.get_string();
+    loaded.subtitle_match_index = in.get<int32_t>();
+    loaded.reference_regex = in.get_string();
+    loaded.match_full_path = in.get<uint8_t>() != 0;
+    const size_t video_count = loaded.videos.files.size();
+    const size_t subtitle_count = loaded.subtitles.files.size();
+    get_keys(in, loaded.video_keys, video_count);
+    get_keys(in, loaded.subtitle_keys, subtitle_count);
+    get_partners(in, loaded.match.video_partners, video_count, subtitle_count);
+    get_partners(in, loaded.match.subtitle_partners, subtitle_count, video_count);
+    get_partners(in, loaded.match.video_references, video_count, subtitle_count);
+    get_partners(in, loaded.match.subtitle_references, subtitle_count, subtitle_count);
+    const auto paired = [](uint32_t partner) { return partner != no_partner; };
+    loaded.match.pairs = std::count_if(loaded.match.video_partners.begin(), loaded.match.video_partners.end(), paired);
+    loaded.match.reference_pairs =
+        std::count_if(loaded.match.video_references.begin(), loaded.match.video_references.end(), paired);
+    if (!in.ok) {
+        return false;
+    }
+    snapshot = std::move(loaded);
+    return true;
+}
+
+bool store_scan_snapshot(const std::string &path, const ScanSnapshot &snapshot) {
+    SnapshotWriter out;
+    out.data.append("SCNS", 4);
+    out.put(snapshot_version);
+    put_folder(out, snapshot.videos);
+    put_folder(out, snapshot.subtitles);
+    out.put_string(snapshot.video_regex);
+    out.put(static_cast<int32_t>(snapshot.video_match_index));
+    out.put_string(snapshot.subtitle_regex);
+    out.put(static_cast<int32_t>(snapshot.subtitle_match_index));
+    out.put_string(snapshot.reference_regex);
+    out.put(static_cast<uint8_t>(snapshot.match_full_path));
+    put_keys(out, snapshot.video_keys);
+    put_keys(out, snapshot.subtitle_keys);
+    put_partners(out, snapshot.match.video_partners);
+    put_partners(out, snapshot.match.subtitle_partners);
+    put_partners(out, snapshot.match.video_references);
+    put_partners(out, snapshot.match.subtitle_references);
+
+    std::string temp_path = path + ".XXXXXX";
+    int fd = mkstemp(&temp_path[0]);
+    if (fd == -1) {
+        return false;
+    }
+    size_t written = 0;
+    while (written < out.data.size()) {
+        ssize_t count = write(fd, out.data.data() + written, out.data.size() - written);
+        if (count <= 0) {
+            break;
+        }
+        written += static_cast<size_t>(count);
+    }
+    close(fd);
+    if (written != out.data.size() || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        unlink(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool directory_mtime(const fs::path &path, int64_t &mtime_ns) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+        return false;
+    }
+    mtime_ns = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    return true;
+}
+
+static std::string parent_of(std::string_view relative) {
+    const size_t slash = relative.rfind('/');
+    return slash == std::string_view::npos ? std::string() : std::string(relative.substr(0, slash));
+}
+
+static std::string join_relative(const std::string &parent, const std::string &name) {
+    if (parent.empty() || name.empty()) {
+        return parent.empty() ? name : parent;
+    }
+    return parent + "/" + name;
+}
+
+// Full scan of a subdirectory that wasn't there before, merged into folder
+static void scan_new_directory(FolderSnapshot &folder, const std::string &relative, int depth,
+                               const ScanOptions &options, const ScanControl &control,
+                               std::vector<ScanError> &errors) {
+    ScanOptions sub_options = options;
+    sub_options.max_depth = options.max_depth < 0 ? -1 : options.max_depth - depth;
+    scan_directory((fs::path(folder.folder) / relative).string(), sub_options, control, [&](ScanBatch batch) {
+        for (size_t i = 0; i < batch.files.size(); ++i) {
+            append_catalog_file(folder.files, join_relative(relative, std::string(batch.files.path(i))),
+                                batch.files.sizes[i], batch.files.mtimes_ns[i]);
+        }
+        for (const auto &directory : batch.directories) {
+            folder.directories.push_back(
+                {join_relative(relative, directory.path), directory.mtime_ns, directory.depth + depth});
+        }
+        errors.insert(errors.end(), batch.errors.begin(), batch.errors.end());
+    });
+}
+
+size_t revalidate_folder(FolderSnapshot &folder, const ScanOptions &options, const ScanControl &control,
+                         std::vector<ScanError> &errors) {
+    const fs::path root = folder.folder;
+    std::vector<ScannedDirectory> stale;
+    std::unordered_set<std::string> changed;  // stale or gone; their direct files are dropped
+    for (const auto &directory : folder.directories) {
+        if (control.cancelled) {
+            return 0;
+        }
+        int64_t mtime_ns = 0;
+        if (!directory_mtime(root / directory.path, mtime_ns)) {
+            changed.insert(directory.path);
+        } else if (mtime_ns != directory.mtime_ns) {
+            stale.push_back(directory);
+            changed.insert(directory.path);
+        }
+    }
+    if (changed.empty()) {
+        return 0;
+    }
+
+    FileCatalog kept;
+    for (size_t i = 0; i < folder.files.size(); ++i) {
+        if (changed.count(parent_of(folder.files.path(i))) == 0) {
+            append_catalog_file(kept, folder.files.path(i), folder.files.sizes[i], folder.files.mtimes_ns[i]);
+        }
+    }
+    folder.files = std::move(kept);
+    folder.directories.erase(std::remove_if(folder.directories.begin(), folder.directories.end(),
+                                            [&](const ScannedDirectory &directory) {
+                                                return changed.count(directory.path) > 0;
+                                            }),
+                             folder.directories.end());
+    // Stale directories are listed again below, so they count as known rather than new
+    std::unordered_set<std::string> known;
+    for (const auto &directory : folder.directories) {
+        known.insert(directory.path);
+    }
+    for (const auto &directory : stale) {
+        known.insert(directory.path);
+    }
+
+    for (const auto &directory : stale) {
+        if (control.cancelled) {
+            return 0;
+        }
+        // The directory's own files, and its new mtime taken before listing
+        ScanOptions flat = options;
+        flat.max_depth = 0;
+        scan_directory((root / directory.path).string(), flat, control, [&](ScanBatch batch) {
+            for (size_t i = 0; i < batch.files.size(); ++i) {
+                append_catalog_file(folder.files, join_relative(directory.path, std::string(batch.files.path(i))),
+                                    batch.files.sizes[i], batch.files.mtimes_ns[i]);
+            }
+            for (const auto &listed : batch.directories) {
+                folder.directories.push_back({directory.path, listed.mtime_ns, directory.depth});
+            }
+            errors.insert(errors.end(), batch.errors.begin(), batch.errors.end());
+        });
+
+        // Subdirectories that weren't listed before get a scan of their own
+        const int child_depth = directory.depth + 1;
+        if (options.max_depth >= 0 && child_depth > options.max_depth) {
+            continue;
+        }
+        // The listing above already reported a directory that can't be read
+        std::error_code ec;
+        for (fs::directory_iterator it(root / directory.path, ec), end; !ec && it != end; it.increment(ec)) {
+            std::error_code entry_ec;
+            if (!it->is_directory(entry_ec)) {
+                continue;
+            }
+            const std::string relative = join_relative(directory.path, it->path().filename().string());
+            if (known.insert(relative).second) {
+                scan_new_directory(folder, relative, child_depth, options, control, errors);
+            }
+        }
+    }
+    return changed.size();
+}
@@ -0,0 +1,54 @@
+#ifndef SCAN_SNAPSHOT_H
+#define SCAN_SNAPSHOT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "directory_scanner.h"
+#include "episode_matcher.h"
+#include "file_catalog.h"
+
+// One scanned folder: every directory that was listed, with its mtime, and the files found
+struct FolderSnapshot {
+    std::string folder;
+    uint64_t options_hash = 0;  // scan_options_hash of the options the scan used
+    std::vector<ScannedDirectory> directories;
+    FileCatalog files;
+};
+
+// The last scan of both folders with the keys and pairs the file lists showed, so the next start
+// can fill the lists before anything is rescanned. The key and partner columns are empty when the
+// patterns were invalid.
+struct ScanSnapshot {
+    FolderSnapshot videos;
+    FolderSnapshot subtitles;
+    std::string video_regex;
+    std::string subtitle_regex;
+    int video_match_index = 1;
+    int subtitle_match_index = 1;
+    std::string reference_regex;
+    bool match_full_path = false;
+    std::vector<EpisodeKey> video_keys;
+    std::vector<EpisodeKey> subtitle_keys;
+    EpisodeMatch match;
+};
+
+// The snapshot file that lives next to the given config file
+std::string scan_snapshot_path(const std::string &config_file);
+
+// Changes whenever a scan with these options could find a different set of files
+uint64_t scan_options_hash(const ScanOptions &options);
+
+// False when there is no snapshot or it is from another version or damaged
+bool load_scan_snapshot(const std::string &path, ScanSnapshot &snapshot);
+
+// Written to a temporary file and renamed into place
+bool store_scan_snapshot(const std::string &path, const ScanSnapshot &snapshot);
+
+// Bring folder up to date: only directories whose mtime changed are listed again, new subdirectories
+// are scanned and vanished ones dropped. Returns the number of directories that had changed; entries
+// that could not be read are appended to errors.
+size_t revalidate_folder(FolderSnapshot &folder, const ScanOptions &options, const ScanControl &control,
+                         std::vector<ScanError> &errors);
+
+#endif // SCAN_SNAPSHOT_H
@@ -0,0 +1,167 @@
+#include "span_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Bumped whenever the file layout or the speech detector changes, so stale spans are re-extracted
+static const uint32_t span_file_version = 1;
+// Bumped whenever the layout or what the probe reads changes
+static const uint32_t probe_file_version = 1;
+
+struct SpanFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t hash;
+    uint64_t count;
+};
+
+struct SpanRecord {
+    uint32_t start_ms;
+    uint32_t end_ms;
+};
+
+struct ProbeFile {
+    SpanFileHeader header;  // count is always 1
+    double frame_rate;
+    int64_t duration_ms;
+};
+
+static std::string cache_file_path(const std::string &cache_dir, const FileFingerprint &fingerprint,
+                                   const char *extension) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.%s", static_cast<unsigned long long>(fingerprint.hash), extension);
+    return (fs::path(cache_dir) / name).string();
+}
+
+static SpanFileHeader make_header(const char *magic, uint32_t version, const FileFingerprint &fingerprint,
+                                  uint64_t count) {
+    SpanFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, magic, 4);
+    header.version = version;
+    header.size = fingerprint.size;
+    header.mtime_ns = fingerprint.mtime_ns;
+    header.hash = fingerprint.hash;
+    header.count = count;
+    return header;
+}
+
+static bool header_matches(const SpanFileHeader &header, const char *magic, uint32_t version,
+                           const FileFingerprint &fingerprint) {
+    return std::memcmp(header.magic, magic, 4) == 0 && header.version == version &&
+           header.size == fingerprint.size && header.mtime_ns == fingerprint.mtime_ns &&
+           header.hash == fingerprint.hash;
+}
+
+// Several jobs may share a video, so every writer gets its own temporary name and renames it into place
+static bool write_cache_file(const std::string &cache_dir, const std::string &path, const char *data, size_t size) {
+    std::error_code ec;
+    fs::create_directories(cache_dir, ec);
+    std::string temp_path = path + ".XXXXXX";
+    int fd = mkstemp(&temp_path[0]);
+    if (fd == -1) {
+        return false;
+    }
+    size_t written = 0;
+    while (written < size) {
+        ssize_t count = write(fd, data + written, size - written);
+        if (count <= 0) {
+            break;
+        }
+        written += static_cast<size_t>(count);
+    }
+    close(fd);
+    if (written != size || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        unlink(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string span_cache_dir(const std::string &config_file) {
+    return (fs::path(config_file).parent_path() / "speech_spans").string();
+}
+
+bool load_cached_spans(const std::string &cache_dir, const FileFingerprint &fingerprint,
+                       std::vector<TimeSpan> &spans) {
+    int fd = open(cache_file_path(cache_dir, fingerprint, "spans").c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(SpanFileHeader)) {
+        close(fd);
+        return false;
+    }
+    const size_t length = static_cast<size_t>(info.st_size);
+    void *data = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    const SpanFileHeader *header = static_cast<const SpanFileHeader *>(data);
+    const bool valid = header_matches(*header, "SPAN", span_file_version, fingerprint) &&
+                       header->count == (length - sizeof(SpanFileHeader)) / sizeof(SpanRecord);
+    if (valid) {
+        const SpanRecord *records =
+            reinterpret_cast<const SpanRecord *>(static_cast<const char *>(data) + sizeof(SpanFileHeader));
+        spans.resize(header->count);
+        for (size_t i = 0; i < spans.size(); ++i) {
+            spans[i].start = records[i].start_ms;
+            spans[i].end = records[i].end_ms;
+        }
+    }
+    munmap(data, length);
+    return valid;
+}
+
+bool store_cached_spans(const std::string &cache_dir, const FileFingerprint &fingerprint,
+                        const std::vector<TimeSpan> &spans) {
+    std::vector<char> data(sizeof(SpanFileHeader) + spans.size() * sizeof(SpanRecord));
+    const SpanFileHeader header = make_header("SPAN", span_file_version, fingerprint, spans.size());
+    std::memcpy(data.data(), &header, sizeof(header));
+    SpanRecord *records = reinterpret_cast<SpanRecord *>(data.data() + sizeof(SpanFileHeader));
+    for (size_t i = 0; i < spans.size(); ++i) {
+        records[i].start_ms = static_cast<uint32_t>(std::max<int64_t>(0, spans[i].start));
+        records[i].end_ms = static_cast<uint32_t>(std::max<int64_t>(0, spans[i].end));
+    }
+    return write_cache_file(cache_dir, cache_file_path(cache_dir, fingerprint, "spans"), data.data(), data.size());
+}
+
+bool load_cached_media_info(const std::string &cache_dir, const FileFingerprint &fingerprint, MediaInfo &info) {
+    int fd = open(cache_file_path(cache_dir, fingerprint, "probe").c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    ProbeFile file;
+    const bool valid = read(fd, &file, sizeof(file)) == static_cast<ssize_t>(sizeof(file)) &&
+                       header_matches(file.header, "PROB", probe_file_version, fingerprint) && file.header.count == 1;
+    close(fd);
+    if (valid) {
+        info.frame_rate = file.frame_rate;
+        info.duration_ms = file.duration_ms;
+    }
+    return valid;
+}
+
+bool store_cached_media_info(const std::string &cache_dir, const FileFingerprint &fingerprint,
+                             const MediaInfo &info) {
+    ProbeFile file;
+    std::memset(&file, 0, sizeof(file));
+    file.header = make_header("PROB", probe_file_version, fingerprint, 1);
+    file.frame_rate = info.frame_rate;
+    file.duration_ms = info.duration_ms;
+    return write_cache_file(cache_dir, cache_file_path(cache_dir, fingerprint, "probe"),
+                            reinterpret_cast<const char *>(&file), sizeof(file));
+}
@@ -0,0 +1,31 @@
+#ifndef SPAN_CACHE_H
+#define SPAN_CACHE_H
+
+#include <string>
+#include <vector>
+#include "alignment.h"
+#include "media_probe.h"
+#include "sync_cache.h"
+
+// Speech spans of each video are kept as small binary files in one directory, named after the
+// video's fingerprint, so re-syncs skip decoding the audio again. What the video's container
+// headers said is kept next to them the same way.
+
+// The span directory that lives next to the given config file
+std::string span_cache_dir(const std::string &config_file);
+
+// Memory-maps the file for fingerprint; false when there is none or it belongs to another file version
+bool load_cached_spans(const std::string &cache_dir, const FileFingerprint &fingerprint,
+                       std::vector<TimeSpan> &spans);
+
+// Written to a temporary file and renamed into place, so readers never see half a file
+bool store_cached_spans(const std::string &cache_dir, const FileFingerprint &fingerprint,
+                        const std::vector<TimeSpan> &spans);
+
+// False when the video was never probed or has changed since; a probe that found nothing is cached too
+bool load_cached_media_info(const std::string &cache_dir, const FileFingerprint &fingerprint, MediaInfo &info);
+
+bool store_cached_media_info(const std::string &cache_dir, const FileFingerprint &fingerprint,
+                             const MediaInfo &info);
+
+#endif // SPAN_CACHE_H
@@ -0,0 +1,53 @@
+#include "stage_table_view.h"
+
+#include <cstdio>
+#include <string>
+
+enum {
+    COLUMN_STAGE,
+    COLUMN_COUNT_TEXT,
+    COLUMN_P50,
+    COLUMN_P95,
+    COLUMN_MAX,
+    COLUMN_TOTAL,
+    COLUMN_COUNT
+};
+
+static void append_text_column(GtkWidget *tree_view, const char *title, int column) {
+    GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
+    GtkTreeViewColumn *view_column = gtk_tree_view_column_new_with_attributes(title, renderer, "text", column, NULL);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(tree_view), view_column);
+}
+
+void create_stage_table_view(StageTableView &view) {
+    view.store = gtk_list_store_new(COLUMN_COUNT, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING,
+                                    G_TYPE_STRING, G_TYPE_STRING);
+    view.tree_view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(view.store));
+    g_object_unref(view.store);  // the view holds the reference now
+
+    append_text_column(view.tree_view, "Stage", COLUMN_STAGE);
+    append_text_column(view.tree_view, "Count", COLUMN_COUNT_TEXT);
+    append_text_column(view.tree_view, "p50 ms", COLUMN_P50);
+    append_text_column(view.tree_view, "p95 ms", COLUMN_P95);
+    append_text_column(view.tree_view, "Max ms", COLUMN_MAX);
+    append_text_column(view.tree_view, "Total ms", COLUMN_TOTAL);
+}
+
+static std::string format_ms(double ms) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), ms < 10.0 ? "%.2f" : "%.0f", ms);
+    return buffer;
+}
+
+void update_stage_table_view(StageTableView &view, const std::vector<TraceStageSummary> &stages) {
+    gtk_list_store_clear(view.store);
+    for (const auto &stage : stages) {
+        GtkTreeIter iter;
+        gtk_list_store_insert_with_values(view.store, &iter, -1, COLUMN_STAGE, stage.name.c_str(), COLUMN_COUNT_TEXT,
+                                          std::to_string(stage.count).c_str(), COLUMN_P50,
+                                          format_ms(stage.p50_ms).c_str(), COLUMN_P95,
+                                          format_ms(stage.p95_ms).c_str(), COLUMN_MAX,
+                                          format_ms(stage.max_ms).c_str(), COLUMN_TOTAL,
+                                          format_ms(stage.total_ms).c_str(), -1);
+    }
+}
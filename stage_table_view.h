@@ -0,0 +1,18 @@
+#ifndef STAGE_TABLE_VIEW_H
+#define STAGE_TABLE_VIEW_H
+
+#include <gtk/gtk.h>
+#include <vector>
+#include "trace.h"
+
+// Per-stage timings of the last batch: count, p50, p95, max and total
+struct StageTableView {
+    GtkWidget *tree_view = nullptr;
+    GtkListStore *store = nullptr;
+};
+
+void create_stage_table_view(StageTableView &view);
+
+void update_stage_table_view(StageTableView &view, const std::vector<TraceStageSummary> &stages);
+
+#endif // STAGE_TABLE_VIEW_H
@@ -0,0 +1,492 @@
+#include "subtitle_file.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::~MappedFile() {
+    unmap_file(*this);
+}
+
+void unmap_file(MappedFile &file) {
+    if (file.data) {
+        munmap(const_cast<char *>(file.data), file.size);
+    }
+    file.data = nullptr;
+    file.size = 0;
+}
+
+bool map_file(const std::string &path, MappedFile &file, std::string &error) {
+    unmap_file(file);
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        error = "Cannot open " + path;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        error = "Cannot read " + path;
+        return false;
+    }
+    if (info.st_size == 0) {
+        close(fd);
+        return true;
+    }
+    void *data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        error = "Cannot map " + path;
+        return false;
+    }
+    file.data = static_cast<const char *>(data);
+    file.size = static_cast<size_t>(info.st_size);
+    return true;
+}
+
+static bool valid_utf8(std::string_view bytes) {
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(bytes.data());
+    const unsigned char *end = p + bytes.size();
+    while (p < end) {
+        // Runs of ASCII are skipped eight bytes at a time
+        if (end - p >= 8) {
+            uint64_t word;
+            std::memcpy(&word, p, sizeof(word));
+            if ((word & 0x8080808080808080ULL) == 0) {
+                p += 8;
+                continue;
+            }
+        }
+        const unsigned char c = *p;
+        size_t extra = 0;
+        if (c < 0x80) {
+            ++p;
+            continue;
+        } else if (c >= 0xC2 && c <= 0xDF) {
+            extra = 1;
+        } else if ((c & 0xF0) == 0xE0) {
+            extra = 2;
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            extra = 3;
+        } else {
+            return false;
+        }
+        if (static_cast<size_t>(end - p) < extra + 1) {
+            return false;
+        }
+        for (size_t i = 1; i <= extra; ++i) {
+            if ((p[i] & 0xC0) != 0x80) {
+                return false;
+            }
+        }
+        p += extra + 1;
+    }
+    return true;
+}
+
+SubtitleEncoding detect_subtitle_encoding(std::string_view bytes) {
+    const unsigned char *b = reinterpret_cast<const unsigned char *>(bytes.data());
+    if (bytes.size() >= 3 && b[0] == 0xEF && b[1] == 0xBB && b[2] == 0xBF) {
+        return ENCODING_UTF8;
+    }
+    if (bytes.size() >= 2 && b[0] == 0xFF && b[1] == 0xFE) {
+        return ENCODING_UTF16LE;
+    }
+    if (bytes.size() >= 2 && b[0] == 0xFE && b[1] == 0xFF) {
+        return ENCODING_UTF16BE;
+    }
+    // Without a BOM, ASCII text in UTF-16 shows up as every other byte being zero
+    if (bytes.size() >= 4 && b[1] == 0 && b[3] == 0 && b[0] != 0) {
+        return ENCODING_UTF16LE;
+    }
+    if (bytes.size() >= 4 && b[0] == 0 && b[2] == 0 && b[1] != 0) {
+        return ENCODING_UTF16BE;
+    }
+    return valid_utf8(bytes) ? ENCODING_UTF8 : ENCODING_LEGACY;
+}
+
+static void append_utf8(std::string &out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+// UTF-8 with a BOM, so the rewritten file still announces a Unicode encoding
+static std::string utf16_to_utf8(std::string_view bytes, bool big_endian) {
+    const unsigned char *b = reinterpret_cast<const unsigned char *>(bytes.data());
+    auto unit = [&](size_t at) -> uint32_t {
+        return big_endian ? (uint32_t(b[at]) << 8 | b[at + 1]) : (uint32_t(b[at + 1]) << 8 | b[at]);
+    };
+    std::string out = "\xEF\xBB\xBF";
+    out.reserve(bytes.size());
+    size_t i = bytes.size() >= 2 && unit(0) == 0xFEFF ? 2 : 0;
+    for (; i + 1 < bytes.size(); i += 2) {
+        uint32_t cp = unit(i);
+        if (cp >= 0xD800 && cp < 0xDC00 && i + 3 < bytes.size()) {
+            uint32_t low = unit(i + 2);
+            if (low >= 0xDC00 && low < 0xE000) {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                i += 2;
+            }
+        }
+        append_utf8(out, cp);
+    }
+    return out;
+}
+
+// The line starting at pos without its line break; pos moves past the break
+static std::string_view next_line(std::string_view bytes, size_t &pos) {
+    const char *start = bytes.data() + pos;
+    const void *newline = std::memchr(start, '\n', bytes.size() - pos);
+    const size_t end = newline ? static_cast<size_t>(static_cast<const char *>(newline) - bytes.data()) : bytes.size();
+    std::string_view line(start, end - pos);
+    pos = newline ? end + 1 : bytes.size();
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    return line;
+}
+
+static bool read_number(std::string_view text, size_t &pos, int64_t &value, size_t &digits) {
+    value = 0;
+    digits = 0;
+    while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+        if (digits < 9) {
+            value = value * 10 + (text[pos] - '0');
+        }
+        ++pos;
+        ++digits;
+    }
+    return digits > 0;
+}
+
+// "HH:MM:SS,mmm" (SRT) or "H:MM:SS.cc" (ASS): the fraction may have any number of digits.
+// Leading blanks are skipped; token is where the timestamp itself starts and pos ends after it.
+static bool parse_timestamp(std::string_view text, size_t &pos, int64_t &time, size_t &token) {
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t')) {
+        ++pos;
+    }
+    token = pos;
+    int64_t fields[3];
+    size_t digits = 0;
+    for (int f = 0; f < 3; ++f) {
+        if (!read_number(text, pos, fields[f], digits)) {
+            return false;
+        }
+        if (f < 2) {
+            if (pos >= text.size() || text[pos] != ':') {
+                return false;
+            }
+            ++pos;
+        }
+    }
+    if (pos >= text.size() || (text[pos] != ',' && text[pos] != '.')) {
+        return false;
+    }
+    ++pos;
+    int64_t fraction = 0;
+    if (!read_number(text, pos, fraction, digits)) {
+        return false;
+    }
+    digits = std::min<size_t>(digits, 9);
+    for (size_t d = digits; d < 3; ++d) {
+        fraction *= 10;
+    }
+    for (size_t d = 3; d < digits; ++d) {
+        fraction /= 10;
+    }
+    time = ((fields[0] * 60 + fields[1]) * 60 + fields[2]) * 1000 + fraction;
+    return true;
+}
+
+static bool parse_srt_timing(std::string_view line, size_t line_pos, SubtitleCue &cue) {
+    const size_t arrow = line.find("-->");
+    if (arrow == std::string_view::npos) {
+        return false;
+    }
+    size_t pos = 0;
+    size_t token = 0;
+    if (!parse_timestamp(line.substr(0, arrow), pos, cue.span.start, token)) {
+        return false;
+    }
+    cue.start_pos = static_cast<uint32_t>(line_pos + token);
+    cue.start_length = static_cast<uint32_t>(pos - token);
+    pos = arrow + 3;
+    if (!parse_timestamp(line, pos, cue.span.end, token)) {
+        return false;
+    }
+    cue.end_pos = static_cast<uint32_t>(line_pos + token);
+    cue.end_length = static_cast<uint32_t>(pos - token);
+    return true;
+}
+
+static void parse_srt(std::string_view bytes, size_t pos, std::vector<SubtitleCue> &cues) {
+    bool in_cue = false;
+    size_t text_begin = 0;
+    size_t text_end = 0;
+    while (pos < bytes.size()) {
+        const size_t line_pos = pos;
+        std::string_view line = next_line(bytes, pos);
+        if (in_cue) {
+            if (line.find_first_not_of(" \t") == std::string_view::npos) {
+                cues.back().text = bytes.substr(text_begin, text_end - text_begin);
+                in_cue = false;
+            } else {
+                text_end = line_pos + line.size();
+            }
+            continue;
+        }
+        // Outside a cue only a timing line matters; cue numbers and junk are skipped
+        SubtitleCue cue;
+        if (parse_srt_timing(line, line_pos, cue)) {
+            cues.push_back(cue);
+            in_cue = true;
+            text_begin = pos;
+            text_end = pos;
+        }
+    }
+    if (in_cue) {
+        cues.back().text = bytes.substr(text_begin, text_end - text_begin);
+    }
+}
+
+static bool starts_with(std::string_view text, std::string_view prefix) {
+    return text.size() >= prefix.size() && text.compare(0, prefix.size(), prefix) == 0;
+}
+
+static std::string_view trim(std::string_view text) {
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+static void parse_ass(std::string_view bytes, size_t pos, std::vector<SubtitleCue> &cues) {
+    // Field positions from the [Events] Format line; these are the ASS and SSA defaults
+    bool in_events = false;
+    int start_field = 1;
+    int end_field = 2;
+    int text_field = 9;
+    while (pos < bytes.size()) {
+        const size_t line_pos = pos;
+        std::string_view line = next_line(bytes, pos);
+        if (!line.empty() && line[0] == '[') {
+            in_events = starts_with(line, "[Events]") || starts_with(line, "[events]");
+            continue;
+        }
+        if (!in_events) {
+            continue;
+        }
+
+        if (starts_with(line, "Format:")) {
+            std::string_view fields = line.substr(7);
+            int index = 0;
+            for (size_t begin = 0; begin <= fields.size(); ++index) {
+                size_t comma = std::min(fields.find(',', begin), fields.size());
+                std::string_view name = trim(fields.substr(begin, comma - begin));
+                if (name == "Start") {
+                    start_field = index;
+                } else if (name == "End") {
+                    end_field = index;
+                } else if (name == "Text") {
+                    text_field = index;
+                }
+                begin = comma + 1;
+            }
+            continue;
+        }
+        if (!starts_with(line, "Dialogue:")) {
+            continue;
+        }
+
+        // The text is the last field and may itself contain commas
+        SubtitleCue cue;
+        bool have_start = false;
+        bool have_end = false;
+        bool have_text = false;
+        size_t field_begin = 9;
+        for (int field = 0;; ++field) {
+            if (field == text_field) {
+                cue.text = bytes.substr(line_pos + field_begin, line.size() - field_begin);
+                have_text = true;
+                break;
+            }
+            const size_t comma = line.find(',', field_begin);
+            if (comma == std::string_view::npos) {
+                break;
+            }
+            if (field == start_field || field == end_field) {
+                size_t token_pos = field_begin;
+                size_t token = 0;
+                int64_t time = 0;
+                if (parse_timestamp(line.substr(0, comma), token_pos, time, token)) {
+                    const uint32_t position = static_cast<uint32_t>(line_pos + token);
+                    const uint32_t length = static_cast<uint32_t>(token_pos - token);
+                    if (field == start_field) {
+                        cue.span.start = time;
+                        cue.start_pos = position;
+                        cue.start_length = length;
+                        have_start = true;
+                    } else {
+                        cue.span.end = time;
+                        cue.end_pos = position;
+                        cue.end_length = length;
+                        have_end = true;
+                    }
+                }
+            }
+            field_begin = comma + 1;
+        }
+        if (have_start && have_end && have_text) {
+            cues.push_back(cue);
+        }
+    }
+}
+
+void parse_subtitle_bytes(std::string_view bytes, SubtitleDocument &document) {
+    document.bytes = bytes;
+    document.cues.clear();
+    size_t pos = starts_with(bytes, "\xEF\xBB\xBF") ? 3 : 0;
+    const std::string_view head = bytes.substr(0, 4096);
+    if (head.find("[Script Info]") != std::string_view::npos || head.find("[Events]") != std::string_view::npos) {
+        document.format = FORMAT_ASS;
+        parse_ass(bytes, pos, document.cues);
+    } else {
+        document.format = FORMAT_SRT;
+        parse_srt(bytes, pos, document.cues);
+    }
+}
+
+bool load_subtitle_file(const std::string &path, SubtitleDocument &document, std::string &error) {
+    document.converted.clear();
+    if (!map_file(path, document.file, error)) {
+        return false;
+    }
+    const std::string_view raw(document.file.data ? document.file.data : "", document.file.size);
+    document.encoding = detect_subtitle_encoding(raw);
+    if (document.encoding == ENCODING_UTF16LE || document.encoding == ENCODING_UTF16BE) {
+        document.converted = utf16_to_utf8(raw, document.encoding == ENCODING_UTF16BE);
+        unmap_file(document.file);
+        parse_subtitle_bytes(document.converted, document);
+    } else {
+        parse_subtitle_bytes(raw, document);
+    }
+    return true;
+}
+
+std::vector<TimeSpan> subtitle_spans(const SubtitleDocument &document) {
+    std::vector<TimeSpan> spans;
+    spans.reserve(document.cues.size());
+    for (const auto &cue : document.cues) {
+        spans.push_back(cue.span);
+    }
+    return spans;
+}
+
+static void append_digits(std::string &out, long long value, int width) {
+    char digits[24];
+    int count = 0;
+    do {
+        digits[count++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value > 0 || count < width);
+    while (count > 0) {
+        out += digits[--count];
+    }
+}
+
+// Same style as the token it replaces: SRT keeps its ',' or '.', ASS gets centiseconds
+static void append_timestamp(std::string &out, SubtitleFormat format, std::string_view original, int64_t time) {
+    const long long ms = std::max<int64_t>(0, time);
+    if (format == FORMAT_ASS) {
+        const long long cs = (ms + 5) / 10;
+        append_digits(out, cs / 360000, 1);
+        out += ':';
+        append_digits(out, cs / 6000 % 60, 2);
+        out += ':';
+        append_digits(out, cs / 100 % 60, 2);
+        out += '.';
+        append_digits(out, cs % 100, 2);
+    } else {
+        append_digits(out, ms / 3600000, 2);
+        out += ':';
+        append_digits(out, ms / 60000 % 60, 2);
+        out += ':';
+        append_digits(out, ms / 1000 % 60, 2);
+        out += original.find('.') != std::string_view::npos ? '.' : ',';
+        append_digits(out, ms % 1000, 3);
+    }
+}
+
+std::string render_retimed_subtitle(const SubtitleDocument &document, const std::vector<TimeSpan> &spans) {
+    const std::string_view bytes = document.bytes;
+    std::string out;
+    out.reserve(bytes.size() + 64);
+    size_t copied = 0;
+    auto replace = [&](uint32_t pos, uint32_t length, int64_t time) {
+        out.append(bytes.substr(copied, pos - copied));
+        append_timestamp(out, document.format, bytes.substr(pos, length), time);
+        copied = pos + length;
+    };
+    for (size_t i = 0; i < document.cues.size() && i < spans.size(); ++i) {
+        const SubtitleCue &cue = document.cues[i];
+        if (cue.start_pos < cue.end_pos) {
+            replace(cue.start_pos, cue.start_length, spans[i].start);
+            replace(cue.end_pos, cue.end_length, spans[i].end);
+        } else {
+            replace(cue.end_pos, cue.end_length, spans[i].end);
+            replace(cue.start_pos, cue.start_length, spans[i].start);
+        }
+    }
+    out.append(bytes.substr(copied));
+    return out;
+}
+
+bool write_retimed_subtitle(const std::string &path, const SubtitleDocument &document,
+                            const std::vector<TimeSpan> &spans, std::string &error) {
+    const std::string data = render_retimed_subtitle(document, spans);
+    // Written beside the target and renamed over it once on disk, so a crash never leaves half a subtitle
+    static std::atomic<unsigned int> next_temp{0};
+    const std::string temp_path = path + ".partial-" + std::to_string(getpid()) + "-" + std::to_string(next_temp++);
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (fd == -1) {
+        error = "Cannot write " + path;
+        return false;
+    }
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t count = write(fd, data.data() + written, data.size() - written);
+        if (count <= 0) {
+            break;
+        }
+        written += static_cast<size_t>(count);
+    }
+    const bool synced = written == data.size() && fdatasync(fd) == 0;
+    close(fd);
+    if (!synced || rename(temp_path.c_str(), path.c_str()) != 0) {
+        unlink(temp_path.c_str());
+        error = "Cannot write " + path;
+        return false;
+    }
+    return true;
+}
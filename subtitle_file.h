@@ -0,0 +1,72 @@
+#ifndef SUBTITLE_FILE_H
+#define SUBTITLE_FILE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "alignment.h"
+
+// A file mapped read-only for as long as the struct lives
+struct MappedFile {
+    const char *data = nullptr;
+    size_t size = 0;
+
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile();
+};
+
+bool map_file(const std::string &path, MappedFile &file, std::string &error);
+void unmap_file(MappedFile &file);
+
+enum SubtitleFormat { FORMAT_SRT, FORMAT_ASS };  // FORMAT_ASS covers SSA too
+
+enum SubtitleEncoding {
+    ENCODING_UTF8,     // also plain ASCII
+    ENCODING_UTF16LE,  // re-encoded to UTF-8 on load, the only case that copies the text
+    ENCODING_UTF16BE,
+    ENCODING_LEGACY    // some 8-bit code page; bytes are kept as they are
+};
+
+// One cue. The text and both timestamp tokens point into the document's bytes, nothing is copied.
+struct SubtitleCue {
+    TimeSpan span;
+    uint32_t start_pos = 0;  // timestamp tokens, as byte ranges, so the writer can replace just them
+    uint32_t start_length = 0;
+    uint32_t end_pos = 0;
+    uint32_t end_length = 0;
+    std::string_view text;
+};
+
+// A parsed subtitle file. Loading another file into the same document reuses the cue storage, so a
+// worker parsing a whole season allocates the cue arena only once.
+struct SubtitleDocument {
+    SubtitleFormat format = FORMAT_SRT;
+    SubtitleEncoding encoding = ENCODING_UTF8;
+    MappedFile file;
+    std::string converted;   // UTF-8 copy of UTF-16 input
+    std::string_view bytes;  // the mapped file or the converted copy; cues point in here
+    std::vector<SubtitleCue> cues;
+};
+
+SubtitleEncoding detect_subtitle_encoding(std::string_view bytes);
+
+// Parse bytes in place; the document only keeps views into them
+void parse_subtitle_bytes(std::string_view bytes, SubtitleDocument &document);
+
+// Map path and parse it; SRT or ASS/SSA is told from the content. Cues without a readable timing are skipped.
+bool load_subtitle_file(const std::string &path, SubtitleDocument &document, std::string &error);
+
+std::vector<TimeSpan> subtitle_spans(const SubtitleDocument &document);
+
+// The document's bytes with only the timestamps replaced by spans (one per cue, negative times clamp to
+// zero); everything else is copied verbatim. UTF-16 input is written back as UTF-8 with a BOM.
+std::string render_retimed_subtitle(const SubtitleDocument &document, const std::vector<TimeSpan> &spans);
+
+// The file appears complete or not at all: it is written under a temporary name and renamed into place
+bool write_retimed_subtitle(const std::string &path, const SubtitleDocument &document,
+                            const std::vector<TimeSpan> &spans, std::string &error);
+
+#endif // SUBTITLE_FILE_H
@@ -0,0 +1,177 @@
+#include "sync_cache.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "nlohmann/json.hpp"
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+// Bytes hashed from each end of a file
+static const size_t fingerprint_block = 64 * 1024;
+
+static uint64_t fnv1a(const unsigned char *data, size_t size, uint64_t hash) {
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool stat_file(const std::string &path, uint64_t &size, int64_t &mtime_ns) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+        return false;
+    }
+    size = static_cast<uint64_t>(info.st_size);
+    mtime_ns = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    return true;
+}
+
+bool fingerprint_file(const std::string &path, FileFingerprint &fingerprint) {
+    if (!stat_file(path, fingerprint.size, fingerprint.mtime_ns)) {
+        return false;
+    }
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+
+    std::vector<unsigned char> buffer(fingerprint_block);
+    uint64_t hash = fnv1a(reinterpret_cast<const unsigned char *>(&fingerprint.size), sizeof(fingerprint.size),
+                          14695981039346656037ULL);
+    ssize_t head = pread(fd, buffer.data(), buffer.size(), 0);
+    if (head > 0) {
+        hash = fnv1a(buffer.data(), static_cast<size_t>(head), hash);
+    }
+    if (fingerprint.size > fingerprint_block) {
+        off_t tail_offset = static_cast<off_t>(fingerprint.size - fingerprint_block);
+        ssize_t tail = pread(fd, buffer.data(), buffer.size(), tail_offset);
+        if (tail > 0) {
+            hash = fnv1a(buffer.data(), static_cast<size_t>(tail), hash);
+        }
+    }
+    close(fd);
+
+    fingerprint.hash = hash;
+    return head >= 0;
+}
+
+std::string sync_cache_key(const FileFingerprint &video, const FileFingerprint &subtitle,
+                           const AlignmentOptions &options, const std::string &output_file) {
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "%016llx.%016llx.%llx.%llx:%g:%d:%d", static_cast<unsigned long long>(video.hash),
+             static_cast<unsigned long long>(subtitle.hash), static_cast<unsigned long long>(video.mtime_ns),
+             static_cast<unsigned long long>(subtitle.mtime_ns), options.split_penalty,
+             options.disable_fps_guessing ? 1 : 0, static_cast<int>(options.engine));
+    std::string key = buffer;
+    for (double penalty : options.penalty_sweep) {
+        snprintf(buffer, sizeof(buffer), ",%g", penalty);
+        key += buffer;
+    }
+    return key + "|" + output_file;
+}
+
+std::string sync_cache_path(const std::string &config_file) {
+    return (fs::path(config_file).parent_path() / "sync_cache.json").string();
+}
+
+void load_sync_cache(SyncCache &cache, const std::string &path) {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.path = path;
+    cache.entries.clear();
+    cache.dirty = false;
+
+    std::ifstream file(path);
+    if (!file) {
+        return;
+    }
+    json data;
+    try {
+        file >> data;
+    } catch (const json::parse_error &) {
+        return;
+    }
+    if (!data.contains("entries") || !data["entries"].is_object()) {
+        return;
+    }
+    for (const auto &item : data["entries"].items()) {
+        const json &value = item.value();
+        if (!value.contains("output") || !value["output"].is_string() || !value.contains("size") ||
+            !value.contains("mtime")) {
+            continue;
+        }
+        SyncCacheEntry entry;
+        entry.output_file = value["output"].get<std::string>();
+        entry.output_size = value["size"].get<uint64_t>();
+        entry.output_mtime_ns = value["mtime"].get<int64_t>();
+        cache.entries.emplace(item.key(), entry);
+    }
+}
+
+bool save_sync_cache(SyncCache &cache) {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if (!cache.dirty || cache.path.empty()) {
+        return true;
+    }
+
+    json entries = json::object();
+    for (const auto &item : cache.entries) {
+        entries[item.first] = {
+            {"output", item.second.output_file},
+            {"size", item.second.output_size},
+            {"mtime", item.second.output_mtime_ns}
+        };
+    }
+    json data = {{"version", 1}, {"entries", entries}};
+
+    // Write a sibling file and rename it over, so a crash never leaves a truncated cache
+    const std::string temp_path = cache.path + ".tmp";
+    {
+        std::ofstream file(temp_path);
+        file << data.dump(1);
+        if (!file) {
+            return false;
+        }
+    }
+    if (std::rename(temp_path.c_str(), cache.path.c_str()) != 0) {
+        return false;
+    }
+    cache.dirty = false;
+    return true;
+}
+
+bool sync_cache_lookup(SyncCache &cache, const std::string &key, const std::string &output_file) {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    auto it = cache.entries.find(key);
+    if (it == cache.entries.end() || it->second.output_file != output_file) {
+        return false;
+    }
+
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    if (!stat_file(output_file, size, mtime_ns) || size != it->second.output_size ||
+        mtime_ns != it->second.output_mtime_ns) {
+        // The output was removed or edited since, so the entry is no use anymore
+        cache.entries.erase(it);
+        cache.dirty = true;
+        return false;
+    }
+    return true;
+}
+
+void sync_cache_store(SyncCache &cache, const std::string &key, const std::string &output_file) {
+    SyncCacheEntry entry;
+    entry.output_file = output_file;
+    if (!stat_file(output_file, entry.output_size, entry.output_mtime_ns)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.entries[key] = entry;
+    cache.dirty = true;
+}
@@ -0,0 +1,60 @@
+#ifndef SYNC_CACHE_H
+#define SYNC_CACHE_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Cheap identity of a file: size, mtime and a hash of its first and last blocks
+struct FileFingerprint {
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    uint64_t hash = 0;
+};
+
+// Which aligner runs a job: an alass process, or the built-in one when it can read the inputs. The
+// built-in aligner is opt-in until its results have been compared against alass on a real library.
+enum AlignmentEngine { ENGINE_NATIVE, ENGINE_ALASS };
+
+// Options that change what the aligner writes, so they are part of the cache key
+struct AlignmentOptions {
+    double split_penalty = 7.0;  // 0 = one constant offset (native engine)
+    bool disable_fps_guessing = false;
+    AlignmentEngine engine = ENGINE_ALASS;
+    std::vector<double> penalty_sweep;  // native engine: try each and keep the best instead of split_penalty
+};
+
+struct SyncCacheEntry {
+    std::string output_file;
+    uint64_t output_size = 0;
+    int64_t output_mtime_ns = 0;
+};
+
+// Results of earlier successful jobs, persisted as JSON; safe to share between worker threads
+struct SyncCache {
+    std::string path;
+    std::mutex mutex;
+    std::unordered_map<std::string, SyncCacheEntry> entries;
+    bool dirty = false;
+};
+
+bool fingerprint_file(const std::string &path, FileFingerprint &fingerprint);
+
+// Identifies one job: both inputs, the options and where the result goes
+std::string sync_cache_key(const FileFingerprint &video, const FileFingerprint &subtitle,
+                           const AlignmentOptions &options, const std::string &output_file);
+
+// The cache file that lives next to the given config file
+std::string sync_cache_path(const std::string &config_file);
+
+// A missing or unreadable cache file leaves the cache empty
+void load_sync_cache(SyncCache &cache, const std::string &path);
+bool save_sync_cache(SyncCache &cache);
+
+// True when key was synced to output_file before and that output is still on disk unchanged
+bool sync_cache_lookup(SyncCache &cache, const std::string &key, const std::string &output_file);
+void sync_cache_store(SyncCache &cache, const std::string &key, const std::string &output_file);
+
+#endif // SYNC_CACHE_H
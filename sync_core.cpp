@@ -0,0 +1,243 @@
+#include "sync_core.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include "episode_pattern.h"
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+const char *const synced_output_prefix = "synced_";
+
+// String entries of a JSON array, anything else is skipped
+static std::vector<std::string> read_string_list(const json &list) {
+    std::vector<std::string> values;
+    for (const auto &item : list) {
+        if (item.is_string()) {
+            values.push_back(item.get<std::string>());
+        }
+    }
+    return values;
+}
+
+template <typename T>
+static void read_integer(const json &config, const char *key, T &value) {
+    if (config.contains(key) && config[key].is_number_integer()) {
+        value = config[key].get<T>();
+    }
+}
+
+static void read_string(const json &config, const char *key, std::string &value) {
+    if (config.contains(key) && config[key].is_string()) {
+        value = config[key].get<std::string>();
+    }
+}
+
+static void read_bool(const json &config, const char *key, bool &value) {
+    if (config.contains(key) && config[key].is_boolean()) {
+        value = config[key].get<bool>();
+    }
+}
+
+void read_sync_settings(const json &config, SyncSettings &settings) {
+    read_integer(config, "worker_count", settings.worker_count);
+    read_integer(config, "memory_budget_mb", settings.memory_budget_mb);
+    read_integer(config, "hdd_jobs_per_device", settings.hdd_jobs_per_device);
+    read_bool(config, "adaptive_workers", settings.adaptive_workers);
+    if (config.contains("video_extensions") && config["video_extensions"].is_array()) {
+        settings.video_extensions = normalize_extensions(read_string_list(config["video_extensions"]));
+    }
+    if (config.contains("subtitle_extensions") && config["subtitle_extensions"].is_array()) {
+        settings.subtitle_extensions = normalize_extensions(read_string_list(config["subtitle_extensions"]));
+    }
+    read_integer(config, "scan_depth", settings.scan_depth);
+    read_integer(config, "scan_threads", settings.scan_threads);
+    if (config.contains("split_penalty_sweep") && config["split_penalty_sweep"].is_array()) {
+        std::vector<double> penalties;
+        for (const auto &item : config["split_penalty_sweep"]) {
+            if (item.is_number() && item.get<double>() >= 0.0) {
+                penalties.push_back(item.get<double>());
+            }
+        }
+        if (!penalties.empty()) {
+            settings.penalty_sweep = penalties;
+        }
+    }
+    read_string(config, "trace_file", settings.trace_file);
+}
+
+void write_sync_settings(const SyncSettings &settings, json &config) {
+    config["worker_count"] = settings.worker_count;
+    config["memory_budget_mb"] = settings.memory_budget_mb;
+    config["hdd_jobs_per_device"] = settings.hdd_jobs_per_device;
+    config["adaptive_workers"] = settings.adaptive_workers;
+    config["video_extensions"] = settings.video_extensions;
+    config["subtitle_extensions"] = settings.subtitle_extensions;
+    config["scan_depth"] = settings.scan_depth;
+    config["scan_threads"] = settings.scan_threads;
+    config["split_penalty_sweep"] = settings.penalty_sweep;
+    config["trace_file"] = settings.trace_file;
+}
+
+void read_sync_request(const json &config, SyncRequest &request) {
+    read_string(config, "video_folder", request.video_folder);
+    read_string(config, "srt_folder", request.srt_folder);
+    read_string(config, "video_regex", request.video_regex);
+    read_string(config, "subtitle_regex", request.subtitle_regex);
+    read_integer(config, "video_match_index", request.video_match_index);
+    read_integer(config, "subtitle_match_index", request.subtitle_match_index);
+    read_string(config, "reference_regex", request.reference_regex);
+    read_bool(config, "match_full_path", request.match_full_path);
+    if (config.contains("split_penalty") && config["split_penalty"].is_number()) {
+        request.alignment.split_penalty = config["split_penalty"].get<double>();
+    }
+    if (config.contains("disable_fps_guessing") && config["disable_fps_guessing"].is_boolean()) {
+        request.alignment.disable_fps_guessing = config["disable_fps_guessing"].get<bool>();
+    }
+    if (config.contains("alignment_engine") && config["alignment_engine"].is_string()) {
+        request.alignment.engine = config["alignment_engine"] == "native" ? ENGINE_NATIVE : ENGINE_ALASS;
+    }
+    if (config.contains("sweep_split_penalty") && config["sweep_split_penalty"].is_boolean()) {
+        request.sweep_split_penalty = config["sweep_split_penalty"].get<bool>();
+    }
+    read_sync_settings(config, request.settings);
+    request.alignment.penalty_sweep = sweep_penalties(request);
+}
+
+std::vector<double> sweep_penalties(const SyncRequest &request) {
+    if (!request.sweep_split_penalty || request.alignment.engine != ENGINE_NATIVE) {
+        return std::vector<double>();
+    }
+    return request.settings.penalty_sweep;
+}
+
+bool parse_penalty_list(const std::string &text, std::vector<double> &penalties) {
+    penalties.clear();
+    size_t begin = 0;
+    while (begin <= text.size()) {
+        size_t end = text.find(',', begin);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        const std::string item = text.substr(begin, end - begin);
+        char *parsed_end = nullptr;
+        double penalty = std::strtod(item.c_str(), &parsed_end);
+        if (item.empty() || *parsed_end != '\0' || penalty < 0.0) {
+            return false;
+        }
+        penalties.push_back(penalty);
+        begin = end + 1;
+    }
+    return !penalties.empty();
+}
+
+ScanOptions make_scan_options(const SyncSettings &settings, bool video_side) {
+    ScanOptions options;
+    options.max_depth = settings.scan_depth;
+    options.thread_count = settings.scan_threads > 0 ? settings.scan_threads : 0;
+    options.extensions = video_side ? settings.video_extensions : settings.subtitle_extensions;
+    return options;
+}
+
+FileCatalog scan_folder(const std::string &folder, const ScanOptions &options, std::vector<ScanError> *errors) {
+    FileCatalog files;
+    ScanControl control;
+    scan_directory(folder, options, control, [&](ScanBatch batch) {
+        append_catalog(files, batch.files);
+        if (errors) {
+            errors->insert(errors->end(), batch.errors.begin(), batch.errors.end());
+        }
+    });
+    return files;
+}
+
+std::vector<EpisodeKey> extract_library_keys(const SyncRequest &request, const FileCatalog &files, bool video_side) {
+    if (video_side) {
+        return extract_episode_keys(files, request.video_regex, request.video_match_index, request.match_full_path);
+    }
+    std::vector<EpisodeKey> keys = extract_episode_keys(files, request.subtitle_regex, request.subtitle_match_index,
+                                                        request.match_full_path);
+    for (size_t i = 0; i < files.size(); ++i) {
+        const std::string_view name = catalog_file_name(files.path(i));
+        if (name.compare(0, std::strlen(synced_output_prefix), synced_output_prefix) == 0) {
+            keys[i] = EpisodeKey();
+        }
+    }
+    return keys;
+}
+
+std::vector<bool> find_trusted_subtitles(const SyncRequest &request, const FileCatalog &subtitles) {
+    std::vector<bool> trusted;
+    if (request.reference_regex.empty()) {
+        return trusted;
+    }
+    std::shared_ptr<const EpisodePattern> pattern = compile_episode_pattern(request.reference_regex);
+    if (!pattern) {
+        return trusted;
+    }
+    trusted.resize(subtitles.size());
+    for (size_t i = 0; i < subtitles.size(); ++i) {
+        std::string_view found;
+        const std::string_view text =
+            request.match_full_path ? subtitles.path(i) : catalog_file_name(subtitles.path(i));
+        trusted[i] = find_episode_match(*pattern, text, 1, found);
+    }
+    return trusted;
+}
+
+MatchedLibrary pair_library(std::vector<EpisodeKey> video_keys, std::vector<EpisodeKey> subtitle_keys,
+                            std::vector<bool> trusted) {
+    MatchedLibrary library;
+    library.video_keys = std::move(video_keys);
+    library.subtitle_keys = std::move(subtitle_keys);
+    library.trusted = std::move(trusted);
+    const auto valid = [](const EpisodeKey &key) { return key.valid(); };
+    library.video_matches = std::count_if(library.video_keys.begin(), library.video_keys.end(), valid);
+    library.subtitle_matches = std::count_if(library.subtitle_keys.begin(), library.subtitle_keys.end(), valid);
+    library.match = match_episodes(library.video_keys, library.subtitle_keys, library.trusted);
+    return library;
+}
+
+MatchedLibrary match_library(const SyncRequest &request, const FileCatalog &videos, const FileCatalog &subtitles) {
+    return pair_library(extract_library_keys(request, videos, true), extract_library_keys(request, subtitles, false),
+                        find_trusted_subtitles(request, subtitles));
+}
+
+std::vector<SyncJob> build_sync_jobs(const SyncRequest &request, const FileCatalog &videos,
+                                     const FileCatalog &subtitles, const MatchedLibrary &library) {
+    const fs::path video_folder = request.video_folder;
+    const fs::path srt_folder = request.srt_folder;
+    std::vector<SyncJob> jobs;
+    jobs.reserve(library.match.pairs);
+    for (size_t i = 0; i < videos.size(); ++i) {
+        const uint32_t partner = library.match.video_partners[i];
+        if (partner == no_partner) {
+            continue;
+        }
+        const fs::path subtitle = srt_folder / subtitles.path(partner);
+        SyncJob job;
+        job.video_file = (video_folder / videos.path(i)).string();
+        job.subtitle_file = subtitle.string();
+        job.output_file = (subtitle.parent_path() / (synced_output_prefix + format_episode_key(library.video_keys[i]) +
+                                                     subtitle.extension().string()))
+                              .string();
+        const uint32_t reference = library.match.video_references[i];
+        if (reference != no_partner) {
+            job.reference_file = (srt_folder / subtitles.path(reference)).string();
+        }
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+BatchSettings make_batch_settings(const SyncRequest &request) {
+    BatchSettings settings;
+    settings.worker_count = resolve_worker_count(request.settings.worker_count);
+    settings.memory_budget = static_cast<uint64_t>(std::max(0, request.settings.memory_budget_mb)) << 20;
+    settings.hdd_jobs = static_cast<unsigned int>(std::max(0, request.settings.hdd_jobs_per_device));
+    settings.adaptive = request.settings.adaptive_workers;
+    settings.alignment = request.alignment;
+    return settings;
+}
@@ -0,0 +1,95 @@
+#ifndef SYNC_CORE_H
+#define SYNC_CORE_H
+
+#include <string>
+#include <vector>
+#include "alignment.h"
+#include "directory_scanner.h"
+#include "episode_matcher.h"
+#include "job_scheduler.h"
+#include "nlohmann/json.hpp"
+
+// Config values without a widget of their own; shared by the GUI and the batch CLI
+struct SyncSettings {
+    int worker_count = 0;  // 0 = use the hardware concurrency
+    int memory_budget_mb = 0;     // estimated memory of the running jobs together, 0 = unlimited
+    int hdd_jobs_per_device = 2;  // 0 = as many as workers
+    bool adaptive_workers = true;
+    std::vector<std::string> video_extensions = default_video_extensions();
+    std::vector<std::string> subtitle_extensions = default_subtitle_extensions();
+    int scan_depth = 8;    // negative = unlimited
+    int scan_threads = 0;  // 0 = use the hardware concurrency
+    std::vector<double> penalty_sweep = default_penalty_sweep();
+    std::string trace_file;  // Chrome trace of each batch is written here, empty = no export
+};
+
+// Everything one scan/match/sync run needs, whether it comes from the widgets, flags or a manifest
+struct SyncRequest {
+    std::string video_folder;
+    std::string srt_folder;
+    std::string video_regex = "\\d+";
+    std::string subtitle_regex = "\\d+";
+    int video_match_index = 1;
+    int subtitle_match_index = 1;
+    std::string reference_regex;  // subtitles it finds are trusted, already synced tracks; empty = none
+    bool match_full_path = false;  // the patterns see the path below the folder rather than the file name
+    bool sweep_split_penalty = false;  // alignment.penalty_sweep follows this, see sweep_penalties
+    AlignmentOptions alignment;
+    SyncSettings settings;
+};
+
+// Keys and pairs of the scanned files of both folders, as columns parallel to their catalogs; the
+// catalogs stay with the caller
+struct MatchedLibrary {
+    std::vector<EpisodeKey> video_keys;
+    std::vector<EpisodeKey> subtitle_keys;
+    std::vector<bool> trusted;  // per subtitle
+    EpisodeMatch match;
+    size_t video_matches = 0;  // files with a valid key
+    size_t subtitle_matches = 0;
+};
+
+// Read the known keys of a sync_config.json style object; missing or mistyped keys are left alone
+void read_sync_settings(const nlohmann::json &config, SyncSettings &settings);
+void write_sync_settings(const SyncSettings &settings, nlohmann::json &config);
+void read_sync_request(const nlohmann::json &config, SyncRequest &request);
+
+// The penalties a sweep tries, empty unless one is asked for with the native engine; alass takes a single
+// penalty, so a sweep kept for it would only change the cache keys
+std::vector<double> sweep_penalties(const SyncRequest &request);
+
+// Parse a comma separated list of penalties such as "1,7,30"
+bool parse_penalty_list(const std::string &text, std::vector<double> &penalties);
+
+ScanOptions make_scan_options(const SyncSettings &settings, bool video_side);
+
+// Full synchronous scan of one folder, errors are appended to errors when given
+FileCatalog scan_folder(const std::string &folder, const ScanOptions &options, std::vector<ScanError> *errors);
+
+// Name prefix of the files written by the sync jobs
+extern const char *const synced_output_prefix;
+
+// The key column of one side under the request's pattern. Earlier sync outputs sitting in the subtitle
+// folder get no key, so they are never used as inputs.
+std::vector<EpisodeKey> extract_library_keys(const SyncRequest &request, const FileCatalog &files, bool video_side);
+
+// Which subtitles the request's reference pattern finds, searched for in their names or paths like the
+// episode patterns; empty when there is no pattern or it is invalid
+std::vector<bool> find_trusted_subtitles(const SyncRequest &request, const FileCatalog &subtitles);
+
+// Pair two key columns extracted with extract_library_keys
+MatchedLibrary pair_library(std::vector<EpisodeKey> video_keys, std::vector<EpisodeKey> subtitle_keys,
+                            std::vector<bool> trusted);
+
+// Extract keys from both catalogs and pair them
+MatchedLibrary match_library(const SyncRequest &request, const FileCatalog &videos, const FileCatalog &subtitles);
+
+// One job per pair, with full paths; the output is written next to the subtitle. A pair with a trusted
+// subtitle of its episode is aligned against that instead of the video.
+std::vector<SyncJob> build_sync_jobs(const SyncRequest &request, const FileCatalog &videos,
+                                     const FileCatalog &subtitles, const MatchedLibrary &library);
+
+// Scheduler settings from the config; the cache and span cache directory are left to the caller
+BatchSettings make_batch_settings(const SyncRequest &request);
+
+#endif // SYNC_CORE_H
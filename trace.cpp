@@ -0,0 +1,174 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include "nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+std::atomic<bool> trace_on{false};
+
+// Events kept per thread between collects; past this the oldest are overwritten
+static const size_t max_thread_events = 1 << 16;
+
+// Events of one thread. Only its own thread appends, so the mutex is only contended while collecting.
+struct ThreadTrace {
+    uint32_t id = 0;
+    std::string name;
+    std::mutex mutex;
+    std::vector<TraceEvent> events;  // a ring once full, next is the slot to overwrite
+    size_t next = 0;
+};
+
+struct TraceRegistry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadTrace>> threads;
+    uint32_t next_id = 1;
+};
+
+static TraceRegistry &registry() {
+    static TraceRegistry instance;
+    return instance;
+}
+
+static ThreadTrace &thread_trace() {
+    thread_local std::shared_ptr<ThreadTrace> trace;
+    if (!trace) {
+        trace = std::make_shared<ThreadTrace>();
+        TraceRegistry &all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        trace->id = all.next_id++;
+        trace->name = "thread " + std::to_string(trace->id);
+        all.threads.push_back(trace);
+    }
+    return *trace;
+}
+
+void trace_enable(bool enabled) {
+    trace_on.store(enabled, std::memory_order_relaxed);
+}
+
+int64_t trace_now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void trace_record(const char *name, int64_t start_us, int64_t duration_us) {
+    if (!trace_enabled()) {
+        return;
+    }
+    ThreadTrace &trace = thread_trace();
+    std::lock_guard<std::mutex> lock(trace.mutex);
+    if (trace.events.size() < max_thread_events) {
+        trace.events.push_back({name, trace.id, start_us, duration_us});
+    } else {
+        trace.events[trace.next] = {name, trace.id, start_us, duration_us};
+        trace.next = (trace.next + 1) % max_thread_events;
+    }
+}
+
+void trace_set_thread_name(const std::string &name) {
+    if (!trace_enabled()) {
+        return;
+    }
+    ThreadTrace &trace = thread_trace();
+    std::lock_guard<std::mutex> lock(trace.mutex);
+    trace.name = name;
+}
+
+std::vector<TraceEvent> trace_collect(bool clear) {
+    std::vector<TraceEvent> events;
+    TraceRegistry &all = registry();
+    std::lock_guard<std::mutex> lock(all.mutex);
+    if (clear) {
+        // Lanes of exited threads (no other reference) go once a previous collect has drained them,
+        // so their names are still there for exporting what that collect returned
+        all.threads.erase(std::remove_if(all.threads.begin(), all.threads.end(),
+                                         [](const std::shared_ptr<ThreadTrace> &trace) {
+                                             return trace.use_count() == 1 && trace->events.empty();
+                                         }),
+                          all.threads.end());
+    }
+    for (const auto &trace : all.threads) {
+        std::lock_guard<std::mutex> thread_lock(trace->mutex);
+        events.insert(events.end(), trace->events.begin(), trace->events.end());
+        if (clear) {
+            trace->events.clear();
+            trace->next = 0;
+        }
+    }
+    // Parents before the spans nested in them, as trace viewers expect
+    std::sort(events.begin(), events.end(), [](const TraceEvent &a, const TraceEvent &b) {
+        return a.start_us != b.start_us ? a.start_us < b.start_us : a.duration_us > b.duration_us;
+    });
+    return events;
+}
+
+// Nearest-rank percentile of sorted durations
+static double percentile_ms(const std::vector<int64_t> &sorted, double fraction) {
+    size_t rank = static_cast<size_t>(fraction * sorted.size() + 0.999999);
+    rank = std::min(std::max<size_t>(rank, 1), sorted.size());
+    return sorted[rank - 1] / 1000.0;
+}
+
+std::vector<TraceStageSummary> summarize_trace(const std::vector<TraceEvent> &events) {
+    std::map<std::string, std::vector<int64_t>> durations;
+    for (const auto &event : events) {
+        durations[event.name].push_back(event.duration_us);
+    }
+    std::vector<TraceStageSummary> summary;
+    for (auto &stage : durations) {
+        std::vector<int64_t> &sorted = stage.second;
+        std::sort(sorted.begin(), sorted.end());
+        TraceStageSummary row;
+        row.name = stage.first;
+        row.count = sorted.size();
+        for (int64_t duration : sorted) {
+            row.total_ms += duration / 1000.0;
+        }
+        row.p50_ms = percentile_ms(sorted, 0.50);
+        row.p95_ms = percentile_ms(sorted, 0.95);
+        row.max_ms = sorted.back() / 1000.0;
+        summary.push_back(row);
+    }
+    // Biggest consumers first
+    std::sort(summary.begin(), summary.end(),
+              [](const TraceStageSummary &a, const TraceStageSummary &b) { return a.total_ms > b.total_ms; });
+    return summary;
+}
+
+bool write_chrome_trace(const std::string &path, const std::vector<TraceEvent> &events, std::string &error) {
+    json trace_events = json::array();
+    {
+        TraceRegistry &all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        for (const auto &trace : all.threads) {
+            std::lock_guard<std::mutex> thread_lock(trace->mutex);
+            trace_events.push_back(
+                {{"name", "thread_name"}, {"ph", "M"}, {"pid", 1}, {"tid", trace->id}, {"args", {{"name", trace->name}}}});
+        }
+    }
+    const int64_t origin = events.empty() ? 0 : events.front().start_us;
+    for (const auto &event : events) {
+        trace_events.push_back({{"name", event.name},
+                                {"cat", "sync"},
+                                {"ph", "X"},
+                                {"pid", 1},
+                                {"tid", event.thread},
+                                {"ts", event.start_us - origin},
+                                {"dur", event.duration_us}});
+    }
+
+    std::ofstream file(path);
+    file << json{{"traceEvents", trace_events}, {"displayTimeUnit", "ms"}}.dump();
+    if (!file.flush()) {
+        error = "Cannot write " + path;
+        return false;
+    }
+    return true;
+}
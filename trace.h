@@ -0,0 +1,73 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One finished span; times are microseconds on the steady clock
+struct TraceEvent {
+    const char *name;  // a string literal, stage names are never copied
+    uint32_t thread;   // lane in the exported trace
+    int64_t start_us;
+    int64_t duration_us;
+};
+
+// p50/p95 of one stage over the collected events
+struct TraceStageSummary {
+    std::string name;
+    size_t count = 0;
+    double total_ms = 0.0;
+    double p50_ms = 0.0;
+    double p95_ms = 0.0;
+    double max_ms = 0.0;
+};
+
+extern std::atomic<bool> trace_on;
+
+// Off by default; while off a TRACE_SCOPE costs one relaxed load and records nothing
+void trace_enable(bool enabled);
+
+inline bool trace_enabled() {
+    return trace_on.load(std::memory_order_relaxed);
+}
+
+int64_t trace_now_us();
+
+// Record a span directly, for stages that don't map onto a C++ scope such as time spent queued
+void trace_record(const char *name, int64_t start_us, int64_t duration_us);
+
+// Name the calling thread's lane, e.g. "worker 2"; only kept while tracing is on
+void trace_set_thread_name(const std::string &name);
+
+// Events of every thread sorted by start time, at most the latest 65536 per thread; clear drops them so the
+// next collect starts fresh
+std::vector<TraceEvent> trace_collect(bool clear);
+
+std::vector<TraceStageSummary> summarize_trace(const std::vector<TraceEvent> &events);
+
+// Chrome trace-event JSON (chrome://tracing, Perfetto), one lane per thread
+bool write_chrome_trace(const std::string &path, const std::vector<TraceEvent> &events, std::string &error);
+
+struct TraceScope {
+    const char *name;
+    int64_t start_us;
+
+    explicit TraceScope(const char *name) : name(name), start_us(trace_enabled() ? trace_now_us() : -1) {
+    }
+    ~TraceScope() {
+        if (start_us >= 0) {
+            trace_record(name, start_us, trace_now_us() - start_us);
+        }
+    }
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+// Time the rest of the enclosing scope as stage name
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+#endif // TRACE_H
@@ -0,0 +1,193 @@
+#include "voice_activity.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static const size_t frame_samples = vad_sample_rate / 100;  // 10 ms
+static const int64_t frame_ms = 10;
+static const double speech_margin_db = 9.0;   // above the noise floor
+static const double min_speech_db = 30.0;     // never speech below this, however quiet the floor
+static const int open_frames = 3;             // speech frames in a row that start a span
+static const int close_frames = 25;           // silent frames in a row that end one
+static const int64_t min_span_frames = 10;
+
+static void close_span(VoiceActivityState &state) {
+    const int64_t end = state.last_speech + 1;
+    if (end - state.open_start >= min_span_frames) {
+        state.spans.push_back({state.open_start * frame_ms, end * frame_ms});
+    }
+    state.open_start = -1;
+    state.silence_run = 0;
+}
+
+static void process_frame(VoiceActivityState &state) {
+    // Pre-emphasis keeps low rumble and music bass from reading as speech
+    double energy = 0.0;
+    for (int16_t sample : state.frame) {
+        double emphasized = sample - 0.97 * state.last_sample;
+        state.last_sample = sample;
+        energy += emphasized * emphasized;
+    }
+    const double db = 10.0 * std::log10(energy / state.frame.size() + 1.0);
+
+    // The floor follows quiet passages down quickly and creeps back up at about 1 dB/s
+    if (state.noise_floor_db < 0.0) {
+        state.noise_floor_db = db;
+    } else if (db < state.noise_floor_db) {
+        state.noise_floor_db = 0.8 * state.noise_floor_db + 0.2 * db;
+    } else {
+        state.noise_floor_db += std::min(db - state.noise_floor_db, 0.01);
+    }
+
+    const bool speech = db > state.noise_floor_db + speech_margin_db && db > min_speech_db;
+    if (speech) {
+        ++state.speech_run;
+        state.silence_run = 0;
+        state.last_speech = state.frame_index;
+        if (state.open_start < 0 && state.speech_run >= open_frames) {
+            state.open_start = state.frame_index - (open_frames - 1);
+        }
+    } else {
+        state.speech_run = 0;
+        if (state.open_start >= 0 && ++state.silence_run >= close_frames) {
+            close_span(state);
+        }
+    }
+    ++state.frame_index;
+    state.frame.clear();
+}
+
+void vad_feed(VoiceActivityState &state, const int16_t *samples, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        state.frame.push_back(samples[i]);
+        if (state.frame.size() == frame_samples) {
+            process_frame(state);
+        }
+    }
+}
+
+std::vector<TimeSpan> vad_finish(VoiceActivityState &state) {
+    if (state.open_start >= 0) {
+        close_span(state);
+    }
+    return std::move(state.spans);
+}
+
+bool ffmpeg_available() {
+    static const bool found = []() {
+        const char *path = std::getenv("PATH");
+        std::string dirs = path ? path : "";
+        size_t begin = 0;
+        while (begin <= dirs.size()) {
+            size_t end = dirs.find(':', begin);
+            if (end == std::string::npos) {
+                end = dirs.size();
+            }
+            std::string dir = dirs.substr(begin, end - begin);
+            if (!dir.empty() && access((dir + "/ffmpeg").c_str(), X_OK) == 0) {
+                return true;
+            }
+            begin = end + 1;
+        }
+        return false;
+    }();
+    return found;
+}
+
+// ffmpeg writing raw samples of the first audio track to the write end of the pipe
+static pid_t spawn_ffmpeg(const std::string &media_file, int output_fd) {
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+    sigset_t default_signals;
+    sigemptyset(&default_signals);
+    sigaddset(&default_signals, SIGINT);
+    sigaddset(&default_signals, SIGTERM);
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setsigmask(&attr, &no_signals);
+    posix_spawnattr_setsigdefault(&attr, &default_signals);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, output_fd, STDOUT_FILENO);
+
+    const std::string rate = std::to_string(vad_sample_rate);
+    const char *argv[] = {"ffmpeg", "-nostdin", "-v", "error", "-i", media_file.c_str(), "-map", "0:a:0", "-vn",
+                          "-ac", "1", "-ar", rate.c_str(), "-f", "s16le", "-", nullptr};
+    pid_t pid = -1;
+    if (posix_spawnp(&pid, "ffmpeg", &actions, &attr, const_cast<char *const *>(argv), environ) != 0) {
+        pid = -1;
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    return pid;
+}
+
+bool extract_speech_spans(const std::string &media_file, std::vector<TimeSpan> &spans, std::string &error,
+                          const std::atomic<bool> *cancelled) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        error = std::string("Cannot create a pipe: ") + std::strerror(errno);
+        return false;
+    }
+    pid_t pid = spawn_ffmpeg(media_file, fds[1]);
+    close(fds[1]);
+    if (pid == -1) {
+        close(fds[0]);
+        error = "Cannot start ffmpeg";
+        return false;
+    }
+
+    // Samples are consumed as they arrive; an odd trailing byte waits for its other half
+    VoiceActivityState state;
+    std::vector<char> buffer(64 * 1024);
+    size_t carried = 0;
+    bool was_cancelled = false;
+    for (;;) {
+        if (cancelled && *cancelled) {
+            was_cancelled = true;
+            kill(pid, SIGTERM);
+            break;
+        }
+        ssize_t count = read(fds[0], buffer.data() + carried, buffer.size() - carried);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            break;
+        }
+        size_t available = carried + static_cast<size_t>(count);
+        size_t samples = available / sizeof(int16_t);
+        vad_feed(state, reinterpret_cast<const int16_t *>(buffer.data()), samples);
+        carried = available % sizeof(int16_t);
+        if (carried) {
+            buffer[0] = buffer[available - 1];
+        }
+    }
+    close(fds[0]);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+    }
+    if (was_cancelled) {
+        error = "Cancelled";
+        return false;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        error = "ffmpeg could not decode the audio of " + media_file;
+        return false;
+    }
+    spans = vad_finish(state);
+    return true;
+}
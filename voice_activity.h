@@ -0,0 +1,40 @@
+#ifndef VOICE_ACTIVITY_H
+#define VOICE_ACTIVITY_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "alignment.h"
+
+// Audio is decoded to this rate, mono, 16-bit; plenty for telling speech from silence
+static const int vad_sample_rate = 8000;
+
+// Streaming energy detector over 10 ms frames with an adaptive noise floor.
+// Memory use doesn't depend on the length of the audio, only on the number of spans found.
+struct VoiceActivityState {
+    std::vector<int16_t> frame;     // samples of the frame being filled
+    int16_t last_sample = 0;        // for the pre-emphasis filter across frames
+    int64_t frame_index = 0;
+    double noise_floor_db = -1.0;   // negative until the first frame
+    int speech_run = 0;             // consecutive speech frames
+    int silence_run = 0;            // consecutive silent frames inside a span
+    int64_t open_start = -1;        // first frame of the current span, -1 when outside one
+    int64_t last_speech = -1;
+    std::vector<TimeSpan> spans;
+};
+
+void vad_feed(VoiceActivityState &state, const int16_t *samples, size_t count);
+
+// Close a span still open at the end of the audio and hand out the result
+std::vector<TimeSpan> vad_finish(VoiceActivityState &state);
+
+// True when an ffmpeg executable is on the PATH
+bool ffmpeg_available();
+
+// Decode the first audio track of media_file through an ffmpeg pipe and detect the speech in it.
+// Polls cancelled between reads and kills ffmpeg once it is set.
+bool extract_speech_spans(const std::string &media_file, std::vector<TimeSpan> &spans, std::string &error,
+                          const std::atomic<bool> *cancelled);
+
+#endif // VOICE_ACTIVITY_H